@@ -0,0 +1,440 @@
+/*
+ * access.c -- the files with access control on open
+ *
+ * sculluid: one user at a time, others get -EBUSY
+ * scullwuid: one user at a time, others wait for the device to be released
+ * scullpriv: a private device for each controlling tty (or each user, for
+ *	processes without one), looked up in a hash table
+ *
+ * They share the read, write, llseek and ioctl of the bare devices and
+ * take the minors right after them.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/fcntl.h>
+#include <linux/cdev.h>
+#include <linux/tty.h>
+#include <linux/sched.h>
+#include <linux/cred.h>         /* current_uid(), current_euid() */
+#include <linux/capability.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/hash.h>
+#include <linux/rculist.h>
+#include <linux/ktime.h>
+
+#include "scull.h"
+
+/************************************************************************
+ *
+ * Next, the "uid" device. It can be opened multiple times by the
+ * same user, but access is denied to other users if the device is open
+ */
+
+static struct scull_dev scull_u_device;
+static int scull_u_count;       /* initialized to 0 by default */
+static kuid_t scull_u_owner;    /* valid while scull_u_count is not 0 */
+static DEFINE_SPINLOCK(scull_u_lock);
+
+/* may the current process open a device owned by @owner */
+static bool scull_a_allowed(kuid_t owner)
+{
+	return uid_eq(owner, current_uid()) || uid_eq(owner, current_euid()) ||
+		capable(CAP_DAC_OVERRIDE);
+}
+
+static int scull_u_open(struct inode *inode, struct file *filp)
+{
+	struct scull_dev *dev = &scull_u_device; /* device information */
+	int retval;
+
+	spin_lock(&scull_u_lock);
+	if (scull_u_count && !scull_a_allowed(scull_u_owner)) {
+		spin_unlock(&scull_u_lock);
+		return -EBUSY;   /* -EPERM would confuse the user */
+	}
+
+	if (scull_u_count == 0)
+		scull_u_owner = current_uid(); /* grab it */
+
+	scull_u_count++;
+	spin_unlock(&scull_u_lock);
+
+	/* then, everything else is copied from the bare scull device */
+	retval = scull_file_open(filp, dev);
+	if (retval) {
+		spin_lock(&scull_u_lock);
+		scull_u_count--;
+		spin_unlock(&scull_u_lock);
+	}
+	return retval;
+}
+
+static int scull_u_release(struct inode *inode, struct file *filp)
+{
+	spin_lock(&scull_u_lock);
+	scull_u_count--; /* nothing else */
+	spin_unlock(&scull_u_lock);
+	return scull_release(inode, filp);
+}
+
+/*
+ * The other operations for the device come from the bare device
+ */
+static struct file_operations scull_user_fops = {
+	.owner =          THIS_MODULE,
+	.llseek =         scull_llseek,
+	.read =           scull_read,
+	.write =          scull_write,
+	.unlocked_ioctl = scull_ioctl,
+	.open =           scull_u_open,
+	.release =        scull_u_release,
+	.fsync =          scull_fsync,
+	.fallocate =      scull_fallocate,
+#ifdef SCULL_URING
+	.uring_cmd =      scull_uring_cmd,
+#endif
+};
+
+/************************************************************************
+ *
+ * Next, the device with blocking-open based on uid
+ */
+
+static struct scull_dev scull_w_device;
+static int scull_w_count;       /* initialized to 0 by default */
+static kuid_t scull_w_owner;
+static DECLARE_WAIT_QUEUE_HEAD(scull_w_wait);
+static DEFINE_SPINLOCK(scull_w_lock);
+
+/* free or ours: checked again under scull_w_lock before taking it */
+static inline bool scull_w_available(void)
+{
+	return scull_w_count == 0 || scull_a_allowed(scull_w_owner);
+}
+
+/* one user less, the others may come in after the last one */
+static void scull_w_put(void)
+{
+	int temp;
+
+	spin_lock(&scull_w_lock);
+	scull_w_count--;
+	temp = scull_w_count;
+	spin_unlock(&scull_w_lock);
+
+	if (temp == 0)
+		wake_up_interruptible_sync(&scull_w_wait); /* awake other uid's */
+}
+
+static int scull_w_open(struct inode *inode, struct file *filp)
+{
+	struct scull_dev *dev = &scull_w_device; /* device information */
+	int retval;
+
+	spin_lock(&scull_w_lock);
+	while (!scull_w_available()) {
+		spin_unlock(&scull_w_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(scull_w_wait, scull_w_available()))
+			return -ERESTARTSYS; /* tell the fs layer to handle it */
+		spin_lock(&scull_w_lock);
+	}
+	if (scull_w_count == 0)
+		scull_w_owner = current_uid(); /* grab it */
+	scull_w_count++;
+	spin_unlock(&scull_w_lock);
+
+	/* then, everything else is copied from the bare scull device */
+	retval = scull_file_open(filp, dev);
+	if (retval)
+		scull_w_put();
+	return retval;
+}
+
+static int scull_w_release(struct inode *inode, struct file *filp)
+{
+	scull_w_put();
+	return scull_release(inode, filp);
+}
+
+/*
+ * The other operations for the device come from the bare device
+ */
+static struct file_operations scull_wusr_fops = {
+	.owner =          THIS_MODULE,
+	.llseek =         scull_llseek,
+	.read =           scull_read,
+	.write =          scull_write,
+	.unlocked_ioctl = scull_ioctl,
+	.open =           scull_w_open,
+	.release =        scull_w_release,
+	.fsync =          scull_fsync,
+	.fallocate =      scull_fallocate,
+#ifdef SCULL_URING
+	.uring_cmd =      scull_uring_cmd,
+#endif
+};
+
+/************************************************************************
+ *
+ * Finally the `cloned' private device. The original design kept the
+ * clones in a list searched under one lock; here the list is a hash
+ * table of SCULL_C_BUCKETS, each with its own lock.
+ *
+ * An open finds its clone without any lock (RCU). A first open allocates
+ * the clone outside the lock and inserts it under the lock of its bucket
+ * only, after looking again: of two racing first opens of the same key,
+ * the second frees its copy and uses the one already there. Clones are
+ * never removed before the module is unloaded, so a clone found may be
+ * used without a reference.
+ */
+
+/* a tty key has the top bit set, a uid key does not */
+#define SCULL_C_TTY         (1UL << (BITS_PER_LONG - 1))
+#define SCULL_C_HASH_BITS   8
+#define SCULL_C_BUCKETS     (1 << SCULL_C_HASH_BITS)
+
+struct scull_listitem {
+	struct scull_dev device;
+	unsigned long key;
+	struct hlist_node node;
+};
+
+struct scull_c_bucket {
+	spinlock_t lock;            /* taken by inserts only */
+	struct hlist_head head;
+};
+
+static struct scull_c_bucket scull_c_table[SCULL_C_BUCKETS];
+static atomic_t scull_c_count = ATOMIC_INIT(0);  /* clones so far */
+static int scull_c_first_index;     /* dev->index of the first clone */
+
+/* the key of the current process: its controlling tty, else its uid */
+static unsigned long scull_c_key(void)
+{
+	struct tty_struct *tty = get_current_tty();
+	unsigned long key;
+
+	if (tty) {
+		key = tty_devnum(tty) | SCULL_C_TTY;
+		tty_kref_put(tty);
+	} else {
+		key = __kuid_val(current_uid());
+	}
+	return key;
+}
+
+static struct scull_dev *scull_c_find(struct scull_c_bucket *b, unsigned long key)
+{
+	struct scull_listitem *lptr;
+
+	hlist_for_each_entry_rcu(lptr, &b->head, node)
+		if (lptr->key == key)
+			return &lptr->device;
+	return NULL;
+}
+
+/* look for a device or create one, never sleeping with a lock held */
+static struct scull_dev *scull_c_lookfor_device(unsigned long key)
+{
+	struct scull_c_bucket *b = &scull_c_table[hash_long(key, SCULL_C_HASH_BITS)];
+	struct scull_listitem *lptr;
+	struct scull_dev *dev;
+	u64 start;
+
+	rcu_read_lock();
+	dev = scull_c_find(b, key);
+	rcu_read_unlock();
+	if (dev)
+		return dev;
+
+	/* not found */
+	start = ktime_get_ns();
+	lptr = kzalloc(sizeof(struct scull_listitem), GFP_KERNEL);
+	if (!lptr)
+		return NULL;
+
+	/* initialize the device */
+	lptr->key = key;
+	scull_dev_init(&lptr->device, scull_c_first_index + atomic_inc_return(&scull_c_count) - 1);
+	lptr->device.access_key = key;
+	lptr->device.first_open_ns = ktime_get_ns() - start;
+
+	spin_lock(&b->lock);
+	dev = scull_c_find(b, key);
+	if (!dev) {
+		/* publishes the initialization above too */
+		hlist_add_head_rcu(&lptr->node, &b->head);
+		dev = &lptr->device;
+		lptr = NULL;
+	}
+	spin_unlock(&b->lock);
+
+	kfree(lptr);    /* lost the race, if not NULL */
+	return dev;
+}
+
+static int scull_c_open(struct inode *inode, struct file *filp)
+{
+	struct scull_dev *dev;
+
+	dev = scull_c_lookfor_device(scull_c_key());
+	if (!dev)
+		return -ENOMEM;
+
+	/* then, everything else is copied from the bare scull device */
+	return scull_file_open(filp, dev);
+}
+
+static int scull_c_release(struct inode *inode, struct file *filp)
+{
+	/*
+	 * Nothing to do for the device, because it is persistent.
+	 * A `real' cloned device should be freed on last close
+	 */
+	return scull_release(inode, filp);
+}
+
+/*
+ * The other operations for the device come from the bare device
+ */
+static struct file_operations scull_priv_fops = {
+	.owner =          THIS_MODULE,
+	.llseek =         scull_llseek,
+	.read =           scull_read,
+	.write =          scull_write,
+	.unlocked_ioctl = scull_ioctl,
+	.open =           scull_c_open,
+	.release =        scull_c_release,
+	.fsync =          scull_fsync,
+	.fallocate =      scull_fallocate,
+#ifdef SCULL_URING
+	.uring_cmd =      scull_uring_cmd,
+#endif
+};
+
+/************************************************************************
+ *
+ * And the init and cleanup functions come last
+ */
+
+static struct scull_adev_info {
+	char *name;
+	struct scull_dev *sculldev;
+	struct file_operations *fops;
+} scull_access_devs[] = {
+	{ "sculluid", &scull_u_device, &scull_user_fops },
+	{ "scullwuid", &scull_w_device, &scull_wusr_fops },
+	{ "scullpriv", NULL, &scull_priv_fops }
+};
+#define SCULL_N_ADEVS ARRAY_SIZE(scull_access_devs)
+
+static struct cdev scull_a_cdev[SCULL_N_ADEVS];
+static int scull_a_added;       /* how many of scull_a_cdev were added */
+static dev_t scull_a_firstdev;  /* where our range starts */
+
+/*
+ * Set up a single device, and the cdev of the clones.
+ */
+static int scull_access_setup(dev_t devno, struct scull_adev_info *devinfo,
+		struct cdev *cdev)
+{
+	int err;
+
+	/* initialize the device structure, if any */
+	if (devinfo->sculldev)
+		scull_dev_init(devinfo->sculldev, scull_nr_devs + MINOR(devno) -
+				MINOR(scull_a_firstdev));
+
+	/* do the cdev stuff */
+	cdev_init(cdev, devinfo->fops);
+	cdev->owner = THIS_MODULE;
+	err = cdev_add(cdev, devno, 1);
+	/* fail gracefully if need be */
+	if (err) {
+		pr_notice("error %d adding %s\n", err, devinfo->name);
+		return err;
+	}
+	return 0;
+}
+
+/*
+ * Take SCULL_N_ADEVS minors from @firstdev on. Returns how many, or a
+ * negative error.
+ */
+int scull_access_init(dev_t firstdev)
+{
+	int result, i;
+
+	/* get our number space */
+	result = register_chrdev_region(firstdev, SCULL_N_ADEVS, "sculla");
+	if (result < 0) {
+		pr_warn("sculla device number registration failed\n");
+		return result;
+	}
+	scull_a_firstdev = firstdev;
+
+	for (i = 0; i < SCULL_C_BUCKETS; i++) {
+		spin_lock_init(&scull_c_table[i].lock);
+		INIT_HLIST_HEAD(&scull_c_table[i].head);
+	}
+	scull_c_first_index = scull_nr_devs + SCULL_N_ADEVS;
+
+	/* set up each device */
+	for (i = 0; i < SCULL_N_ADEVS; i++) {
+		result = scull_access_setup(firstdev + i, scull_access_devs + i,
+				scull_a_cdev + i);
+		if (result) {
+			scull_access_cleanup();
+			return result;
+		}
+		scull_a_added++;
+	}
+	return SCULL_N_ADEVS;
+}
+
+/*
+ * This is called by cleanup_module or on failure.
+ * It is required to never fail, even if nothing was initialized first
+ */
+void scull_access_cleanup(void)
+{
+	struct scull_listitem *lptr;
+	struct hlist_node *next;
+	int i;
+
+	if (!scull_a_firstdev)
+		return;
+
+	/* clean up the static devs */
+	for (i = 0; i < scull_a_added; i++) {
+		struct scull_dev *dev = scull_access_devs[i].sculldev;
+
+		cdev_del(scull_a_cdev + i);
+		if (dev)
+			scull_dev_destroy(dev);
+	}
+	scull_a_added = 0;
+
+	/* and all the cloned devices, nobody can open them any more */
+	for (i = 0; i < SCULL_C_BUCKETS; i++) {
+		hlist_for_each_entry_safe(lptr, next, &scull_c_table[i].head, node) {
+			hlist_del(&lptr->node);
+			scull_dev_destroy(&lptr->device);
+			kfree(lptr);
+		}
+	}
+
+	/* Free the device numbers */
+	unregister_chrdev_region(scull_a_firstdev, SCULL_N_ADEVS);
+	scull_a_firstdev = 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * compute.c -- checksums and searches over a range of a device, in place
+ *
+ * SCULL_IOC_CHECKSUM and SCULL_IOC_FIND go over the bytes of a device
+ * where they are, in the quanta: verifying or searching a device costs
+ * reading its memory once, instead of a copy to user space and a system
+ * call for every buffer of it. Only the result is copied out. The holes
+ * are zeroes, as read() returns them, and quanta spilled to the backing
+ * file are read back first.
+ *
+ * crc32c() and the xxh64 of lib/ use the instructions of the CPU where
+ * the kernel has them (crc32 on x86 with SSE4.2, on arm64, ...). The
+ * module needs CONFIG_CRC32 (or LIBCRC32C) and CONFIG_XXHASH.
+ *
+ * dev->sem is held for SCULL_COMPUTE_CHUNK bytes at a time, then let go
+ * so that the readers and writers of a large device are not kept out for
+ * long. The result is thus not that of one instant of the device when it
+ * is written meanwhile. A signal stops the walk with EINTR between two
+ * chunks, and what was done so far is told: a CRC-32C goes on from there
+ * with its result as the seed, a search from @next.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>         /* kmalloc() */
+#include <linux/mm.h>           /* ZERO_PAGE() */
+#include <linux/errno.h>        /* error codes */
+#include <linux/types.h>
+#include <linux/string.h>       /* memchr() */
+#include <linux/sched.h>        /* cond_resched() */
+#include <linux/sched/signal.h> /* signal_pending() */
+#include <linux/crc32c.h>
+#include <linux/xxhash.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/uaccess.h>      /* copy_from_user(), put_user() */
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+#define SCULL_COMPUTE_CHUNK  (1 << 20)  /* bytes under one hold of dev->sem */
+
+/*
+ * A walk over the bytes of [@pos, @end): @fn is given them piece by
+ * piece, in order, and returns 0 to go on, 1 to stop, or -errno.
+ */
+struct scull_walk {
+	loff_t pos;     /* of the next piece */
+	loff_t end;
+	int (*fn)(struct scull_walk *w, const char *p, size_t n);
+};
+
+static int scull_walk_init(struct scull_walk *w, u64 pos, u64 len)
+{
+	if (pos > LLONG_MAX)
+		return -EINVAL;
+	w->pos = pos;
+	w->end = len > LLONG_MAX - pos ? LLONG_MAX : pos + len;
+	return 0;
+}
+
+/*
+ * Walk @w over @dev, up to its end if that comes first. Returns 0 when
+ * done or stopped by @fn, -EINTR on a signal.
+ */
+static int scull_walk(struct scull_dev *dev, struct scull_walk *w)
+{
+	const char *zeroes = page_address(ZERO_PAGE(0));
+	const char *from;
+	size_t chunk;
+	ssize_t n;
+	int retval = 0;
+
+	while (w->pos < w->end) {
+		if (down_interruptible(&dev->sem))
+			return -EINTR;
+		if (dev->mode != SCULL_MODE_BYTES)
+			retval = -EINVAL;
+
+		for (chunk = 0; !retval && chunk < SCULL_COMPUTE_CHUNK; chunk += n) {
+			if (w->pos >= dev->size)
+				w->end = w->pos;
+			if (w->pos >= w->end)
+				break;
+			n = scull_peek_locked(dev, w->pos, min_t(u64, w->end - w->pos,
+					SCULL_COMPUTE_CHUNK - chunk), &from);
+			if (n < 0) {
+				retval = n;
+				break;
+			}
+			if (!from) {
+				from = zeroes;
+				n = min_t(ssize_t, n, PAGE_SIZE);
+			}
+			retval = w->fn(w, from, n);
+			if (retval)
+				break;
+			w->pos += n;
+		}
+		up(&dev->sem);
+		if (retval)
+			return retval < 0 ? retval : 0;
+
+		cond_resched();
+		if (w->pos < w->end && signal_pending(current))
+			return -EINTR;
+	}
+	return 0;
+}
+
+struct scull_csum_walk {
+	struct scull_walk w;
+	u32 algo;
+	u32 crc;
+	struct xxh64_state xxh;
+};
+
+static int scull_csum_piece(struct scull_walk *w, const char *p, size_t n)
+{
+	struct scull_csum_walk *cw = container_of(w, struct scull_csum_walk, w);
+
+	if (cw->algo == SCULL_CSUM_CRC32C)
+		cw->crc = crc32c(cw->crc, p, n);
+	else
+		xxh64_update(&cw->xxh, p, n);
+	return 0;
+}
+
+/* SCULL_IOC_CHECKSUM */
+int scull_checksum(struct scull_dev *dev, struct scull_csum *cs)
+{
+	struct scull_csum_walk cw = { .w.fn = scull_csum_piece, .algo = cs->algo };
+	int retval;
+
+	if (cs->flags || (cs->algo != SCULL_CSUM_CRC32C && cs->algo != SCULL_CSUM_XXH64))
+		return -EINVAL;
+	if (cs->algo == SCULL_CSUM_CRC32C && cs->seed > U32_MAX)
+		return -EINVAL;
+	retval = scull_walk_init(&cw.w, cs->pos, cs->len);
+	if (retval)
+		return retval;
+
+	/* as zlib's crc32(): the result of a range is the seed of the next */
+	cw.crc = ~(u32)cs->seed;
+	xxh64_reset(&cw.xxh, cs->seed);
+
+	retval = scull_walk(dev, &cw.w);
+	cs->done = cw.w.pos - cs->pos;
+	if (cs->algo == SCULL_CSUM_CRC32C)
+		cs->result = ~cw.crc;
+	else
+		cs->result = xxh64_digest(&cw.xxh);
+	return retval;
+}
+
+/*
+ * @carry: the last @carried bytes before the piece, at most
+ * @pattern_len - 1, which a match may start in, and room to add as many
+ * of the piece to them
+ */
+struct scull_find_walk {
+	struct scull_walk w;
+	struct scull_find *f;
+	u64 __user *matches;
+	u32 carried;
+	u8 pattern[SCULL_FIND_PATTERN_MAX];
+	u8 carry[2 * SCULL_FIND_PATTERN_MAX];
+};
+
+/* a match at @pos; 1 once @matches is full */
+static int scull_find_match(struct scull_find_walk *fw, loff_t pos)
+{
+	struct scull_find *f = fw->f;
+
+	if (put_user(pos, &fw->matches[f->nr]))
+		return -EFAULT;
+	if (++f->nr < f->max)
+		return 0;
+	f->next = pos + 1;
+	return 1;
+}
+
+/* the matches in the @n bytes at @p, which are at @pos, starting in the first @starts */
+static int scull_find_in(struct scull_find_walk *fw, const u8 *p, size_t n,
+		size_t starts, loff_t pos)
+{
+	u32 len = fw->f->pattern_len;
+	const u8 *s = p, *end;
+	int retval;
+
+	if (n < len)
+		return 0;
+	end = p + min(starts, n - len + 1);
+	while (s < end && (s = memchr(s, fw->pattern[0], end - s))) {
+		if (!memcmp(s + 1, fw->pattern + 1, len - 1)) {
+			retval = scull_find_match(fw, pos + (s - p));
+			if (retval)
+				return retval;
+		}
+		s++;
+	}
+	return 0;
+}
+
+static int scull_find_piece(struct scull_walk *w, const char *p, size_t n)
+{
+	struct scull_find_walk *fw = container_of(w, struct scull_find_walk, w);
+	size_t keep = fw->f->pattern_len - 1, head = min(n, keep), all;
+	int retval;
+
+	/* the matches across the start of the piece */
+	memcpy(fw->carry + fw->carried, p, head);
+	if (fw->carried) {
+		retval = scull_find_in(fw, fw->carry, fw->carried + head, fw->carried,
+				w->pos - fw->carried);
+		if (retval)
+			return retval;
+	}
+	retval = scull_find_in(fw, (const u8 *)p, n, n, w->pos);
+	if (retval)
+		return retval;
+
+	if (n >= keep) {
+		memcpy(fw->carry, p + n - keep, keep);
+		fw->carried = keep;
+		return 0;
+	}
+	all = fw->carried + n;
+	if (all > keep) {
+		memmove(fw->carry, fw->carry + all - keep, keep);
+		all = keep;
+	}
+	fw->carried = all;
+	return 0;
+}
+
+/* SCULL_IOC_FIND */
+int scull_find(struct scull_dev *dev, struct scull_find *f)
+{
+	struct scull_find_walk *fw;
+	int retval;
+
+	if (f->flags || !f->pattern_len || f->pattern_len > SCULL_FIND_PATTERN_MAX || !f->max)
+		return -EINVAL;
+	fw = kzalloc(sizeof(*fw), GFP_KERNEL);
+	if (!fw)
+		return -ENOMEM;
+	retval = scull_walk_init(&fw->w, f->pos, f->len);
+	if (retval)
+		goto out;
+	if (copy_from_user(fw->pattern, u64_to_user_ptr(f->pattern), f->pattern_len)) {
+		retval = -EFAULT;
+		goto out;
+	}
+	fw->w.fn = scull_find_piece;
+	fw->f = f;
+	fw->matches = u64_to_user_ptr(f->matches);
+	f->nr = 0;
+	f->next = 0;
+
+	retval = scull_walk(dev, &fw->w);
+	if (f->nr == f->max)
+		goto out;   /* @next was set */
+	f->next = fw->w.pos;
+	/* stopped early, the matches starting in the bytes carried are still to be found */
+	if (retval == -EINTR)
+		f->next -= fw->carried;
+out:
+	kfree(fw);
+	return retval;
+}
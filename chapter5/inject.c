@@ -0,0 +1,138 @@
+/*
+ * inject.c -- latency and failure injection
+ *
+ * All the draws are made with dev->sem held, from a per-device xorshift
+ * generator rather than the kernel's: a given seed and sequence of calls
+ * gives the same delays and failures on every kernel, and in user space.
+ * Nothing here sleeps, scull_read() and scull_write() sleep for the delay
+ * themselves once the semaphore is released.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/math64.h>   /* div_u64() */
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+#define SCULL_INJECT_SEED 0x9e3779b97f4a7c15ULL /* used for seed 0 */
+
+/* xorshift64*, 32 random bits */
+static u32 scull_inject_rand(struct scull_dev *dev)
+{
+	u64 x = dev->inject_rnd;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	dev->inject_rnd = x;
+	return (x * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+/* true @ppm times per million */
+static bool scull_inject_chance(struct scull_dev *dev, u32 ppm)
+{
+	return ppm && scull_inject_rand(dev) % 1000000 < ppm;
+}
+
+/*
+ * delay_us * 2^(-log2(u) / alpha), u uniform in (0, 1]: a pareto of
+ * minimum delay_us and shape alpha. log2 and 2^x are interpolated linearly
+ * between powers of two, in 1/65536, which keeps the quantiles within
+ * about 10% of the exact distribution.
+ */
+static u32 scull_inject_pareto(struct scull_dev *dev)
+{
+	struct scull_inject *in = &dev->inject;
+	u32 r = scull_inject_rand(dev) | 1;     /* u is r / 2^32 */
+	int hi = fls(r) - 1;
+	u64 frac = ((u64)(r - (1U << hi)) << 16) >> hi;
+	u64 e = div_u64(((((u64)(32 - hi)) << 16) - frac) * 100, in->pareto_alpha);
+	u64 d;
+
+	if ((e >> 16) >= 32)
+		return in->delay_max_us;
+	d = (u64)in->delay_us << (e >> 16);
+	d += (d * (e & 0xffff)) >> 16;
+	return min_t(u64, d, in->delay_max_us);
+}
+
+/*
+ * Replace the settings of @dev by @conf, restart the generator from
+ * @conf->seed and clear the counters.
+ */
+int scull_inject_set(struct scull_dev *dev, const struct scull_inject *conf)
+{
+	struct scull_inject *in = &dev->inject;
+
+	if (conf->delay_mode > SCULL_DELAY_PARETO ||
+	    conf->enomem_ppm > 1000000 || conf->short_ppm > 1000000 ||
+	    conf->delay_us > SCULL_INJECT_MAX_US ||
+	    conf->delay_max_us > SCULL_INJECT_MAX_US)
+		return -EINVAL;
+	if ((conf->delay_mode == SCULL_DELAY_UNIFORM ||
+	     conf->delay_mode == SCULL_DELAY_PARETO) &&
+	    conf->delay_max_us < conf->delay_us)
+		return -EINVAL;
+	if (conf->delay_mode == SCULL_DELAY_PARETO && !conf->pareto_alpha)
+		return -EINVAL;
+
+	memset(in, 0, sizeof(*in));
+	in->delay_mode = conf->delay_mode;
+	in->delay_us = conf->delay_us;
+	in->delay_max_us = conf->delay_max_us;
+	in->pareto_alpha = conf->pareto_alpha;
+	in->enomem_ppm = conf->enomem_ppm;
+	in->short_ppm = conf->short_ppm;
+	in->seed = conf->seed;
+	dev->inject_rnd = conf->seed ? conf->seed : SCULL_INJECT_SEED;
+	return 0;
+}
+
+/* microseconds to wait before returning from this read or write */
+u32 scull_inject_delay(struct scull_dev *dev)
+{
+	struct scull_inject *in = &dev->inject;
+	u32 us;
+
+	switch (in->delay_mode) {
+	case SCULL_DELAY_FIXED:
+		us = in->delay_us;
+		break;
+	case SCULL_DELAY_UNIFORM:
+		us = in->delay_us + (u32)(((u64)scull_inject_rand(dev) *
+				(in->delay_max_us - in->delay_us + 1)) >> 32);
+		break;
+	case SCULL_DELAY_PARETO:
+		us = scull_inject_pareto(dev);
+		break;
+	default:
+		return 0;
+	}
+	in->delayed++;
+	in->delay_total_us += us;
+	return us;
+}
+
+/* should this quantum allocation fail? */
+bool scull_inject_enomem(struct scull_dev *dev)
+{
+	if (!scull_inject_chance(dev, dev->inject.enomem_ppm))
+		return false;
+	dev->inject.enomem++;
+	return true;
+}
+
+/* @count, or less than that if a short transfer is injected */
+size_t scull_inject_short(struct scull_dev *dev, size_t count)
+{
+	if (count < 2 || !scull_inject_chance(dev, dev->inject.short_ppm))
+		return count;
+	dev->inject.short_xfers++;
+	return 1 + scull_inject_rand(dev) % (count - 1);
+}
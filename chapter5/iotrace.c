@@ -0,0 +1,172 @@
+/*
+ * iotrace.c -- a ring of the reads and writes of a device, for replay
+ *
+ * SCULL_IOC_IOTRACE gives a device a ring of records, and from then on
+ * every read() and write() of it adds one as it returns: when it came
+ * in, the thread, the position and length asked, what it returned, how
+ * long it took and how much of that was the wait for dev->sem.
+ * SCULL_IOC_IOTRACE_READ takes them out, oldest first; scull_replay
+ * drains them to a file and plays such a file back on a device.
+ *
+ * When the ring is full the new records are dropped, and counted: the
+ * old ones are what a drainer that fell behind wants first. Adding one
+ * is a copy of 40 bytes under the spinlock of the ring, after dev->sem
+ * was let go. Draining copies to user space without it: the writers only
+ * fill the slots past the head, never those between the tail and the
+ * head, and a single drainer goes at a time, under scull_iotrace_mutex,
+ * which also keeps the ring from being freed meanwhile.
+ *
+ * The readers and writers find the ring under RCU, and never wait for
+ * one being set up or taken away.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kvzalloc() */
+#include <linux/mm.h>       /* kvfree() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/log2.h>     /* is_power_of_2() */
+#include <linux/overflow.h> /* struct_size() */
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>    /* current */
+#include <linux/ktime.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/uaccess.h>  /* copy_to_user() */
+
+#include "scull.h"
+
+/*
+ * @lock: protects @head, @tail and @lost
+ * @head, @tail: records ever added and taken, @recs[n & @mask] is record n
+ */
+struct scull_iotrace {
+	spinlock_t lock;
+	u64 head;
+	u64 tail;
+	u64 lost;
+	u32 mask;
+	struct scull_iotrace_rec recs[];
+};
+
+/* the drainers, and those setting up or taking away a ring */
+static DEFINE_MUTEX(scull_iotrace_mutex);
+
+static struct scull_iotrace *scull_iotrace_get(struct scull_dev *dev)
+{
+	return rcu_dereference_protected(dev->iotrace,
+			lockdep_is_held(&scull_iotrace_mutex));
+}
+
+/* a ring of @nr records for @dev instead of the one it has, 0: none */
+int scull_iotrace_set(struct scull_dev *dev, unsigned long nr)
+{
+	struct scull_iotrace *tr = NULL, *old;
+
+	if (nr && (!is_power_of_2(nr) || nr > SCULL_IOTRACE_MAX))
+		return -EINVAL;
+	if (nr) {
+		tr = kvzalloc(struct_size(tr, recs, nr), GFP_KERNEL);
+		if (!tr)
+			return -ENOMEM;
+		spin_lock_init(&tr->lock);
+		tr->mask = nr - 1;
+	}
+
+	mutex_lock(&scull_iotrace_mutex);
+	old = scull_iotrace_get(dev);
+	rcu_assign_pointer(dev->iotrace, tr);
+	mutex_unlock(&scull_iotrace_mutex);
+
+	if (old) {
+		synchronize_rcu();  /* the last scull_iotrace_add() on it */
+		kvfree(old);
+	}
+	return 0;
+}
+
+static inline u32 scull_iotrace_u32(u64 v)
+{
+	return v > U32_MAX ? U32_MAX : v;
+}
+
+/* a read or write of @dev which started at @start returns @result */
+void scull_iotrace_add(struct scull_dev *dev, int op, u64 start, loff_t pos,
+		size_t len, ssize_t result, u64 wait_ns)
+{
+	struct scull_iotrace_rec *r;
+	struct scull_iotrace *tr;
+	u64 lat;
+
+	if (!start)
+		return;
+	lat = ktime_get_ns() - start;
+
+	rcu_read_lock();
+	tr = rcu_dereference(dev->iotrace);
+	if (tr) {
+		spin_lock(&tr->lock);
+		if (tr->head - tr->tail > tr->mask) {
+			tr->lost++;
+		} else {
+			r = &tr->recs[tr->head & tr->mask];
+			r->ts_ns = start;
+			r->pos = pos;
+			r->len = scull_iotrace_u32(len);
+			r->result = result;
+			r->lat_ns = scull_iotrace_u32(lat);
+			r->wait_ns = scull_iotrace_u32(wait_ns);
+			r->pid = current->pid;
+			r->op = op;
+			tr->head++;
+		}
+		spin_unlock(&tr->lock);
+	}
+	rcu_read_unlock();
+}
+
+/* SCULL_IOC_IOTRACE_READ */
+int scull_iotrace_read(struct scull_dev *dev, struct scull_iotrace_read *rd)
+{
+	struct scull_iotrace_rec __user *buf = u64_to_user_ptr(rd->buf);
+	struct scull_iotrace *tr;
+	u64 head, tail, n, first;
+	int retval = 0;
+
+	mutex_lock(&scull_iotrace_mutex);
+	tr = scull_iotrace_get(dev);
+	if (!tr) {
+		retval = -ENODATA;
+		goto out;
+	}
+	spin_lock(&tr->lock);
+	head = tr->head;
+	tail = tr->tail;
+	rd->lost = tr->lost;
+	spin_unlock(&tr->lock);
+
+	/* up to the end of the ring, then from its start */
+	n = min_t(u64, head - tail, rd->nr);
+	first = min_t(u64, n, tr->mask + 1 - (tail & tr->mask));
+	if (copy_to_user(buf, &tr->recs[tail & tr->mask], first * sizeof(*buf)) ||
+	    copy_to_user(buf + first, &tr->recs[0], (n - first) * sizeof(*buf))) {
+		retval = -EFAULT;
+		goto out;
+	}
+
+	spin_lock(&tr->lock);
+	tr->tail = tail + n;
+	spin_unlock(&tr->lock);
+	rd->got = n;
+out:
+	mutex_unlock(&scull_iotrace_mutex);
+	return retval;
+}
+
+/* the device goes away, nobody has it open */
+void scull_iotrace_free(struct scull_dev *dev)
+{
+	kvfree(rcu_dereference_protected(dev->iotrace, 1));
+	RCU_INIT_POINTER(dev->iotrace, NULL);
+}
@@ -0,0 +1,552 @@
+/*
+ * kv.c -- the key/value mode of a device
+ *
+ * In SCULL_MODE_KV a device is a cache of values looked up by key,
+ * through the SCULL_IOC_KV_* ioctls; read() and write() are refused.
+ *
+ * The items are in an rhashtable, which grows and shrinks by itself.
+ * A get takes no lock: it finds the item under rcu_read_lock() and keeps
+ * it with a reference while it copies the value out, so that a put or a
+ * delete of the same key can go on meanwhile. Writers (put, delete and
+ * eviction) take kv->lock, which also protects the LRU list.
+ *
+ * A value is kept in quanta of the device's quantum size, like the bytes
+ * of the other modes. When the items of a device take more than
+ * scull_kv_max_bytes, the least recently used ones are evicted. A get
+ * does not move its item on the list, which would need the lock: it sets
+ * item->accessed, and eviction gives such items a second chance at the
+ * tail of the list instead. An item past its TTL is a miss at once, its
+ * memory comes back when eviction gets to it, or its key is put again.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+
+#include "scull.h"
+
+/*
+ * @refs: one for the table, one for each get copying the value out
+ * @accessed: set by gets since eviction last looked at the item
+ * @expires: in jiffies, 0 if never
+ * @bytes: what the item costs, counted in kv->bytes
+ * @data: the value, in DIV_ROUND_UP(@vlen, @quantum) quanta
+ */
+struct scull_kv_item {
+	struct rhash_head node;
+	struct list_head lru;
+	struct rcu_head rcu;
+	atomic_t refs;
+	int accessed;
+	unsigned long expires;
+	size_t bytes;
+	u32 vlen;
+	u32 klen;
+	int quantum;
+	char **data;
+	char key[];
+};
+
+/* counted by the gets, per cpu so that they do not share a cache line */
+struct scull_kv_pcpu {
+	u64 hits;
+	u64 misses;
+};
+
+/*
+ * @lock: taken by writers, for @ht, @lru and the counters
+ * @lru: items by last use, the least recent first
+ */
+struct scull_kv {
+	struct rhashtable ht;
+	spinlock_t lock;
+	struct list_head lru;
+	unsigned long items;
+	u64 bytes;
+	u64 evictions;
+	u64 expired;
+	struct scull_kv_pcpu __percpu *pcpu;
+};
+
+/* what a lookup is given, the key of an item is in the item */
+struct scull_kv_key {
+	const char *key;
+	u32 len;
+};
+
+static u32 scull_kv_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct scull_kv_key *k = data;
+
+	return jhash(k->key, k->len, seed);
+}
+
+static u32 scull_kv_obj_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct scull_kv_item *item = data;
+
+	return jhash(item->key, item->klen, seed);
+}
+
+static int scull_kv_cmpfn(struct rhashtable_compare_arg *arg, const void *obj)
+{
+	const struct scull_kv_key *k = arg->key;
+	const struct scull_kv_item *item = obj;
+
+	return k->len != item->klen || memcmp(k->key, item->key, k->len);
+}
+
+static const struct rhashtable_params scull_kv_params = {
+	.head_offset = offsetof(struct scull_kv_item, node),
+	.key_len = sizeof(struct scull_kv_key),
+	.hashfn = scull_kv_hashfn,
+	.obj_hashfn = scull_kv_obj_hashfn,
+	.obj_cmpfn = scull_kv_cmpfn,
+	.automatic_shrinking = true,
+};
+
+static void scull_kv_item_free(struct scull_kv_item *item)
+{
+	int i;
+
+	if (item->data)
+		for (i = 0; i < DIV_ROUND_UP(item->vlen, item->quantum); i++)
+			kfree(item->data[i]);
+	kfree(item->data);
+	kfree(item);
+}
+
+static void scull_kv_item_free_rcu(struct rcu_head *head)
+{
+	scull_kv_item_free(container_of(head, struct scull_kv_item, rcu));
+}
+
+/* a get may still find it in the table until a grace period is over */
+static void scull_kv_item_put(struct scull_kv_item *item)
+{
+	if (atomic_dec_and_test(&item->refs))
+		call_rcu(&item->rcu, scull_kv_item_free_rcu);
+}
+
+static bool scull_kv_expired(const struct scull_kv_item *item)
+{
+	return item->expires && time_after_eq(jiffies, item->expires);
+}
+
+/* take @item out of the table and the list, with kv->lock held */
+static void scull_kv_unlink(struct scull_kv *kv, struct scull_kv_item *item)
+{
+	rhashtable_remove_fast(&kv->ht, &item->node, scull_kv_params);
+	list_del(&item->lru);
+	kv->items--;
+	kv->bytes -= item->bytes;
+	scull_kv_item_put(item);
+}
+
+/*
+ * Evict until the items fit in @max_bytes, with kv->lock held. An item
+ * got since it was last looked at goes to the tail instead, once: two
+ * passes over the list at most.
+ */
+static void scull_kv_shrink(struct scull_kv *kv, u64 max_bytes)
+{
+	struct scull_kv_item *item;
+	unsigned long passes = 2 * kv->items;
+
+	while (kv->bytes > max_bytes && !list_empty(&kv->lru)) {
+		item = list_first_entry(&kv->lru, struct scull_kv_item, lru);
+		if (scull_kv_expired(item)) {
+			kv->expired++;
+		} else if (passes && READ_ONCE(item->accessed)) {
+			/* no more second chances once @passes is used up */
+			passes--;
+			WRITE_ONCE(item->accessed, 0);
+			list_move_tail(&item->lru, &kv->lru);
+			continue;
+		} else {
+			kv->evictions++;
+		}
+		scull_kv_unlink(kv, item);
+	}
+}
+
+/*
+ * Give @dev its table, before it is first put in KV mode. It stays
+ * until the device is freed, see scull_kv_free(), so that the lockless
+ * gets never find it gone.
+ */
+int scull_kv_setup(struct scull_dev *dev)
+{
+	struct scull_kv *kv;
+	int retval;
+
+	if (READ_ONCE(dev->kv))
+		return 0;
+	kv = kzalloc(sizeof(struct scull_kv), GFP_KERNEL);
+	if (!kv)
+		return -ENOMEM;
+	kv->pcpu = alloc_percpu(struct scull_kv_pcpu);
+	if (!kv->pcpu) {
+		kfree(kv);
+		return -ENOMEM;
+	}
+	retval = rhashtable_init(&kv->ht, &scull_kv_params);
+	if (retval) {
+		free_percpu(kv->pcpu);
+		kfree(kv);
+		return retval;
+	}
+	spin_lock_init(&kv->lock);
+	INIT_LIST_HEAD(&kv->lru);
+
+	/* as in scull_get_dev(): the first one wins */
+	if (cmpxchg(&dev->kv, NULL, kv)) {
+		rhashtable_destroy(&kv->ht);
+		free_percpu(kv->pcpu);
+		kfree(kv);
+	}
+	return 0;
+}
+
+/*
+ * Drop every item, after dev->mode was changed: a put that took the lock
+ * before us is dropped here, one after us sees the new mode.
+ */
+void scull_kv_clear(struct scull_dev *dev)
+{
+	struct scull_kv *kv = READ_ONCE(dev->kv);
+	int cpu;
+
+	if (!kv)
+		return;
+	spin_lock(&kv->lock);
+	scull_kv_shrink(kv, 0);
+	kv->evictions = kv->expired = 0;
+	spin_unlock(&kv->lock);
+	/* racy with the gets of the old mode, as the counters can be */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(kv->pcpu, cpu), 0, sizeof(struct scull_kv_pcpu));
+}
+
+/* the device goes away, nobody has it open */
+void scull_kv_free(struct scull_dev *dev)
+{
+	struct scull_kv *kv = dev->kv;
+
+	if (!kv)
+		return;
+	scull_kv_clear(dev);
+	rcu_barrier();      /* the items are freed by call_rcu() */
+	rhashtable_destroy(&kv->ht);
+	free_percpu(kv->pcpu);
+	kfree(kv);
+	dev->kv = NULL;
+}
+
+/* check a key from user space and copy it to @key */
+static int scull_kv_get_key(const struct scull_kv_op *op, char *key)
+{
+	if (!op->klen || op->klen > SCULL_KV_KEY_MAX)
+		return -EINVAL;
+	if (copy_from_user(key, (const char __user *)(uintptr_t)op->key, op->klen))
+		return -EFAULT;
+	return 0;
+}
+
+/* a new item for @op, its key and value copied in, not in the table yet */
+static struct scull_kv_item *scull_kv_item_new(struct scull_dev *dev,
+		const struct scull_kv_op *op, int *err)
+{
+	const char __user *val = (const char __user *)(uintptr_t)op->val;
+	int quantum = READ_ONCE(dev->quantum), nr, i;
+	struct scull_kv_item *item;
+	u32 done, len;
+
+	*err = -ENOMEM;
+	item = kzalloc(sizeof(*item) + op->klen, GFP_KERNEL);
+	if (!item)
+		return NULL;
+	item->klen = op->klen;
+	item->vlen = op->vlen;
+	item->quantum = quantum;
+	atomic_set(&item->refs, 1);
+	*err = scull_kv_get_key(op, item->key);
+	if (*err)
+		goto fail;
+
+	*err = -ENOMEM;
+	nr = DIV_ROUND_UP(op->vlen, quantum);
+	item->bytes = sizeof(*item) + op->klen + nr * (sizeof(char *) + quantum);
+	item->data = kcalloc(nr, sizeof(char *), GFP_KERNEL);
+	if (nr && !item->data)
+		goto fail;
+	for (i = 0, done = 0; i < nr; i++, done += len) {
+		len = min_t(u32, quantum, op->vlen - done);
+		item->data[i] = kmalloc(quantum, GFP_KERNEL);
+		if (!item->data[i])
+			goto fail;
+		if (copy_from_user(item->data[i], val + done, len)) {
+			*err = -EFAULT;
+			goto fail;
+		}
+	}
+	*err = 0;
+	return item;
+
+fail:
+	scull_kv_item_free(item);
+	return NULL;
+}
+
+/*
+ * SCULL_IOC_KV_PUT: insert or replace op->key. The value is copied in
+ * before the lock is taken, the gets of the old value go on meanwhile.
+ */
+static int scull_kv_put(struct scull_dev *dev, struct scull_kv *kv,
+		const struct scull_kv_op *op)
+{
+	u64 max_bytes = READ_ONCE(scull_kv_max_bytes);
+	unsigned int ttl_ms = op->ttl_ms ? op->ttl_ms : READ_ONCE(scull_kv_ttl_ms);
+	struct scull_kv_item *item, *old;
+	struct scull_kv_key k;
+	int retval;
+
+	if (op->vlen > SCULL_KV_VAL_MAX)
+		return -E2BIG;
+	item = scull_kv_item_new(dev, op, &retval);
+	if (!item)
+		return retval;
+	if (item->bytes > max_bytes) {
+		scull_kv_item_free(item);
+		return -E2BIG;
+	}
+	if (ttl_ms)
+		item->expires = (jiffies + msecs_to_jiffies(ttl_ms)) | 1;
+	k.key = item->key;
+	k.len = item->klen;
+
+	spin_lock(&kv->lock);
+	/* see scull_kv_clear() */
+	if (READ_ONCE(dev->mode) != SCULL_MODE_KV) {
+		retval = -EINVAL;
+		goto out;
+	}
+	old = rhashtable_lookup_fast(&kv->ht, &k, scull_kv_params);
+	if (old)
+		retval = rhashtable_replace_fast(&kv->ht, &old->node, &item->node,
+				scull_kv_params);
+	else
+		retval = rhashtable_insert_fast(&kv->ht, &item->node, scull_kv_params);
+	if (retval)
+		goto out;
+	if (old) {
+		list_del(&old->lru);
+		kv->items--;
+		kv->bytes -= old->bytes;
+		scull_kv_item_put(old);
+	}
+	list_add_tail(&item->lru, &kv->lru);
+	kv->items++;
+	kv->bytes += item->bytes;
+	item = NULL;
+	scull_kv_shrink(kv, max_bytes);
+out:
+	spin_unlock(&kv->lock);
+	if (item)
+		scull_kv_item_free(item);
+	return retval;
+}
+
+/*
+ * One get: copy the value of op->key to op->val, and its length to
+ * op->vlen. -ENOENT if there is no such key, -EMSGSIZE if op->vlen is
+ * too small, op->vlen is then what it takes.
+ */
+static int scull_kv_get(struct scull_kv *kv, struct scull_kv_op *op)
+{
+	char __user *val = (char __user *)(uintptr_t)op->val;
+	char key[SCULL_KV_KEY_MAX];
+	struct scull_kv_key k = { .key = key, .len = op->klen };
+	struct scull_kv_item *item;
+	u32 done, len;
+	int i, retval;
+
+	retval = scull_kv_get_key(op, key);
+	if (retval)
+		return retval;
+
+	rcu_read_lock();
+	item = rhashtable_lookup_fast(&kv->ht, &k, scull_kv_params);
+	if (item && (scull_kv_expired(item) || !atomic_inc_not_zero(&item->refs)))
+		item = NULL;
+	rcu_read_unlock();
+	if (!item) {
+		this_cpu_inc(kv->pcpu->misses);
+		return -ENOENT;
+	}
+	this_cpu_inc(kv->pcpu->hits);
+	if (!READ_ONCE(item->accessed))
+		WRITE_ONCE(item->accessed, 1);
+
+	if (op->vlen < item->vlen) {
+		retval = -EMSGSIZE;
+	} else {
+		for (i = 0, done = 0; done < item->vlen; i++, done += len) {
+			len = min_t(u32, item->quantum, item->vlen - done);
+			if (copy_to_user(val + done, item->data[i], len)) {
+				retval = -EFAULT;
+				break;
+			}
+		}
+	}
+	op->vlen = item->vlen;
+	scull_kv_item_put(item);
+	return retval;
+}
+
+/* SCULL_IOC_KV_DELETE */
+static int scull_kv_delete(struct scull_dev *dev, struct scull_kv *kv,
+		const struct scull_kv_op *op)
+{
+	char key[SCULL_KV_KEY_MAX];
+	struct scull_kv_key k = { .key = key, .len = op->klen };
+	struct scull_kv_item *item;
+	int retval;
+
+	retval = scull_kv_get_key(op, key);
+	if (retval)
+		return retval;
+
+	spin_lock(&kv->lock);
+	item = rhashtable_lookup_fast(&kv->ht, &k, scull_kv_params);
+	if (item)
+		scull_kv_unlink(kv, item);
+	spin_unlock(&kv->lock);
+	return item ? 0 : -ENOENT;
+}
+
+/*
+ * SCULL_IOC_KV_MGET: the gets of m->nr operations in one call, each
+ * with its own result. Returns how many keys were found.
+ */
+static int scull_kv_mget(struct scull_kv *kv, struct scull_kv_mget *m)
+{
+	struct scull_kv_op __user *uops = (struct scull_kv_op __user *)(uintptr_t)m->ops;
+	struct scull_kv_op *ops;
+	int i, retval = 0;
+
+	if (m->nr > SCULL_KV_MGET_MAX)
+		return -EINVAL;
+	ops = kmalloc_array(m->nr, sizeof(*ops), GFP_KERNEL);
+	if (m->nr && !ops)
+		return -ENOMEM;
+	if (copy_from_user(ops, uops, m->nr * sizeof(*ops))) {
+		retval = -EFAULT;
+		goto out;
+	}
+
+	m->found = 0;
+	for (i = 0; i < m->nr; i++) {
+		ops[i].result = scull_kv_get(kv, &ops[i]);
+		if (!ops[i].result)
+			m->found++;
+	}
+	if (copy_to_user(uops, ops, m->nr * sizeof(*ops)))
+		retval = -EFAULT;
+	else
+		retval = m->found;
+out:
+	kfree(ops);
+	return retval;
+}
+
+static void scull_kv_get_stats(struct scull_kv *kv, struct scull_kv_stats *st)
+{
+	struct scull_kv_pcpu *p;
+	int cpu;
+
+	st->hits = st->misses = 0;
+	for_each_possible_cpu(cpu) {
+		p = per_cpu_ptr(kv->pcpu, cpu);
+		st->hits += READ_ONCE(p->hits);
+		st->misses += READ_ONCE(p->misses);
+	}
+	spin_lock(&kv->lock);
+	st->items = kv->items;
+	st->bytes = kv->bytes;
+	st->evictions = kv->evictions;
+	st->expired = kv->expired;
+	spin_unlock(&kv->lock);
+	st->max_bytes = READ_ONCE(scull_kv_max_bytes);
+}
+
+/*
+ * The SCULL_IOC_KV_* ioctls, without dev->sem. Only a device in KV mode
+ * has them; @write tells if the file was opened for writing.
+ */
+long scull_kv_ioctl(struct scull_dev *dev, unsigned int cmd, unsigned long arg,
+		bool write)
+{
+	struct scull_kv *kv = READ_ONCE(dev->kv);
+	struct scull_kv_stats st;
+	struct scull_kv_mget m;
+	struct scull_kv_op op;
+	int retval;
+
+	if (READ_ONCE(dev->mode) != SCULL_MODE_KV || !kv)
+		return -EINVAL;
+
+	switch (cmd) {
+	case SCULL_IOC_KV_PUT:
+	case SCULL_IOC_KV_DELETE:
+		if (!write)
+			return -EPERM;
+		if (copy_from_user(&op, (void __user *)arg, sizeof(op)))
+			return -EFAULT;
+		if (cmd == SCULL_IOC_KV_PUT)
+			return scull_kv_put(dev, kv, &op);
+		return scull_kv_delete(dev, kv, &op);
+
+	case SCULL_IOC_KV_GET:
+		if (copy_from_user(&op, (void __user *)arg, sizeof(op)))
+			return -EFAULT;
+		retval = scull_kv_get(kv, &op);
+		/* the caller learns the length of a value too large for it */
+		if ((!retval || retval == -EMSGSIZE) &&
+		    copy_to_user((void __user *)arg, &op, sizeof(op)))
+			return -EFAULT;
+		return retval;
+
+	case SCULL_IOC_KV_MGET:
+		if (copy_from_user(&m, (void __user *)arg, sizeof(m)))
+			return -EFAULT;
+		retval = scull_kv_mget(kv, &m);
+		if (retval >= 0 && copy_to_user((void __user *)arg, &m, sizeof(m)))
+			return -EFAULT;
+		return retval;
+
+	case SCULL_IOC_KV_STATS:
+		scull_kv_get_stats(kv, &st);
+		if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+			return -EFAULT;
+		return 0;
+	}
+	return -ENOTTY;
+}
@@ -0,0 +1,863 @@
+/*
+ * libscull.c -- a client library for /dev/scullN, see libscull.h
+ *
+ * A handle has depth I/O slots. An I/O takes one when it is queued and
+ * gives it back just before its callback runs, so a callback can queue
+ * the next one without waiting. Each engine has a way to hand the
+ * queued I/Os over (submit) and one to collect those done (reap):
+ *
+ *	uring	  the I/Os are gathered in commands of up to opts.batch of
+ *		  them, one for the reads and one for the writes being
+ *		  filled at a time; a full command goes to the SQ ring, and
+ *		  the ring to the kernel when the caller submits or waits
+ *	threads	  the I/Os are gathered on a list given to the pool in one
+ *		  go; the threads put them on a done list
+ *	sync	  the I/O is done when it is queued and put on the done list
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/types.h>
+#include <linux/io_uring.h>
+
+#include "libscull.h"
+
+/* same as in scull.h */
+#define SCULL_MODE_BYTES         0
+
+#define SCULL_URING_READ         1
+#define SCULL_URING_WRITE        2
+#define SCULL_URING_STATS        4
+#define SCULL_URING_MAX_IOS      64
+#define SCULL_URING_MAX_BYTES    (16U << 20)
+
+struct scull_uring_cmd {
+    __u64 addr;
+    __u32 nr;
+    __u32 flags;
+};
+
+struct scull_uring_io {
+    __u64 pos;
+    __u64 buf;
+    __u32 len;
+    __s32 result;
+};
+
+struct scull_allocstat {
+    __u32 reserve;
+    __u32 ready;
+    __u64 hits;
+    __u64 stalls;
+    __u64 stall_ns;
+    __u64 stall_max_ns;
+    __u64 refills;
+    __u64 fallocated;
+};
+
+struct scull_uring_stats {
+    __u64 size;
+    __u64 qsets;
+    __u64 quanta;
+    __u64 nodes;
+    __u64 extents;
+    __u64 generation;
+    __u32 mode;
+    __u32 pad;
+    struct scull_allocstat alloc;
+};
+
+#define LIBSCULL_DEPTH       32
+#define LIBSCULL_MAX_DEPTH   4096
+#define LIBSCULL_THREADS_MAX 16
+#define LIBSCULL_BUF_SIZE    (64 << 10)
+
+struct libscull_io {
+    struct libscull_io *next;   /* on the free, queued or done list */
+    libscull_cb cb;
+    void *arg;
+    void *buf;
+    size_t len;
+    off_t pos;
+    ssize_t result;
+    uint64_t t0;
+    int is_read;
+};
+
+/* an io_uring command, and the I/Os it carries */
+struct libscull_cmd {
+    struct libscull_cmd *next;
+    int op;
+    unsigned int nr;
+    size_t bytes;
+    struct scull_uring_io *ios;
+    struct libscull_io **lios;
+};
+
+/* the rings, set up with the raw system calls: no liburing needed */
+struct libscull_ring {
+    int fd;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq, *cq;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+struct libscull {
+    int fd;
+    enum libscull_engine engine;
+    struct libscull_opts opts;
+    struct libscull_stats st;
+
+    struct libscull_io *ios, *free_ios;
+    unsigned int inflight;      /* slots taken */
+    struct libscull_io *queued, **queued_tail;  /* not handed over yet */
+    unsigned int nr_queued;
+    struct libscull_io *done, **done_tail;      /* sync: callbacks to run */
+
+    char *bufs;
+    void **free_bufs;
+    unsigned int nr_free_bufs;
+
+    /* uring */
+    struct libscull_ring ring;
+    struct libscull_cmd *cmds, *free_cmds;
+    struct libscull_cmd *filling[2];            /* writes, reads */
+    struct scull_uring_io *uios;
+    struct libscull_io **ulios;
+    unsigned int sq_pending;    /* SQEs not entered yet */
+
+    /* threads */
+    pthread_t *tids;
+    unsigned int nr_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t reaped;
+    struct libscull_io *pending, **pending_tail;
+    struct libscull_io *tdone, **tdone_tail;
+    int stop;
+};
+
+static const char *libscull_engine_names[] = {
+    [LIBSCULL_AUTO] = "auto", [LIBSCULL_URING] = "uring",
+    [LIBSCULL_THREADS] = "threads", [LIBSCULL_SYNC] = "sync",
+};
+
+static uint64_t libscull_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void libscull_do_io(int fd, struct libscull_io *io)
+{
+    ssize_t ret;
+
+    if (io->is_read)
+        ret = pread(fd, io->buf, io->len, io->pos);
+    else
+        ret = pwrite(fd, io->buf, io->len, io->pos);
+    io->result = ret < 0 ? -errno : ret;
+}
+
+/* give the slot back, count, and run the callback */
+static void libscull_complete(struct libscull *h, struct libscull_io *io)
+{
+    libscull_cb cb = io->cb;
+    void *arg = io->arg;
+    ssize_t result = io->result;
+    uint64_t lat = libscull_now() - io->t0;
+
+    if (result < 0) {
+        h->st.errors++;
+    } else if (io->is_read) {
+        h->st.reads++;
+        h->st.read_bytes += result;
+    } else {
+        h->st.writes++;
+        h->st.write_bytes += result;
+    }
+    if (result >= 0 && (size_t)result < io->len)
+        h->st.short_ios++;
+    h->st.lat_ns += lat;
+    if (lat > h->st.lat_max_ns)
+        h->st.lat_max_ns = lat;
+
+    io->next = h->free_ios;
+    h->free_ios = io;
+    h->inflight--;
+    if (cb)
+        cb(arg, result);
+}
+
+/* sync */
+
+static int libscull_sync_reap(struct libscull *h)
+{
+    struct libscull_io *io;
+    int n = 0;
+
+    while ((io = h->done)) {
+        h->done = io->next;
+        if (!h->done)
+            h->done_tail = &h->done;
+        libscull_complete(h, io);
+        n++;
+    }
+    return n;
+}
+
+/* uring */
+
+static int libscull_ring_setup(struct libscull_ring *r, unsigned int entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && r->cq_len > r->sq_len)
+        r->sq_len = r->cq_len;
+    r->sq = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQ_RING);
+    if (r->sq == MAP_FAILED)
+        goto fail;
+    r->cq = r->sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        r->cq = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_CQ_RING);
+        if (r->cq == MAP_FAILED)
+            goto fail_sq;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail_cq;
+    r->sq_tail = (unsigned int *)((char *)r->sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)((char *)r->sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)((char *)r->sq + p.sq_off.array);
+    r->cq_head = (unsigned int *)((char *)r->cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)((char *)r->cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)((char *)r->cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq + p.cq_off.cqes);
+    return 0;
+
+fail_cq:
+    if (r->cq != r->sq)
+        munmap(r->cq, r->cq_len);
+fail_sq:
+    munmap(r->sq, r->sq_len);
+fail:
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+static void libscull_ring_free(struct libscull_ring *r)
+{
+    if (r->fd < 0)
+        return;
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq != r->sq)
+        munmap(r->cq, r->cq_len);
+    munmap(r->sq, r->sq_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+static void libscull_ring_queue(struct libscull_ring *r, int fd, int op, void *addr,
+                                unsigned int nr, uint64_t user_data)
+{
+    unsigned int tail = *r->sq_tail, idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    struct scull_uring_cmd cmd = { .addr = (uintptr_t)addr, .nr = nr };
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd;
+    sqe->cmd_op = op;
+    sqe->user_data = user_data;
+    memcpy(sqe->cmd, &cmd, sizeof(cmd));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int libscull_ring_enter(struct libscull_ring *r, unsigned int submit,
+                               unsigned int wait)
+{
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, submit, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+/*
+ * Whether @fd takes the SCULL_URING_* commands: a STATS command, which
+ * must succeed and show a device in byte mode.
+ */
+static int libscull_uring_probe(struct libscull *h)
+{
+    struct libscull_ring *r = &h->ring;
+    struct scull_uring_stats st;
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    int res;
+
+    memset(&st, 0xff, sizeof(st));
+    libscull_ring_queue(r, h->fd, SCULL_URING_STATS, &st, 0, 0);
+    if (libscull_ring_enter(r, 1, 1) < 0)
+        return -1;
+    head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        errno = EIO;
+        return -1;
+    }
+    cqe = &r->cqes[head & *r->cq_mask];
+    res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    /* whatever else answers the command does not fill the counters */
+    if (st.mode != SCULL_MODE_BYTES) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+static int libscull_uring_init(struct libscull *h)
+{
+    unsigned int i, depth = h->opts.depth, batch = h->opts.batch;
+
+    if (libscull_ring_setup(&h->ring, depth))
+        return -1;
+    if (libscull_uring_probe(h))
+        return -1;
+    h->cmds = calloc(depth, sizeof(*h->cmds));
+    h->uios = calloc((size_t)depth * batch, sizeof(*h->uios));
+    h->ulios = calloc((size_t)depth * batch, sizeof(*h->ulios));
+    if (!h->cmds || !h->uios || !h->ulios) {
+        errno = ENOMEM;
+        return -1;
+    }
+    /* there are never more commands than I/Os in flight */
+    for (i = 0; i < depth; i++) {
+        h->cmds[i].ios = &h->uios[(size_t)i * batch];
+        h->cmds[i].lios = &h->ulios[(size_t)i * batch];
+        h->cmds[i].next = h->free_cmds;
+        h->free_cmds = &h->cmds[i];
+    }
+    return 0;
+}
+
+static void libscull_uring_queue_cmd(struct libscull *h, struct libscull_cmd *c)
+{
+    libscull_ring_queue(&h->ring, h->fd, c->op, c->ios, c->nr, c - h->cmds);
+    h->sq_pending++;
+    h->st.batches++;
+}
+
+static void libscull_uring_add(struct libscull *h, struct libscull_io *io)
+{
+    struct libscull_cmd *c = h->filling[io->is_read];
+    struct scull_uring_io *uio;
+
+    if (c && c->bytes + io->len > SCULL_URING_MAX_BYTES) {
+        libscull_uring_queue_cmd(h, c);
+        c = NULL;
+    }
+    if (!c) {
+        c = h->free_cmds;
+        h->free_cmds = c->next;
+        c->op = io->is_read ? SCULL_URING_READ : SCULL_URING_WRITE;
+        c->nr = 0;
+        c->bytes = 0;
+        h->filling[io->is_read] = c;
+    }
+    uio = &c->ios[c->nr];
+    uio->pos = io->pos;
+    uio->buf = (uintptr_t)io->buf;
+    uio->len = io->len;
+    uio->result = 0;
+    c->lios[c->nr++] = io;
+    c->bytes += io->len;
+    if (c->nr == h->opts.batch) {
+        libscull_uring_queue_cmd(h, c);
+        h->filling[io->is_read] = NULL;
+    }
+}
+
+static int libscull_uring_submit(struct libscull *h)
+{
+    int i, ret;
+
+    for (i = 0; i < 2; i++) {
+        if (h->filling[i])
+            libscull_uring_queue_cmd(h, h->filling[i]);
+        h->filling[i] = NULL;
+    }
+    while (h->sq_pending) {
+        ret = libscull_ring_enter(&h->ring, h->sq_pending, 0);
+        if (ret <= 0) {
+            if (!ret)
+                errno = EIO;
+            return -1;
+        }
+        h->sq_pending -= ret;
+        h->st.submits++;
+    }
+    return 0;
+}
+
+static int libscull_uring_reap(struct libscull *h, int block)
+{
+    struct libscull_ring *r = &h->ring;
+    struct libscull_io *lios[SCULL_URING_MAX_IOS];
+    struct scull_uring_io *uio;
+    struct libscull_cmd *c;
+    unsigned int head, i, nr;
+    int n = 0, res;
+
+    if (block && libscull_ring_enter(r, 0, 1) < 0)
+        return -1;
+
+    for (;;) {
+        head = *r->cq_head;
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        c = &h->cmds[r->cqes[head & *r->cq_mask].user_data];
+        res = r->cqes[head & *r->cq_mask].res;
+        /* the callbacks may queue, and reap, again */
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        nr = c->nr;
+        for (i = 0; i < nr; i++) {
+            uio = &c->ios[i];
+            lios[i] = c->lios[i];
+            /* the CQE has the first error if no I/O moved a byte */
+            lios[i]->result = res < 0 && uio->result <= 0 ? res : uio->result;
+        }
+        c->next = h->free_cmds;
+        h->free_cmds = c;
+        for (i = 0; i < nr; i++)
+            libscull_complete(h, lios[i]);
+        n += nr;
+    }
+    return n;
+}
+
+/* threads */
+
+static void *libscull_worker(void *arg)
+{
+    struct libscull *h = arg;
+    struct libscull_io *io;
+
+    pthread_mutex_lock(&h->lock);
+    for (;;) {
+        while (!h->pending && !h->stop)
+            pthread_cond_wait(&h->work, &h->lock);
+        io = h->pending;
+        if (!io)
+            break;
+        h->pending = io->next;
+        if (!h->pending)
+            h->pending_tail = &h->pending;
+        pthread_mutex_unlock(&h->lock);
+
+        libscull_do_io(h->fd, io);
+
+        pthread_mutex_lock(&h->lock);
+        io->next = NULL;
+        *h->tdone_tail = io;
+        h->tdone_tail = &io->next;
+        pthread_cond_signal(&h->reaped);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+
+static int libscull_threads_init(struct libscull *h)
+{
+    unsigned int i;
+    int ret;
+
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->work, NULL);
+    pthread_cond_init(&h->reaped, NULL);
+    h->pending_tail = &h->pending;
+    h->tdone_tail = &h->tdone;
+    h->tids = calloc(h->opts.threads, sizeof(*h->tids));
+    if (!h->tids) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < h->opts.threads; i++) {
+        ret = pthread_create(&h->tids[i], NULL, libscull_worker, h);
+        if (ret) {
+            errno = ret;
+            return -1;
+        }
+        h->nr_threads++;
+    }
+    return 0;
+}
+
+static void libscull_threads_stop(struct libscull *h)
+{
+    unsigned int i;
+
+    if (!h->tids)
+        return;
+    pthread_mutex_lock(&h->lock);
+    h->stop = 1;
+    pthread_cond_broadcast(&h->work);
+    pthread_mutex_unlock(&h->lock);
+    for (i = 0; i < h->nr_threads; i++)
+        pthread_join(h->tids[i], NULL);
+    free(h->tids);
+    h->tids = NULL;
+}
+
+static int libscull_threads_submit(struct libscull *h)
+{
+    unsigned int nr = h->nr_queued;
+
+    if (!h->queued)
+        return 0;
+    pthread_mutex_lock(&h->lock);
+    *h->pending_tail = h->queued;
+    h->pending_tail = h->queued_tail;
+    if (nr == 1)
+        pthread_cond_signal(&h->work);
+    else
+        pthread_cond_broadcast(&h->work);
+    pthread_mutex_unlock(&h->lock);
+    h->queued = NULL;
+    h->queued_tail = &h->queued;
+    h->nr_queued = 0;
+    h->st.submits++;
+    h->st.batches++;
+    return 0;
+}
+
+static int libscull_threads_reap(struct libscull *h, int block)
+{
+    struct libscull_io *io, *next;
+    int n = 0;
+
+    pthread_mutex_lock(&h->lock);
+    while (block && !h->tdone)
+        pthread_cond_wait(&h->reaped, &h->lock);
+    io = h->tdone;
+    h->tdone = NULL;
+    h->tdone_tail = &h->tdone;
+    pthread_mutex_unlock(&h->lock);
+
+    for (; io; io = next, n++) {
+        next = io->next;
+        libscull_complete(h, io);
+    }
+    return n;
+}
+
+/* the handle */
+
+int libscull_submit(struct libscull *h)
+{
+    switch (h->engine) {
+    case LIBSCULL_URING:
+        return libscull_uring_submit(h);
+    case LIBSCULL_THREADS:
+        return libscull_threads_submit(h);
+    default:
+        return 0;
+    }
+}
+
+static int libscull_reap(struct libscull *h, int block)
+{
+    switch (h->engine) {
+    case LIBSCULL_URING:
+        return libscull_uring_reap(h, block);
+    case LIBSCULL_THREADS:
+        return libscull_threads_reap(h, block);
+    default:
+        return libscull_sync_reap(h);
+    }
+}
+
+int libscull_wait(struct libscull *h, unsigned int min)
+{
+    int n = 0, ret, block = 0;
+
+    for (;;) {
+        /* the callbacks may have queued more */
+        if (libscull_submit(h))
+            return -1;
+        ret = libscull_reap(h, block);
+        if (ret < 0)
+            return -1;
+        n += ret;
+        if ((unsigned int)n >= min || !h->inflight)
+            return n;
+        block = 1;
+    }
+}
+
+int libscull_drain(struct libscull *h)
+{
+    while (h->inflight)
+        if (libscull_wait(h, h->inflight) < 0)
+            return -1;
+    return 0;
+}
+
+unsigned int libscull_inflight(const struct libscull *h)
+{
+    return h->inflight;
+}
+
+static int libscull_queue(struct libscull *h, int is_read, void *buf, size_t len,
+                          off_t pos, libscull_cb cb, void *arg)
+{
+    struct libscull_io *io;
+
+    if (h->engine == LIBSCULL_URING && len > SCULL_URING_MAX_BYTES) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (!h->free_ios)
+        if (libscull_wait(h, 1) < 0)
+            return -1;
+
+    io = h->free_ios;
+    h->free_ios = io->next;
+    io->next = NULL;
+    io->cb = cb;
+    io->arg = arg;
+    io->buf = buf;
+    io->len = len;
+    io->pos = pos;
+    io->result = 0;
+    io->is_read = is_read;
+    io->t0 = libscull_now();
+    if (++h->inflight > h->st.max_inflight)
+        h->st.max_inflight = h->inflight;
+
+    switch (h->engine) {
+    case LIBSCULL_URING:
+        libscull_uring_add(h, io);
+        break;
+    case LIBSCULL_THREADS:
+        *h->queued_tail = io;
+        h->queued_tail = &io->next;
+        if (++h->nr_queued >= h->opts.batch)
+            return libscull_threads_submit(h);
+        break;
+    default:
+        libscull_do_io(h->fd, io);
+        h->st.submits++;
+        *h->done_tail = io;
+        h->done_tail = &io->next;
+        break;
+    }
+    return 0;
+}
+
+int libscull_read(struct libscull *h, void *buf, size_t len, off_t pos,
+                  libscull_cb cb, void *arg)
+{
+    return libscull_queue(h, 1, buf, len, pos, cb, arg);
+}
+
+int libscull_write(struct libscull *h, const void *buf, size_t len, off_t pos,
+                   libscull_cb cb, void *arg)
+{
+    return libscull_queue(h, 0, (void *)buf, len, pos, cb, arg);
+}
+
+void *libscull_buf_get(struct libscull *h)
+{
+    if (!h->nr_free_bufs) {
+        h->st.buf_misses++;
+        return NULL;
+    }
+    return h->free_bufs[--h->nr_free_bufs];
+}
+
+void libscull_buf_put(struct libscull *h, void *buf)
+{
+    char *b = buf;
+
+    if (b < h->bufs || b >= h->bufs + h->opts.nr_bufs * h->opts.buf_size ||
+        h->nr_free_bufs == h->opts.nr_bufs)
+        return;     /* not one of ours */
+    h->free_bufs[h->nr_free_bufs++] = buf;
+}
+
+void libscull_get_stats(const struct libscull *h, struct libscull_stats *st)
+{
+    *st = h->st;
+}
+
+enum libscull_engine libscull_engine(const struct libscull *h)
+{
+    return h->engine;
+}
+
+const char *libscull_engine_name(enum libscull_engine engine)
+{
+    return engine <= LIBSCULL_SYNC ? libscull_engine_names[engine] : "?";
+}
+
+int libscull_fd(const struct libscull *h)
+{
+    return h->fd;
+}
+
+static void libscull_free(struct libscull *h)
+{
+    int err = errno;
+
+    libscull_threads_stop(h);
+    libscull_ring_free(&h->ring);
+    if (h->fd >= 0)
+        close(h->fd);
+    free(h->cmds);
+    free(h->uios);
+    free(h->ulios);
+    free(h->bufs);
+    free(h->free_bufs);
+    free(h->ios);
+    free(h);
+    errno = err;
+}
+
+static int libscull_bufs_init(struct libscull *h)
+{
+    unsigned int i;
+    size_t size;
+
+    if (!h->opts.nr_bufs)
+        return 0;
+    /* every buffer page aligned */
+    h->opts.buf_size = (h->opts.buf_size + 4095) & ~(size_t)4095;
+    size = h->opts.buf_size * h->opts.nr_bufs;
+    if (posix_memalign((void **)&h->bufs, 4096, size))
+        return -1;
+    h->free_bufs = calloc(h->opts.nr_bufs, sizeof(void *));
+    if (!h->free_bufs)
+        return -1;
+    for (i = 0; i < h->opts.nr_bufs; i++)
+        h->free_bufs[i] = h->bufs + (size_t)(h->opts.nr_bufs - 1 - i) * h->opts.buf_size;
+    h->nr_free_bufs = h->opts.nr_bufs;
+    return 0;
+}
+
+struct libscull *libscull_open(const char *path, int flags,
+                               const struct libscull_opts *opts)
+{
+    struct libscull_opts o = { 0 };
+    struct libscull *h;
+    unsigned int i;
+
+    if (opts)
+        o = *opts;
+    if (!o.depth)
+        o.depth = o.engine == LIBSCULL_SYNC ? 1 : LIBSCULL_DEPTH;
+    if (!o.batch || o.batch > SCULL_URING_MAX_IOS)
+        o.batch = SCULL_URING_MAX_IOS;
+    if (!o.threads)
+        o.threads = o.depth < LIBSCULL_THREADS_MAX ? o.depth : LIBSCULL_THREADS_MAX;
+    if (!o.buf_size)
+        o.buf_size = LIBSCULL_BUF_SIZE;
+    if (!o.nr_bufs)
+        o.nr_bufs = o.depth;
+    if (o.depth > LIBSCULL_MAX_DEPTH || o.engine > LIBSCULL_SYNC) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    h = calloc(1, sizeof(*h));
+    if (!h)
+        return NULL;
+    h->opts = o;
+    h->ring.fd = -1;
+    h->queued_tail = &h->queued;
+    h->done_tail = &h->done;
+    h->fd = open(path, flags);
+    if (h->fd < 0)
+        goto fail;
+
+    h->ios = calloc(o.depth, sizeof(*h->ios));
+    if (!h->ios) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    for (i = 0; i < o.depth; i++) {
+        h->ios[i].next = h->free_ios;
+        h->free_ios = &h->ios[i];
+    }
+    if (libscull_bufs_init(h)) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    if (o.engine == LIBSCULL_AUTO || o.engine == LIBSCULL_URING) {
+        if (!libscull_uring_init(h)) {
+            h->engine = LIBSCULL_URING;
+            return h;
+        }
+        if (o.engine == LIBSCULL_URING)
+            goto fail;
+        /* not this kernel, not this device, or not in byte mode */
+        libscull_ring_free(&h->ring);
+        free(h->cmds);
+        free(h->uios);
+        free(h->ulios);
+        h->cmds = NULL;
+        h->uios = NULL;
+        h->ulios = NULL;
+        h->free_cmds = NULL;
+        o.engine = o.depth > 1 ? LIBSCULL_THREADS : LIBSCULL_SYNC;
+    }
+    h->engine = o.engine;
+    if (h->engine == LIBSCULL_THREADS && libscull_threads_init(h))
+        goto fail;
+    return h;
+
+fail:
+    libscull_free(h);
+    return NULL;
+}
+
+int libscull_close(struct libscull *h)
+{
+    int ret = libscull_drain(h);
+
+    libscull_free(h);
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * libscull.h -- a client library for /dev/scullN
+ *
+ * Reads and writes are queued on a handle and complete later, up to a
+ * queue depth of them in flight, with a callback run in the thread of
+ * the caller. Underneath is the fastest engine the device takes:
+ *
+ *	uring	  the SCULL_URING_* commands (uring.c), up to 64 I/Os per
+ *		  command and many commands per io_uring_enter(); byte mode,
+ *		  from 5.19 on
+ *	threads	  pread() and pwrite() on a pool of threads, handed over a
+ *		  batch at a time
+ *	sync	  pread() and pwrite() in the caller, the queue depth is 1
+ *
+ * LIBSCULL_AUTO asks the device for its counters through io_uring when
+ * it is opened, and takes the uring engine if that works, the threads
+ * otherwise. The device has no mmap(), nor a read_iter(): there is no
+ * faster path.
+ *
+ * A handle is for one thread at a time. I/Os in flight together may be
+ * done in any order, as with aio: wait for a write before reading what
+ * it wrote. A callback may queue more I/Os.
+ *
+ *	struct libscull *h = libscull_open("/dev/scull0", O_RDWR, NULL);
+ *	char *buf = libscull_buf_get(h);
+ *
+ *	libscull_read(h, buf, 4000, 0, done, buf);
+ *	libscull_wait(h, 1);
+ *	...
+ *	libscull_close(h);
+ *
+ * Everything returns -1 and sets errno on error, libscull_open() NULL.
+ * Build: gcc -c libscull.c && ar rcs libscull.a libscull.o
+ */
+#ifndef _LIBSCULL_H_
+#define _LIBSCULL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+enum libscull_engine {
+    LIBSCULL_AUTO,
+    LIBSCULL_URING,
+    LIBSCULL_THREADS,
+    LIBSCULL_SYNC,
+};
+
+/* all 0 is the defaults */
+struct libscull_opts {
+    enum libscull_engine engine;
+    unsigned int depth;         /* I/Os in flight (32) */
+    unsigned int batch;         /* I/Os per io_uring command (64, the most) */
+    unsigned int threads;       /* of the threads engine (depth, at most 16) */
+    size_t buf_size;            /* of the buffers of libscull_buf_get() (64k) */
+    unsigned int nr_bufs;       /* (depth) */
+};
+
+/*
+ * Per handle, since it was opened.
+ * @submits: system calls handing I/Os over to the kernel or to the
+ *	threads: io_uring_enter(), or a wakeup of the pool
+ * @batches: io_uring commands, or batches handed to the threads
+ * @lat_ns, @lat_max_ns: from libscull_read() or libscull_write() to the
+ *	completion being seen, summed over the I/Os
+ * @buf_misses: libscull_buf_get() finding no buffer
+ */
+struct libscull_stats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t short_ios;
+    uint64_t errors;
+    uint64_t submits;
+    uint64_t batches;
+    uint64_t lat_ns;
+    uint64_t lat_max_ns;
+    uint64_t buf_misses;
+    unsigned int max_inflight;
+};
+
+/* @result: the bytes read or written, or -errno */
+typedef void (*libscull_cb)(void *arg, ssize_t result);
+
+struct libscull;
+
+/* @flags as for open(2); O_WRONLY empties the device, as it does there */
+struct libscull *libscull_open(const char *path, int flags,
+                               const struct libscull_opts *opts);
+/* waits for the I/Os in flight, whose callbacks run */
+int libscull_close(struct libscull *h);
+
+/* the engine taken, never LIBSCULL_AUTO, and its name */
+enum libscull_engine libscull_engine(const struct libscull *h);
+const char *libscull_engine_name(enum libscull_engine engine);
+/* the file, for ioctls */
+int libscull_fd(const struct libscull *h);
+
+/*
+ * Queue a read or a write of @len bytes at @pos; @buf must stay until
+ * @cb ran. If depth I/Os are in flight, this waits for one to complete.
+ * The uring engine takes up to 16 MB an I/O.
+ */
+int libscull_read(struct libscull *h, void *buf, size_t len, off_t pos,
+                  libscull_cb cb, void *arg);
+int libscull_write(struct libscull *h, const void *buf, size_t len, off_t pos,
+                   libscull_cb cb, void *arg);
+
+/* hand the queued I/Os over now, rather than when a batch is full */
+int libscull_submit(struct libscull *h);
+/*
+ * Submit, then wait for at least @min completions (as many as are in
+ * flight, at most) and run their callbacks, with the others already
+ * there. Returns how many ran.
+ */
+int libscull_wait(struct libscull *h, unsigned int min);
+/* wait for all */
+int libscull_drain(struct libscull *h);
+unsigned int libscull_inflight(const struct libscull *h);
+
+/* buffers of opts.buf_size bytes, page aligned; NULL if all are taken */
+void *libscull_buf_get(struct libscull *h);
+void libscull_buf_put(struct libscull *h, void *buf);
+
+void libscull_get_stats(const struct libscull *h, struct libscull_stats *st);
+
+#endif /* _LIBSCULL_H_ */
@@ -0,0 +1,192 @@
+/*
+ * log.c -- the append-only log mode of a device
+ *
+ * In SCULL_MODE_LOG every write goes to the end of the device, whatever
+ * the file position, and appenders do not wait for each other to copy:
+ *
+ * 1. the bytes are reserved by moving log->tail with a cmpxchg, no lock;
+ * 2. the quanta of the reserved bytes are found (allocated if need be)
+ *    one at a time under dev->sem, held only for that;
+ * 3. the data is copied in without dev->sem, next to the other appenders;
+ * 4. the append is committed: once all the ones reserved before it are,
+ *    dev->size moves past it under dev->sem.
+ *
+ * dev->size is what readers see, so they only ever see whole appends, in
+ * the order the space was reserved. An append that fails halfway is still
+ * committed, so that the ones after it are not stuck: its bytes read as
+ * zeroes, or as a hole if a quantum could not be allocated.
+ *
+ * The appenders hold log->rwsem for reading; it is taken for writing
+ * around anything that frees quanta (trim, a change of mode), so that no
+ * copy is left writing into a freed quantum.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/rwsem.h>
+#include <linux/wait.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+#ifdef __KERNEL__
+#include "scull_trace.h"    /* the tracepoints themselves are created in main.c */
+#endif
+
+/*
+ * @rwsem: read by the appenders, written by what frees quanta
+ * @tail: end of the bytes reserved so far, dev->size once all are committed
+ * @commit_wait: appenders waiting for those reserved before them
+ */
+struct scull_log {
+	struct rw_semaphore rwsem;
+	atomic64_t tail;
+	wait_queue_head_t commit_wait;
+};
+
+/*
+ * Give @dev its struct scull_log, before it is first put in log mode.
+ * It stays until the device is freed, see scull_log_free().
+ */
+int scull_log_setup(struct scull_dev *dev)
+{
+	struct scull_log *log;
+
+	if (READ_ONCE(dev->log))
+		return 0;
+	log = kmalloc(sizeof(struct scull_log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+	init_rwsem(&log->rwsem);
+	atomic64_set(&log->tail, 0);
+	init_waitqueue_head(&log->commit_wait);
+
+	/* as in scull_get_dev(): the first one wins */
+	if (cmpxchg(&dev->log, NULL, log))
+		kfree(log);
+	return 0;
+}
+
+void scull_log_free(struct scull_dev *dev)
+{
+	kfree(dev->log);
+	dev->log = NULL;
+}
+
+/*
+ * Wait for the appenders in flight and keep new ones out, before quanta
+ * are freed. Returns what scull_log_unblock() needs.
+ */
+struct scull_log *scull_log_block(struct scull_dev *dev)
+{
+	struct scull_log *log = READ_ONCE(dev->log);
+
+	if (log)
+		down_write(&log->rwsem);
+	return log;
+}
+
+/* the next append starts at the end of the device again */
+void scull_log_unblock(struct scull_dev *dev, struct scull_log *log)
+{
+	if (!log)
+		return;
+	atomic64_set(&log->tail, READ_ONCE(dev->size));
+	up_write(&log->rwsem);
+}
+
+/* reserve up to @count bytes at the tail, returns where they start */
+static loff_t scull_log_reserve(struct scull_log *log, size_t *count)
+{
+	s64 start, n;
+
+	do {
+		start = atomic64_read(&log->tail);
+		if ((u64)start >= scull_max_size)
+			return -EFBIG;
+		n = min_t(u64, *count, scull_max_size - start);
+	} while (atomic64_cmpxchg(&log->tail, start, start + n) != start);
+
+	*count = n;
+	return start;
+}
+
+/*
+ * scull_write() of a device in log mode: append @count bytes, *f_pos is
+ * set to the end of them like with O_APPEND. @cur is the cursor of the
+ * file, only used under dev->sem.
+ */
+ssize_t scull_log_write(struct scull_dev *dev, struct scull_cursor *cur,
+		const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_log *log = dev->log;
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	loff_t start, pos;
+	size_t done = 0, len;
+	ssize_t retval = 0;
+	char *to;
+
+	if (!count)
+		return 0;
+
+	down_read(&log->rwsem);
+	/* the mode changed since scull_write() looked at it */
+	if (READ_ONCE(dev->mode) != SCULL_MODE_LOG) {
+		retval = -EINVAL;   /* as scull_write() for a byte writer */
+		goto out;
+	}
+	start = scull_log_reserve(log, &count);
+	if (start < 0) {
+		retval = start;
+		goto out;
+	}
+
+	for (pos = start; done < count; pos += len, done += len) {
+		len = count - done;
+		down(&dev->sem);
+		retval = scull_write_prepare(dev, pos, &len, &loc, cur, &to);
+		up(&dev->sem);
+		if (retval)
+			break;      /* the rest is left a hole */
+		if (copy_from_user(to, buf + done, len)) {
+			memset(to, 0, len);
+			retval = -EFAULT;
+			break;
+		}
+	}
+
+	/*
+	 * commit, after everything reserved before us, even what could not be
+	 * copied: the appenders after us wait for it. Not killable for that
+	 * reason. Only appends move dev->size in log mode, the other writers
+	 * check the mode under dev->sem and trims wait for log->rwsem.
+	 */
+	wait_event(log->commit_wait, READ_ONCE(dev->size) == start);
+	down(&dev->sem);
+	dev->size = start + count;
+	up(&dev->sem);
+	wake_up_all(&log->commit_wait);
+
+	trace_scull_write(dev->index, start, count, loc.item, loc.s_pos, 0,
+			  done ? done : retval);
+	if (done) {
+		*f_pos = start + done;
+		retval = done;
+	}
+out:
+	up_read(&log->rwsem);
+	return retval;
+}
@@ -0,0 +1,1369 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt /* prefix of the PDEBUG lines */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include <linux/kernel.h>   /* printk() */
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/vmalloc.h>  /* vzalloc() */
+#include <linux/overflow.h> /* array_size() */
+#include <linux/fs.h>       /* register_chrdev_region */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>    /* size_t */
+#include <linux/proc_fs.h>  /* proc file */
+#include <linux/seq_file.h>  /* seqence file */
+#include <linux/fcntl.h>    /* O_ACCMODE */
+#include <linux/falloc.h>   /* FALLOC_FL_KEEP_SIZE */
+#include <linux/cdev.h>
+
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>    /* usleep_range(), msleep_interruptible() */
+#include <linux/rcupdate.h>
+#include <linux/capability.h>  /* capable() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
+#include <linux/jump_label.h>  /* static keys */
+#endif
+#include "scull.h"
+
+#define CREATE_TRACE_POINTS
+#include "scull_trace.h"
+
+/*
+ * Our parameters which can be set at load time.
+ */
+int scull_major = SCULL_MAJOR;
+int scull_minor = 0;
+int scull_nr_devs = SCULL_NR_DEVS;  /* number of bare scull devices */
+int scull_quantum = SCULL_QUANTUM;  /* the size of every quantum */
+int scull_qset = SCULL_QSET;        /* the num of quantum for a quantum set */
+bool scull_lockstat = false;        /* profile dev->sem, can be changed at runtime */
+bool scull_pow2 = true;             /* shifts instead of divisions for 2^n geometries */
+unsigned long long scull_max_size = SCULL_MAX_SIZE; /* writes end below this */
+unsigned int scull_extent_max = SCULL_EXTENT_MAX;   /* bytes, 0: no extents */
+unsigned long scull_kv_max_bytes = SCULL_KV_MAX_BYTES; /* per device in KV mode */
+unsigned int scull_kv_ttl_ms;       /* of the KV puts which do not give one */
+unsigned int scull_reserve = SCULL_RESERVE; /* ready quanta per device, 0: none */
+static char *scull_spill = "";  /* backing file of the cold quanta, "": none */
+
+module_param(scull_major, int, S_IRUGO);
+module_param(scull_minor, int, S_IRUGO);
+module_param(scull_nr_devs, int, S_IRUGO);
+module_param(scull_quantum, int, S_IRUGO);
+module_param(scull_qset, int, S_IRUGO);
+module_param(scull_lockstat, bool, S_IRUGO | S_IWUSR);
+module_param(scull_pow2, bool, S_IRUGO);
+module_param(scull_max_size, ullong, S_IRUGO);
+module_param(scull_extent_max, uint, S_IRUGO | S_IWUSR);
+module_param(scull_kv_max_bytes, ulong, S_IRUGO | S_IWUSR);
+module_param(scull_kv_ttl_ms, uint, S_IRUGO | S_IWUSR);
+module_param(scull_reserve, uint, S_IRUGO);
+module_param(scull_spill, charp, S_IRUGO);
+
+/*
+ * scull_check=1 runs scull_check() after every write and trim: a walk of
+ * the whole index, far too slow to leave on. The test is a static branch,
+ * a nop in the code until the parameter is set.
+ */
+static bool scull_check_on;
+static bool scull_check_ready;      /* the key may be flipped, see scull_init_module */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
+static DEFINE_STATIC_KEY_FALSE(scull_check_key);
+#define scull_checking()        static_branch_unlikely(&scull_check_key)
+#define scull_check_update(on)  ((on) ? static_branch_enable(&scull_check_key) : \
+                                        static_branch_disable(&scull_check_key))
+#else
+#define scull_checking()        unlikely(scull_check_on)
+#define scull_check_update(on)  do { } while (0)
+#endif
+
+static int scull_check_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_bool(val, kp);
+
+	/* at load time the key is set from scull_init_module */
+	if (!ret && scull_check_ready)
+		scull_check_update(scull_check_on);
+	return ret;
+}
+
+static const struct kernel_param_ops scull_check_ops = {
+	.set = scull_check_set,
+	.get = param_get_bool,
+};
+module_param_cb(scull_check, &scull_check_ops, &scull_check_on, S_IRUGO | S_IWUSR);
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * One pointer per minor, the array is allocated in scull_init_module and
+ * the devices themselves on first open. A single cdev covers all the minors,
+ * so loading the module costs the same for 4 or 10000 devices.
+ */
+struct scull_dev **scull_devices;
+static struct cdev scull_cdev;
+static bool scull_cdev_added;
+
+/*
+ * Take dev->sem on behalf of @op working at @pos.
+ *
+ * The clock is only read if scull_lockstat is set or the caller is
+ * tracing (@timed), the time spent waiting is returned in @wait_ns.
+ * Only a fatal signal interrupts the wait if @killable.
+ */
+static int __scull_lock(struct scull_dev *dev, int op, loff_t pos,
+		bool timed, u64 *wait_ns, bool killable)
+{
+	struct scull_lockstat *ls = &dev->lockstat;
+	u64 start = 0, now, wait;
+
+	if (scull_lockstat || timed)
+		start = ktime_get_ns();
+	if (killable ? down_killable(&dev->sem) : down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+
+	ls->start = 0;
+	if (!start)
+		return 0;
+
+	now = ktime_get_ns();
+	wait = now - start;
+	if (wait_ns)
+		*wait_ns = wait;
+	if (!scull_lockstat)
+		return 0;
+
+	/* we own the semaphore, so nobody else is updating the stats */
+	ls->acquired++;
+	ls->wait_total += wait;
+	if (wait > ls->wait_max)
+		ls->wait_max = wait;
+	ls->wait_hist[scull_lat_bucket(wait)]++;
+
+	ls->start = now;
+	ls->op = op;
+	ls->pos = pos;
+	return 0;
+}
+
+static int scull_lock(struct scull_dev *dev, int op, loff_t pos,
+		bool timed, u64 *wait_ns)
+{
+	return __scull_lock(dev, op, pos, timed, wait_ns, false);
+}
+
+/* for what has to be done once started, like the work of a release */
+static int scull_lock_killable(struct scull_dev *dev, int op)
+{
+	return __scull_lock(dev, op, 0, false, NULL, true);
+}
+
+static void scull_unlock(struct scull_dev *dev)
+{
+	struct scull_lockstat *ls = &dev->lockstat;
+
+	if (ls->start) {
+		u64 hold = ktime_get_ns() - ls->start;
+
+		ls->hold_total += hold;
+		if (hold > ls->hold_max) {
+			ls->hold_max = hold;
+			ls->max_op = ls->op;
+			ls->max_pos = ls->pos;
+		}
+		ls->hold_hist[scull_lat_bucket(hold)]++;
+		ls->start = 0;
+	}
+	up(&dev->sem);
+}
+
+/*
+ * The first device at index *pos or after it which was ever opened.
+ * Devices nobody opened are not allocated and not shown.
+ */
+static struct scull_dev *scull_seq_dev(loff_t *pos)
+{
+	struct scull_dev *dev;
+
+	for (; *pos < scull_nr_devs; (*pos)++) {
+		dev = READ_ONCE(scull_devices[*pos]);
+		if (dev)
+			return dev;
+	}
+	return NULL; /* No more to read */
+}
+
+/* The sfile argument can almost always be ignored. pos is an integer position indicating where the reading should start.
+ * Since seq_file implementations typically step through a sequence of interesting items,
+ * the position is often interpreted as a cursor pointing to the next item in the sequence.
+ * The scull driver interprets each device as one item in the sequence,
+ * so the incoming pos is simply an index into the scull_devices array.
+ */ 
+static void *scull_seq_start(struct seq_file *s, loff_t *pos)
+{
+	return scull_seq_dev(pos);
+}
+
+/*
+ * v is the iterator as returned from the previous call to start or next,
+ * pos is the current position in the file
+ * next should increment the value pointed to by pos
+ * depending on how your iterator works, you might (though probably won’t) want to increment pos by more than one.
+ */
+static void *scull_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	(*pos)++;
+	return scull_seq_dev(pos);
+}
+
+/* When the kernel is done with the iterator, it calls stop to clean up
+ * The scull implementation has no cleanup work to do, so its stop method is empty.
+ */
+static void scull_seq_stop(struct seq_file *s, void *v)
+{
+	/* Actually, there's nothing to do here */
+}
+
+/*
+ * /proc/scullmem is the summary: one line per device, made only of the
+ * counters kept up to date by scull_follow(), scull_write() and
+ * scull_trim(). It does not take dev->sem, so it can be polled as often
+ * as wanted without stalling the writers.
+ *
+ * used:  bytes stored in the device (dev->size)
+ * alloc: bytes of quanta allocated to the device
+ * nodes: nodes of the index of quantum sets
+ * holes: quanta missing below dev->size (sparse writes)
+ * slack: allocated bytes not holding data, in percent of alloc
+ * extents: allocations of several quanta for sequential writers
+ * open:  how long the first open took to set the device up
+ */
+static int scull_mem_show(struct seq_file *s, void *v)
+{
+	struct scull_dev *dev = (struct scull_dev *) v;
+	u64 size = READ_ONCE(dev->size);
+	int quantum = READ_ONCE(dev->quantum);
+	unsigned long nr_qsets = READ_ONCE(dev->nr_qsets);
+	unsigned long nr_quanta = READ_ONCE(dev->nr_quanta);
+	unsigned long nr_nodes = READ_ONCE(dev->nr_nodes);
+	unsigned long nr_extents = READ_ONCE(dev->nr_extents);
+	u64 alloc = (u64) nr_quanta * quantum;
+	u64 needed = div_u64(size + quantum - 1, quantum);
+	u64 holes = needed > nr_quanta ? needed - nr_quanta : 0;
+	unsigned int slack = 0;
+
+	/* with holes, size - alloc can be negative */
+	if (alloc > size)
+		slack = div64_u64((alloc - size) * 100, alloc);
+
+	seq_printf(s, "scull%i: qset %i q %i used %llu alloc %llu qsets %lu quanta %lu nodes %lu holes %llu slack %u%% extents %lu open %lluns\n",
+			dev->index, READ_ONCE(dev->qset), quantum, size, alloc,
+			nr_qsets, nr_quanta, nr_nodes, holes, slack, nr_extents,
+			dev->first_open_ns);
+	return 0;
+}
+
+static struct seq_operations scull_mem_seq_ops = {
+	.start = scull_seq_start,
+	.next  = scull_seq_next,
+	.stop  = scull_seq_stop,
+	.show  = scull_mem_show
+};
+
+static int scull_mem_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &scull_mem_seq_ops);
+}
+
+static struct file_operations scull_mem_proc_ops = {
+	.owner = THIS_MODULE,
+	.open = scull_mem_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release
+};
+
+/*
+ * /proc/scullseq is the detailed dump. Each seq_file step prints a single
+ * quantum set, and dev->sem is only held for that step: a large device
+ * is dumped bit by bit while readers and writers go on in between.
+ *
+ * Every step is the header of a device (@item -1) or one of its quantum
+ * sets, holes are skipped: each step looks up the next present item in
+ * the index, which is a short walk however sparse the device is. The
+ * position only counts the steps, the iterator in seq_file->private
+ * knows where step *pos is.
+ */
+struct scull_seq_iter {
+	int dev;                  /* index in scull_devices */
+	s64 item;                 /* quantum set to show, -1 for the header */
+	s64 next_item;            /* the present item after @item, -1 if none */
+	loff_t pos;               /* step @dev and @item are at */
+};
+
+/* move @iter to the header of the next device which was ever opened */
+static void *scull_qset_seq_dev(struct scull_seq_iter *iter)
+{
+	loff_t i = iter->dev;
+
+	if (!scull_seq_dev(&i))
+		return NULL;
+	if (i != iter->dev) {
+		iter->dev = i;
+		iter->item = -1;
+	}
+	return iter;
+}
+
+static void *scull_qset_seq_start(struct seq_file *s, loff_t *pos)
+{
+	struct scull_seq_iter *iter = s->private;
+
+	if (*pos == 0) {
+		iter->dev = 0;
+		iter->item = -1;
+		iter->pos = 0;
+	} else if (*pos != iter->pos) {
+		return NULL; /* seq_file only restarts where it stopped, or at 0 */
+	}
+	return scull_qset_seq_dev(iter);
+}
+
+static void *scull_qset_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	struct scull_seq_iter *iter = v;
+
+	if (iter->next_item >= 0) {
+		iter->item = iter->next_item;
+	} else {
+		iter->dev++;
+		iter->item = -1;
+	}
+	iter->pos = ++*pos;
+	return scull_qset_seq_dev(iter);
+}
+
+static int scull_qset_seq_show(struct seq_file *s, void *v)
+{
+	struct scull_seq_iter *iter = v;
+	struct scull_dev *dev = scull_devices[iter->dev];
+	struct scull_qset *d;
+	u64 next;
+	int i;
+
+	if (down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+
+	next = iter->item + 1;
+	iter->next_item = scull_next_qset(dev, &next) ? next : -1;
+
+	if (iter->item < 0) {
+		seq_printf(s, "\nDevice %i: qset %i, q %i, sz %lld, index height %i, %lu nodes\n",
+				dev->index, dev->qset, dev->quantum, dev->size,
+				dev->height, dev->nr_nodes);
+		up(&dev->sem);
+		return 0;
+	}
+
+	d = scull_lookup(dev, iter->item);
+	if (d) {
+		seq_printf(s, "  item %lld at %p, qset at %p\n", iter->item, d, d->data);
+		if (d->data && iter->next_item < 0) /* dump only the last item */
+			for (i = 0; i < dev->qset; i++) {
+				if (scull_spilled(d, i))
+					seq_printf(s, "    % 4i: spilled\n", i);
+				else if (d->data[i])
+					seq_printf(s, "    % 4i: %8p\n",
+							i, d->data[i]);
+			}
+	}
+	up(&dev->sem);
+	return 0;
+}
+
+/*
+ * Now that it has a full set of iterator operations, 
+ * scull must package them up and connect them to a file in /proc 
+ */
+static struct seq_operations scull_seq_ops = {
+	.start = scull_qset_seq_start,
+	.next  = scull_qset_seq_next,
+	.stop  = scull_seq_stop,
+	.show  = scull_qset_seq_show
+}; 
+
+/* create an open method that connects the file to the seq_file operations
+ * the iterator lives in seq_file->private, allocated and zeroed by seq_open_private
+ * */
+static int scull_proc_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &scull_seq_ops, sizeof(struct scull_seq_iter));
+}
+
+/* open is the only file operation we must implement ourselves, 
+ * so we can now set up our file_operations structure
+ * Here we specify our own open method, but use the canned methods seq_read, seq_lseek, and seq_release_private for everything else
+ */
+static struct file_operations scull_seq_proc_ops = {
+	.owner = THIS_MODULE,
+	.open = scull_proc_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private
+};
+
+/*
+ * /proc/scull_lockstat shows the profile of each dev->sem, one device
+ * per seq_file step. The counters are read without taking the semaphore:
+ * the numbers may be a bit off while the device is busy, but reading
+ * them never makes the writers wait.
+ */
+static const char *scull_op_names[SCULL_OP_NR] = {
+	[SCULL_OP_OPEN]  = "open",
+	[SCULL_OP_READ]  = "read",
+	[SCULL_OP_WRITE] = "write",
+};
+
+static void scull_lockstat_hist(struct seq_file *s, const char *name,
+		unsigned long *hist)
+{
+	int i;
+
+	for (i = 0; i < SCULL_LAT_BUCKETS; i++)
+		if (hist[i])
+			seq_printf(s, "  %s < %llu ns: %lu\n", name,
+					1ULL << i, hist[i]);
+}
+
+/*
+ * The quanta the writers allocated themselves, holding dev->sem, because
+ * the reserve of pool.c had none ready. Shown even when scull_lockstat
+ * is off: the clock is read only for those, which are slow anyway.
+ */
+static void scull_allocstat_show(struct seq_file *s, struct scull_dev *dev)
+{
+	struct scull_allocstat *st = &dev->alloc;
+	u64 stalls = READ_ONCE(st->stalls);
+
+	seq_printf(s, "  alloc: reserve hits %llu, stalls %llu", st->hits, stalls);
+	if (stalls)
+		seq_printf(s, ", max %llu ns, avg %llu ns", st->stall_max_ns,
+				div64_u64(st->stall_ns, stalls));
+	seq_puts(s, "\n");
+	scull_lockstat_hist(s, "stall", dev->stall_hist);
+}
+
+/* the quanta in the file of scull_spill, and how long reading one back took */
+static void scull_spillstat_show(struct seq_file *s, struct scull_dev *dev)
+{
+	struct scull_spillstat *st = &dev->spill;
+	u64 refaults = READ_ONCE(st->refaults);
+
+	if (!*scull_spill)
+		return;
+	seq_printf(s, "  spill: spilled %lu, spills %llu, errors %llu, refaults %llu",
+			READ_ONCE(dev->nr_spilled), st->spills, st->errors, refaults);
+	if (refaults)
+		seq_printf(s, ", max %llu ns, avg %llu ns", st->refault_max_ns,
+				div64_u64(st->refault_ns, refaults));
+	seq_puts(s, "\n");
+	scull_lockstat_hist(s, "refault", dev->refault_hist);
+}
+
+static int scull_lockstat_show(struct seq_file *s, void *v)
+{
+	struct scull_dev *dev = (struct scull_dev *) v;
+	struct scull_lockstat *ls = &dev->lockstat;
+	unsigned long n = ls->acquired;
+
+	seq_printf(s, "\nDevice %i: acquired %lu\n", dev->index, n);
+	scull_allocstat_show(s, dev);
+	scull_spillstat_show(s, dev);
+	if (!n)
+		return 0;
+	seq_printf(s, "  wait max %llu ns, avg %llu ns\n",
+			ls->wait_max, div64_u64(ls->wait_total, n));
+	seq_printf(s, "  hold max %llu ns, avg %llu ns, longest by %s at %lld\n",
+			ls->hold_max, div64_u64(ls->hold_total, n),
+			scull_op_names[ls->max_op], ls->max_pos);
+	scull_lockstat_hist(s, "wait", ls->wait_hist);
+	scull_lockstat_hist(s, "hold", ls->hold_hist);
+	return 0;
+}
+
+static struct seq_operations scull_lockstat_seq_ops = {
+	.start = scull_seq_start,
+	.next  = scull_seq_next,
+	.stop  = scull_seq_stop,
+	.show  = scull_lockstat_show
+};
+
+static int scull_lockstat_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &scull_lockstat_seq_ops);
+}
+
+/* writing anything to /proc/scull_lockstat starts a new profile */
+static ssize_t scull_lockstat_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *f_pos)
+{
+	int i;
+
+	for (i = 0; i < scull_nr_devs; i++) {
+		struct scull_dev *dev = READ_ONCE(scull_devices[i]);
+
+		if (!dev)
+			continue;
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		memset(&dev->lockstat, 0, sizeof(dev->lockstat));
+		memset(&dev->alloc, 0, sizeof(dev->alloc));
+		memset(dev->stall_hist, 0, sizeof(dev->stall_hist));
+		memset(&dev->spill, 0, sizeof(dev->spill));
+		memset(dev->refault_hist, 0, sizeof(dev->refault_hist));
+		up(&dev->sem);
+	}
+	return count;
+}
+
+static struct file_operations scull_lockstat_proc_ops = {
+	.owner = THIS_MODULE,
+	.open = scull_lockstat_open,
+	.read = seq_read,
+	.write = scull_lockstat_write,
+	.llseek = seq_lseek,
+	.release = seq_release
+};
+
+/*
+ * create the proc files: summary, detailed dump and lock profile
+ * */
+static void scull_create_proc(void)
+{
+	struct proc_dir_entry * proc_scullmem = NULL;
+	struct proc_dir_entry * proc_scullseq = NULL;
+	struct proc_dir_entry * proc_lockstat = NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+	proc_scullmem = create_proc_entry("scullmem", 0, NULL);
+	if (proc_scullmem)
+		proc_scullmem->proc_fops = &scull_mem_proc_ops;
+#else
+	proc_scullmem = proc_create("scullmem", 0, NULL, &scull_mem_proc_ops);
+#endif
+
+	if(!proc_scullmem)
+		printk(KERN_ERR "create scullmem failed!\n");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+	proc_scullseq = create_proc_entry("scullseq", 0, NULL);
+	if (proc_scullseq)
+		proc_scullseq->proc_fops = &scull_seq_proc_ops;
+	else
+		printk(KERN_ERR "create scullseq failed!\n");
+#else
+	proc_scullseq = proc_create("scullseq", 0, NULL, &scull_seq_proc_ops);
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+	proc_lockstat = create_proc_entry("scull_lockstat", S_IRUGO | S_IWUSR, NULL);
+	if (proc_lockstat)
+		proc_lockstat->proc_fops = &scull_lockstat_proc_ops;
+#else
+	proc_lockstat = proc_create("scull_lockstat", S_IRUGO | S_IWUSR, NULL,
+			&scull_lockstat_proc_ops);
+#endif
+	if (!proc_lockstat)
+		printk(KERN_ERR "create scull_lockstat failed!\n");
+}
+
+static void scull_remove_proc(void)
+{
+	/* no problem if it was not registered */
+	remove_proc_entry("scullmem", NULL /* parent dir */);
+	remove_proc_entry("scullseq", NULL);
+	remove_proc_entry("scull_lockstat", NULL);
+}
+
+/*
+ * Set up a zeroed device: the bare ones, and those of access.c.
+ */
+void scull_dev_init(struct scull_dev *dev, int index)
+{
+	dev->index = index;
+	scull_set_geometry(dev, scull_quantum, scull_qset);
+	sema_init(&dev->sem, 1); // initialized to 1 as mutex
+}
+
+/*
+ * Return device @index, allocating it if this is its first open.
+ *
+ * Two first opens may race: both allocate a device, one of them wins the
+ * cmpxchg and the other frees its copy. Once installed, a device stays
+ * until the module is unloaded, so no reference counting is needed.
+ */
+static struct scull_dev *scull_get_dev(int index)
+{
+	struct scull_dev *dev = READ_ONCE(scull_devices[index]);
+	struct scull_dev *old;
+	u64 start;
+
+	if (dev)
+		return dev;
+
+	start = ktime_get_ns();
+	dev = kzalloc(sizeof(struct scull_dev), GFP_KERNEL);
+	if (!dev)
+		return NULL;
+	scull_dev_init(dev, index);
+	dev->first_open_ns = ktime_get_ns() - start;
+
+	/* cmpxchg orders the initialization above before the pointer */
+	old = cmpxchg(&scull_devices[index], NULL, dev);
+	if (old) {
+		kfree(dev);
+		return old;
+	}
+	return dev;
+}
+
+/*
+ * Give @filp its struct scull_file, for every kind of scull device,
+ * after trimming the device if it was opened write-only. The last thing
+ * an open does: it is undone by scull_release(), nothing is left to
+ * undo if this fails.
+ */
+int scull_file_open(struct file *filp, struct scull_dev *dev)
+{
+	struct scull_file *sf;
+	bool rewrite = false;
+
+	/* or keep its quanta, and cut it at release, see SCULL_IOC_SET_REWRITE */
+	if ((filp->f_flags & O_ACCMODE) == O_WRONLY)
+		rewrite = READ_ONCE(dev->rewrite) && READ_ONCE(dev->mode) == SCULL_MODE_BYTES;
+
+	/* now trim the length of the deivce to 0 if open was write-only */
+	if ((filp->f_flags & O_ACCMODE) == O_WRONLY && !rewrite) {
+		struct scull_log *log = scull_log_block(dev);
+
+		if (scull_lock(dev, SCULL_OP_OPEN, 0, false, NULL)) {
+			scull_log_unblock(dev, log);
+			return -ERESTARTSYS;
+		}
+
+		scull_trim(dev);
+		if (scull_checking())
+			scull_check(dev);
+		scull_unlock(dev);
+		scull_log_unblock(dev, log);
+	}
+
+	sf = kzalloc(sizeof(struct scull_file), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	sf->dev = dev;
+	sf->rewrite = rewrite;
+	scull_wc_init(sf);
+	filp->private_data = sf;
+	return 0;
+}
+
+/*
+ * Open and Close
+ */
+int scull_open(struct inode *inode, struct file *filp)
+{
+	struct scull_dev *dev;
+
+	/* identify which device is being opened.
+	* all the minors share scull_cdev, so the minor number of the inode
+	* tells which one it is. the cdev only covers our range of minors */
+	dev = scull_get_dev(iminor(inode) - scull_minor);
+	if (!dev)
+		return -ENOMEM;
+	return scull_file_open(filp, dev);
+}
+
+int scull_release (struct inode *inode, struct file *filp)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	int retval;
+
+	/* what is still buffered reaches the device before the file goes */
+	retval = scull_wc_release(sf);
+	if (sf->rewrite) {
+		/*
+		 * what was not rewritten goes, as if it had been emptied;
+		 * unless the process is being killed while it waits
+		 */
+		if (!scull_lock_killable(dev, SCULL_OP_WRITE)) {
+			if (dev->mode == SCULL_MODE_BYTES)
+				scull_truncate_locked(dev, sf->cur.write_max);
+			if (scull_checking())
+				scull_check(dev);
+			scull_unlock(dev);
+		}
+	}
+	kfree(sf);
+	return retval;
+}
+
+/*
+ * The device has no cache of its own, only the write-combining buffer
+ * of the file.
+ */
+int scull_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct scull_file *sf = filp->private_data;
+
+	return scull_wc_flush(sf, true);
+}
+
+/*
+ * Allocate, zeroed, the quanta of @offset to @offset + @len, so that
+ * writing there later does not allocate; the device grows to the end of
+ * the range unless FALLOC_FL_KEEP_SIZE. The VFS only calls this for
+ * regular files and block devices: for a scull device it is reached
+ * through SCULL_IOC_FALLOCATE. More than SCULL_FALLOC_USER_MAX bytes at
+ * once need CAP_SYS_ADMIN.
+ */
+#define SCULL_FALLOC_USER_MAX  (1LL << 30)
+
+long scull_fallocate(struct file *filp, int mode, loff_t offset, loff_t len)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	long retval;
+
+	if (mode & ~FALLOC_FL_KEEP_SIZE)
+		return -EOPNOTSUPP;
+	if (!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+	if ((u64)offset >= scull_max_size || (u64)len > scull_max_size - offset)
+		return -EFBIG;
+	/* anyone may write, but not take that much memory in one call */
+	if (len > SCULL_FALLOC_USER_MAX && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (down_interruptible(&dev->sem))
+		return -ERESTARTSYS;
+	if (dev->mode == SCULL_MODE_BYTES)
+		retval = scull_fallocate_locked(dev, offset, len,
+				mode & FALLOC_FL_KEEP_SIZE);
+	else
+		retval = -EOPNOTSUPP;
+	if (scull_checking())
+		scull_check(dev);
+	up(&dev->sem);
+	return retval;
+}
+
+/*
+ * Sleep for a delay drawn by scull_inject_delay(). Long ones can be cut
+ * short by a signal, the caller gets its data anyway.
+ */
+static void scull_inject_sleep(u32 us)
+{
+	if (!us)
+		return;
+	if (us < 20000)
+		usleep_range(us, us + us / 8);
+	else
+		msleep_interruptible(DIV_ROUND_UP(us, 1000));
+}
+
+/* the start of a read or write for scull_iotrace_add(), 0 if not traced */
+static inline u64 scull_iotrace_start(struct scull_dev *dev)
+{
+	return rcu_access_pointer(dev->iotrace) ? ktime_get_ns() : 0;
+}
+
+/*
+ * Data management: read and write
+ * the quantum sets themselves are handled in qset.c
+ */
+ssize_t scull_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	loff_t pos = *f_pos;
+	size_t asked = count;
+	u64 wait_ns = 0, start;
+	ssize_t retval;
+	u32 delay;
+
+	if (READ_ONCE(dev->mode) == SCULL_MODE_KV)
+		return -EINVAL;     /* the SCULL_IOC_KV_* ioctls only */
+	start = scull_iotrace_start(dev);
+
+	/* a file reads what it wrote */
+	if (READ_ONCE(sf->wc_buf))
+		scull_wc_flush(sf, false);
+
+	if (scull_lock(dev, SCULL_OP_READ, pos, trace_scull_read_enabled() || start,
+			&wait_ns))
+		return -ERESTARTSYS;
+	delay = scull_inject_delay(dev);
+	if (dev->mode == SCULL_MODE_RECORD) {
+		/* a record is read whole or not at all, never short */
+		retval = scull_rec_read_locked(dev, buf, count, f_pos, &loc, &sf->cur);
+	} else if (dev->mode == SCULL_MODE_KV) {
+		retval = -EINVAL;   /* switched to since the test above */
+	} else {
+		count = scull_inject_short(dev, count);
+		retval = scull_read_locked(dev, buf, count, f_pos, &loc, &sf->cur);
+	}
+	scull_unlock(dev);
+	scull_inject_sleep(delay);
+
+	trace_scull_read(dev->index, pos, count, loc.item, loc.s_pos, wait_ns, retval);
+	scull_iotrace_add(dev, SCULL_OP_READ, start, pos, asked, retval, wait_ns);
+	return retval;
+}
+
+ssize_t scull_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	loff_t pos = *f_pos;
+	size_t asked = count;
+	u64 wait_ns = 0, start;
+	ssize_t retval;
+	u32 delay;
+
+	if (READ_ONCE(dev->mode) == SCULL_MODE_KV)
+		return -EINVAL;
+	start = scull_iotrace_start(dev);
+	if (READ_ONCE(dev->mode) == SCULL_MODE_LOG) {
+		retval = scull_log_write(dev, &sf->cur, buf, count, f_pos);
+		scull_iotrace_add(dev, SCULL_OP_WRITE, start, pos, asked, retval, 0);
+		return retval;
+	}
+
+	/* small writes stop in the buffer of the file, if it has one */
+	if (READ_ONCE(sf->wc_buf) && READ_ONCE(dev->mode) == SCULL_MODE_BYTES) {
+		retval = scull_wc_write(sf, buf, count, f_pos);
+		if (retval) {
+			scull_iotrace_add(dev, SCULL_OP_WRITE, start, pos, asked, retval, 0);
+			return retval;
+		}
+	}
+
+	if (scull_lock(dev, SCULL_OP_WRITE, pos, trace_scull_write_enabled() || start,
+			&wait_ns))
+		return -ERESTARTSYS;
+	delay = scull_inject_delay(dev);
+	if (dev->mode == SCULL_MODE_RECORD) {
+		retval = scull_rec_write_locked(dev, buf, count, f_pos, &loc, &sf->cur);
+	} else if (dev->mode != SCULL_MODE_BYTES) {
+		/* switched since the test above: a log is only written by appends */
+		retval = -EINVAL;
+	} else {
+		count = scull_inject_short(dev, count);
+		retval = scull_write_locked(dev, buf, count, f_pos, &loc, &sf->cur);
+	}
+	if (scull_checking())
+		scull_check(dev);
+	scull_unlock(dev);
+	scull_inject_sleep(delay);
+
+	trace_scull_write(dev->index, pos, count, loc.item, loc.s_pos, wait_ns, retval);
+	scull_iotrace_add(dev, SCULL_OP_WRITE, start, pos, asked, retval, wait_ns);
+	return retval;
+}
+
+/*
+ * The device is as large as the last byte written, and may be seeked
+ * anywhere below scull_max_size: writing there leaves a hole before.
+ * In record mode the position is a record number, up to the number of
+ * records, which is where SEEK_END starts from.
+ */
+loff_t scull_llseek(struct file *filp, loff_t off, int whence)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	loff_t newpos, end = scull_max_size;
+	bool records = false;
+
+	if (READ_ONCE(dev->mode) == SCULL_MODE_RECORD) {
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		records = dev->mode == SCULL_MODE_RECORD;
+		if (records)
+			end = scull_rec_count(dev);
+		up(&dev->sem);
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		newpos = off;
+		break;
+
+	case SEEK_CUR:
+		newpos = filp->f_pos + off;
+		break;
+
+	case SEEK_END:
+		if (records) {
+			newpos = end + off;
+			break;
+		}
+		if (READ_ONCE(sf->wc_buf))
+			scull_wc_flush(sf, false);
+		newpos = READ_ONCE(dev->size) + off;
+		break;
+
+	default: /* can't happen */
+		return -EINVAL;
+	}
+	if (newpos < 0 || newpos > end)
+		return -EINVAL;
+	filp->f_pos = newpos;
+	return newpos;
+}
+
+/*
+ * SCULL_IOC_SET_MODE: empty the device and make it a @mode one. The
+ * table of record mode is only kept while in it.
+ */
+static int scull_set_mode(struct scull_dev *dev, unsigned long mode)
+{
+	struct scull_log *log;
+	int retval;
+
+	if (mode > SCULL_MODE_MAX)
+		return -EINVAL;
+	if (mode == SCULL_MODE_LOG)
+		retval = scull_log_setup(dev);
+	else if (mode == SCULL_MODE_KV)
+		retval = scull_kv_setup(dev);
+	else
+		retval = 0;
+	if (retval)
+		return retval;
+
+	log = scull_log_block(dev);
+	if (scull_lock(dev, SCULL_OP_OPEN, 0, false, NULL)) {
+		scull_log_unblock(dev, log);
+		return -ERESTARTSYS;
+	}
+	if (mode == SCULL_MODE_RECORD) {
+		retval = scull_rec_setup(dev);
+	} else {
+		scull_rec_free(dev);
+		retval = 0;
+	}
+	if (!retval) {
+		scull_trim(dev);
+		WRITE_ONCE(dev->mode, mode);
+	}
+	scull_unlock(dev);
+	scull_log_unblock(dev, log);
+	if (!retval)
+		scull_kv_clear(dev);    /* once the puts see the new mode */
+	return retval;
+}
+
+/*
+ * Free what a device holds, not the device itself. The module is going
+ * away, nobody has it open.
+ */
+void scull_dev_destroy(struct scull_dev *dev)
+{
+	scull_trim(dev);
+	scull_log_free(dev);
+	scull_rec_free(dev);
+	scull_kv_free(dev);
+	scull_pool_free(dev);
+	scull_iotrace_free(dev);
+}
+
+static void faulty_write(void)
+{
+	PDEBUG("this is oops test by scull ioctrl. not an issue.\n");
+	*(int*)0 = 0;
+}
+
+/*
+ *  bits    meaning
+ * dir: 31-30
+ *          00 - no parameters: uses _IO macro
+	        10 - read: _IOR
+	        01 - write: _IOW
+	        11 - read/write: _IOWR
+
+ * size: 29-16	size of arguments
+
+ * type: 15-8	ascii character supposedly
+	unique to each driver
+
+ * nr: 7-0	function #
+ *      ioctl cmd
+ * */
+long scull_ioctl(struct file *filp,
+        unsigned int cmd, unsigned long arg)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	struct scull_inject inject;
+	struct scull_wcombine wc;
+	struct scull_rec_batch batch;
+	struct scull_falloc falloc;
+	struct scull_allocstat alloc;
+	struct scull_spillstat spill;
+	struct scull_iotrace_read iotrace;
+	struct scull_csum csum;
+	struct scull_find find;
+	u64 size;
+	int retval = 0;
+	if (_IOC_TYPE(cmd) != SCULL_IOC_MAGIC)
+		return -ENOTTY;
+
+	if (_IOC_NR(cmd) > SCULL_IOC_MAX)
+		return -ENOTTY;
+
+	PDEBUG("cmd 0x%08x.\n", cmd);
+	switch(cmd) {
+	case SCULL_IOC_MAKE_FAULTY_WRITE:
+		faulty_write();
+		break;
+
+	case SCULL_IOC_SET_INJECT:
+		/* it slows and fails the I/O of everybody using the device */
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user(&inject, (void __user *)arg, sizeof(inject)))
+			return -EFAULT;
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		retval = scull_inject_set(dev, &inject);
+		up(&dev->sem);
+		break;
+
+	case SCULL_IOC_GET_INJECT:
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		inject = dev->inject;
+		up(&dev->sem);
+		if (copy_to_user((void __user *)arg, &inject, sizeof(inject)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_SET_WCOMBINE:
+		if (copy_from_user(&wc, (void __user *)arg, sizeof(wc)))
+			return -EFAULT;
+		retval = scull_wc_set(sf, &wc);
+		break;
+
+	case SCULL_IOC_SET_MODE:
+		/* it empties the device */
+		if (!(filp->f_mode & FMODE_WRITE))
+			return -EPERM;
+		retval = scull_set_mode(dev, arg);
+		break;
+
+	case SCULL_IOC_GET_MODE:
+		return READ_ONCE(dev->mode);
+
+	case SCULL_IOC_GET_WCOMBINE:
+		if (mutex_lock_interruptible(&sf->wc_lock))
+			return -ERESTARTSYS;
+		wc = sf->wc;
+		mutex_unlock(&sf->wc_lock);
+		if (copy_to_user((void __user *)arg, &wc, sizeof(wc)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_KV_PUT:
+	case SCULL_IOC_KV_GET:
+	case SCULL_IOC_KV_DELETE:
+	case SCULL_IOC_KV_MGET:
+	case SCULL_IOC_KV_STATS:
+		return scull_kv_ioctl(dev, cmd, arg, filp->f_mode & FMODE_WRITE);
+
+	case SCULL_IOC_READ_RECORDS:
+		if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+			return -EFAULT;
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		if (dev->mode == SCULL_MODE_RECORD)
+			retval = scull_rec_read_batch_locked(dev, &batch, &filp->f_pos, &sf->cur);
+		else
+			retval = -EINVAL;
+		up(&dev->sem);
+		if (retval >= 0 && copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_FALLOCATE:
+		if (copy_from_user(&falloc, (void __user *)arg, sizeof(falloc)))
+			return -EFAULT;
+		if (falloc.mode & ~SCULL_FALLOC_KEEP_SIZE)
+			return -EOPNOTSUPP;
+		retval = scull_fallocate(filp, falloc.mode & SCULL_FALLOC_KEEP_SIZE ?
+				FALLOC_FL_KEEP_SIZE : 0, falloc.offset, falloc.len);
+		break;
+
+	case SCULL_IOC_GET_ALLOCSTAT:
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		alloc = dev->alloc;
+		up(&dev->sem);
+		scull_pool_stat(dev, &alloc);
+		if (copy_to_user((void __user *)arg, &alloc, sizeof(alloc)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_SPILL:
+		/* make room ahead of the shrinker, or test the refaults */
+		if (!(filp->f_mode & FMODE_WRITE))
+			return -EPERM;
+		if (!*scull_spill)
+			return -EOPNOTSUPP;
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		retval = scull_spill_dev(dev, min_t(unsigned long, arg, INT_MAX));
+		if (scull_checking())
+			scull_check(dev);
+		up(&dev->sem);
+		break;
+
+	case SCULL_IOC_GET_SPILLSTAT:
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		spill = dev->spill;
+		spill.spilled = dev->nr_spilled;
+		up(&dev->sem);
+		if (copy_to_user((void __user *)arg, &spill, sizeof(spill)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_IOTRACE:
+		/* the pids of everybody using the device */
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		retval = scull_iotrace_set(dev, arg);
+		break;
+
+	case SCULL_IOC_IOTRACE_READ:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user(&iotrace, (void __user *)arg, sizeof(iotrace)))
+			return -EFAULT;
+		retval = scull_iotrace_read(dev, &iotrace);
+		if (!retval && copy_to_user((void __user *)arg, &iotrace, sizeof(iotrace)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_CHECKSUM:
+		/* it reads the device */
+		if (!(filp->f_mode & FMODE_READ))
+			return -EBADF;
+		if (copy_from_user(&csum, (void __user *)arg, sizeof(csum)))
+			return -EFAULT;
+		if (READ_ONCE(sf->wc_buf))
+			scull_wc_flush(sf, false);
+		retval = scull_checksum(dev, &csum);
+		/* how far it got before a signal too */
+		if ((!retval || retval == -EINTR) &&
+		    copy_to_user((void __user *)arg, &csum, sizeof(csum)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_FIND:
+		if (!(filp->f_mode & FMODE_READ))
+			return -EBADF;
+		if (copy_from_user(&find, (void __user *)arg, sizeof(find)))
+			return -EFAULT;
+		if (READ_ONCE(sf->wc_buf))
+			scull_wc_flush(sf, false);
+		retval = scull_find(dev, &find);
+		if ((!retval || retval == -EINTR) &&
+		    copy_to_user((void __user *)arg, &find, sizeof(find)))
+			return -EFAULT;
+		break;
+
+	case SCULL_IOC_TRUNCATE:
+		if (!(filp->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (copy_from_user(&size, (void __user *)arg, sizeof(size)))
+			return -EFAULT;
+		if (size > scull_max_size)
+			return -EFBIG;
+		/* what the file buffered lands before the cut */
+		if (READ_ONCE(sf->wc_buf))
+			scull_wc_flush(sf, false);
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		if (dev->mode == SCULL_MODE_BYTES)
+			retval = scull_truncate_locked(dev, size);
+		else
+			retval = -EINVAL;
+		if (scull_checking())
+			scull_check(dev);
+		up(&dev->sem);
+		break;
+
+	case SCULL_IOC_SET_REWRITE:
+		if (!(filp->f_mode & FMODE_WRITE))
+			return -EPERM;
+		retval = READ_ONCE(dev->rewrite);
+		WRITE_ONCE(dev->rewrite, !!arg);
+		break;
+
+	default:
+		PDEBUG("unknown cmd 0x%08x.\n", cmd);
+		break;
+	}
+
+	return retval;
+}
+struct file_operations scull_fops = {
+	.owner =    THIS_MODULE,
+	.llseek =   scull_llseek,
+	.read =     scull_read,
+	.write =    scull_write,
+	.unlocked_ioctl =    scull_ioctl,
+	.open =     scull_open,
+	.release =  scull_release,
+	.fsync =    scull_fsync,
+	.fallocate = scull_fallocate,
+#ifdef SCULL_URING
+	.uring_cmd = scull_uring_cmd,
+#endif
+};
+
+/*
+ * The cleanup function is used to handle initialization failures as well.
+ * Thefore, it must be carefull to work correctly even if some of the items
+ * have not been initialized
+ */
+void scull_cleanup_module(void)
+{
+	int i;
+	dev_t devno = MKDEV(scull_major, scull_minor);
+
+	/* Get rid of our char dev entries */
+	if (scull_cdev_added)
+		cdev_del(&scull_cdev);
+	scull_spill_exit();     /* its shrinker goes through the devices */
+	if (scull_devices) {
+		for (i=0; i < scull_nr_devs; i++) {
+			if (!scull_devices[i])
+				continue;
+			scull_dev_destroy(scull_devices[i]);
+			kfree(scull_devices[i]);
+		}
+		vfree(scull_devices);
+	}
+	scull_remove_proc();
+	scull_uring_exit();
+
+	/* and call the cleanup functions for friend devices */
+	scull_access_cleanup();
+
+	/* cleanup_module is never called if registering failed */
+	unregister_chrdev_region(devno, scull_nr_devs);
+	printk(KERN_WARNING "scull exit, major %d\n", scull_major);
+}
+
+int scull_init_module(void)
+{
+	int result;
+	dev_t dev = 0;
+	u64 start = ktime_get_ns();
+
+	if (scull_max_size > MAX_LFS_FILESIZE)
+		scull_max_size = MAX_LFS_FILESIZE;
+
+	/* the parameters are plain ints: the range has to fit in the minors */
+	if (scull_minor < 0 || scull_nr_devs <= 0 ||
+	    (unsigned int)scull_minor + scull_nr_devs > MINORMASK) {
+		printk(KERN_WARNING "scull: bad scull_minor %d or scull_nr_devs %d\n",
+				scull_minor, scull_nr_devs);
+		return -EINVAL;
+	}
+
+	/* Get a range of minor numbers to work with, asking for a
+	* dynamic major unless directed otherwise at load time.
+	*/
+	if (scull_major) {
+		dev = MKDEV(scull_major, scull_minor);
+		result = register_chrdev_region(dev, scull_nr_devs, "scull");
+	}
+	else {
+		result = alloc_chrdev_region(&dev, scull_minor, scull_nr_devs, "scull");
+		scull_major = MAJOR(dev);
+	}
+
+	if(result < 0) {
+		printk(KERN_WARNING "scull: can't get major %d\n", scull_major);
+		return result;
+	}
+
+	/*
+	* allocate the device pointers -- we can't have them static, as the number
+	* can be specified at load time. the devices are allocated by scull_open
+	*/
+	scull_devices = vzalloc(array_size(scull_nr_devs, sizeof(*scull_devices)));
+	if (!scull_devices) {
+		result = -ENOMEM;
+		goto fail;
+	}
+
+	/* before the devices are live: their io_uring commands may use it */
+	result = scull_uring_init();
+	if (result)
+		goto fail;
+	result = scull_spill_init(scull_spill);
+	if (result)
+		goto fail;
+
+	/* one cdev for the whole range of minors, live as soon as it is added */
+	cdev_init(&scull_cdev, &scull_fops);
+	scull_cdev.owner = THIS_MODULE;
+	result = cdev_add(&scull_cdev, dev, scull_nr_devs);
+	if (result) {
+		printk(KERN_NOTICE "Error %d adding scull\n", result);
+		goto fail;
+	}
+	scull_cdev_added = true;
+
+	/* At this point call the init function for any friend device */
+	result = scull_access_init(MKDEV(scull_major, scull_minor + scull_nr_devs));
+	if (result < 0)
+		goto fail;
+
+	scull_create_proc();
+	scull_check_update(scull_check_on);
+	scull_check_ready = true;
+
+	PDEBUG("probe done, major %d, minor %d, scull_nr_devs %d, each quantum has %d bytes, a quantum set has %d quantums\n",
+		   scull_major, scull_minor, scull_nr_devs, scull_quantum, scull_qset);
+	printk(KERN_INFO "scull: %d devices registered in %llu us\n",
+			scull_nr_devs, div_u64(ktime_get_ns() - start, 1000));
+	return 0;
+
+fail:
+	printk(KERN_ERR "scull: probe failed, major %d\n", scull_major);
+	scull_cleanup_module();
+	return result;
+}
+
+module_init(scull_init_module);
+module_exit(scull_cleanup_module);
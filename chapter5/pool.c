@@ -0,0 +1,147 @@
+/*
+ * pool.c -- a reserve of ready quanta for the writers
+ *
+ * A writer needing a new quantum takes one from the reserve of its
+ * device, a pop under a spinlock, instead of calling kmalloc() with
+ * dev->sem held: an allocation that has to wait for reclaim makes
+ * everybody queued on dev->sem wait as well. A worker refills the reserve
+ * to scull_reserve quanta, without dev->sem, whenever a writer leaves it
+ * half empty. Writers that go faster than the worker find it empty and
+ * allocate for themselves as before: those are the stalls counted in
+ * dev->alloc, which tell whether the reserve is large enough.
+ *
+ * Extents (see qset.c) are always allocated by the writer. The reserve
+ * is made on the first write allocating a quantum and kept, full, until
+ * the device goes away: trimming the device does not empty it.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+
+#include "scull.h"
+
+/*
+ * @lock: protects @nr and @refills, taken by the writers and the worker
+ * @quanta: @nr ready quanta of @quantum bytes, room for @size
+ * @work: the refill, queued when @nr falls below @size / 2
+ */
+struct scull_pool {
+	spinlock_t lock;
+	void **quanta;
+	unsigned int nr;
+	unsigned int size;
+	int quantum;
+	u64 refills;
+	struct work_struct work;
+};
+
+static void scull_pool_refill(struct work_struct *work)
+{
+	struct scull_pool *pool = container_of(work, struct scull_pool, work);
+	void *q;
+
+	while (READ_ONCE(pool->nr) < pool->size) {
+		q = kzalloc(pool->quantum, GFP_KERNEL);    /* as scull_quantum_alloc() */
+		if (!q)
+			return;     /* the writers will allocate, and try again */
+		spin_lock(&pool->lock);
+		if (pool->nr < pool->size) {
+			pool->quanta[pool->nr++] = q;
+			pool->refills++;
+			q = NULL;
+		}
+		spin_unlock(&pool->lock);
+		if (q) {
+			kfree(q);
+			return;
+		}
+	}
+}
+
+/* make the reserve of @dev and have it filled, with dev->sem held */
+static void scull_pool_setup(struct scull_dev *dev)
+{
+	unsigned int size = scull_reserve;
+	struct scull_pool *pool;
+
+	if (!size)
+		return;
+	pool = kzalloc(sizeof(struct scull_pool), GFP_KERNEL);
+	if (!pool)
+		return;
+	pool->quanta = kmalloc_array(size, sizeof(void *), GFP_KERNEL);
+	if (!pool->quanta) {
+		kfree(pool);
+		return;
+	}
+	spin_lock_init(&pool->lock);
+	pool->size = size;
+	pool->quantum = dev->quantum;   /* scull_quantum, which never changes */
+	INIT_WORK(&pool->work, scull_pool_refill);
+	WRITE_ONCE(dev->pool, pool);
+	schedule_work(&pool->work);
+}
+
+/*
+ * A quantum for a writer of @dev, which holds dev->sem, or NULL if the
+ * reserve is empty (or not there yet) and the writer has to allocate it.
+ */
+void *scull_pool_get(struct scull_dev *dev)
+{
+	struct scull_pool *pool = dev->pool;
+	void *q = NULL;
+	bool low;
+
+	if (!pool) {
+		scull_pool_setup(dev);
+		return NULL;
+	}
+
+	spin_lock(&pool->lock);
+	if (pool->nr)
+		q = pool->quanta[--pool->nr];
+	low = pool->nr < pool->size / 2;
+	spin_unlock(&pool->lock);
+
+	/* nothing happens if the refill is already queued */
+	if (low)
+		schedule_work(&pool->work);
+	return q;
+}
+
+/* the reserve half of SCULL_IOC_GET_ALLOCSTAT */
+void scull_pool_stat(struct scull_dev *dev, struct scull_allocstat *st)
+{
+	struct scull_pool *pool = READ_ONCE(dev->pool);
+
+	st->reserve = scull_reserve;
+	st->ready = 0;
+	st->refills = 0;
+	if (!pool)
+		return;
+	spin_lock(&pool->lock);
+	st->ready = pool->nr;
+	st->refills = pool->refills;
+	spin_unlock(&pool->lock);
+}
+
+/* the device goes away, nobody has it open */
+void scull_pool_free(struct scull_dev *dev)
+{
+	struct scull_pool *pool = dev->pool;
+	unsigned int i;
+
+	if (!pool)
+		return;
+	cancel_work_sync(&pool->work);
+	for (i = 0; i < pool->nr; i++)
+		kfree(pool->quanta[i]);
+	kfree(pool->quanta);
+	kfree(pool);
+	dev->pool = NULL;
+}
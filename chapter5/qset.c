@@ -0,0 +1,1004 @@
+/*
+ * qset.c -- the storage of scull: the index of quantum sets
+ *
+ * Everything here works on a struct scull_dev whose semaphore is held by
+ * the caller, and knows nothing about files, cdevs or /proc. That lets the
+ * same source be built as a user-space library (see user/), where
+ * scull_user.h stands in for kmalloc, copy_*_user and the tracepoints.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>   /* printk() */
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>    /* size_t */
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/log2.h>     /* ilog2() */
+#include <linux/prefetch.h>
+#include <linux/sched.h>        /* cond_resched() */
+#include <linux/sched/signal.h> /* fatal_signal_pending() */
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+#ifdef __KERNEL__
+#include "scull_trace.h"    /* the tracepoints themselves are created in main.c */
+#endif
+
+/*
+ * The quantum sets are found through a radix tree indexed by item number,
+ * SCULL_INDEX_FANOUT slots per node and dev->height levels: the slots of
+ * the bottom level point to quantum sets, the others to nodes. Only the
+ * paths to the items written are allocated, so a device can be very large
+ * and very sparse, and any item is at most SCULL_INDEX_MAX_HEIGHT nodes
+ * away from dev->data.
+ *
+ * A quantum is kmalloc()ed on its own, unless a file writing sequentially
+ * gets to it: the quanta after it in the quantum set are then allocated
+ * together, as one extent twice as large as what the file has written in
+ * a row so far, up to scull_extent_max bytes (kvmalloc(), so it may be
+ * only virtually contiguous). The data pointers of an extent are into it,
+ * one quantum apart, and reads and writes go through contiguous quanta
+ * in one copy. qs->extent[] tells which pointers start an extent.
+ */
+
+/* how many items a tree of @height levels can index */
+static inline bool scull_index_covers(int height, u64 item)
+{
+	return height * SCULL_INDEX_SHIFT >= 64 ||
+		item < (1ULL << (height * SCULL_INDEX_SHIFT));
+}
+
+static inline int scull_index_slot(u64 item, int level)
+{
+	return (item >> (level * SCULL_INDEX_SHIFT)) & (SCULL_INDEX_FANOUT - 1);
+}
+
+static struct scull_node *scull_node_alloc(struct scull_dev *dev)
+{
+	struct scull_node *node = kmalloc(sizeof(struct scull_node), GFP_KERNEL);
+
+	if (node) {
+		memset(node, 0, sizeof(struct scull_node));
+		dev->nr_nodes++;
+	}
+	return node;
+}
+
+/*
+ * Free the quanta of @dptr from @from on, counted in @quanta. An extent
+ * is freed whole or not at all: one which starts before @from keeps its
+ * quanta past it.
+ */
+static void scull_free_quanta(struct scull_dev *dev, struct scull_qset *dptr,
+		int from, unsigned long *quanta)
+{
+	int j, n;
+
+	if (!dptr->data)
+		return;
+	for (j = 0; dptr->extent && j < from; j++)
+		if (dptr->extent[j] && j + dptr->extent[j] > from)
+			from = j + dptr->extent[j];
+
+	for (j = from; j < dev->qset; j += n) {
+		n = 1;
+		if (!dptr->data[j])
+			continue;
+		if (scull_spilled(dptr, j)) {
+			scull_spill_drop(dptr->data[j]);
+			__clear_bit(j, dptr->spilled);
+			dev->nr_spilled--;
+		} else if (dptr->extent && dptr->extent[j]) {
+			n = dptr->extent[j];
+			kvfree(dptr->data[j]); // the whole extent
+			memset(&dptr->data[j], 0, n * sizeof(void *));
+			dptr->extent[j] = 0;
+			dev->nr_extents--;
+		} else {
+			kfree(dptr->data[j]); // free each quantum
+		}
+		dptr->data[j] = NULL;
+		dev->nr_quanta -= n;
+		(*quanta) += n;
+	}
+}
+
+static void scull_free_qset(struct scull_dev *dev, struct scull_qset *dptr,
+		unsigned long *quanta)
+{
+	scull_free_quanta(dev, dptr, 0, quanta);
+	kfree(dptr->data);
+	kfree(dptr->extent);
+	kfree(dptr->spilled);
+	kfree(dptr);
+	dev->nr_qsets--;
+}
+
+/* free the subtree of @node, @level levels above the quantum sets */
+static void scull_free_node(struct scull_dev *dev, struct scull_node *node,
+		int level, unsigned long *qsets, unsigned long *quanta)
+{
+	int i;
+
+	for (i = 0; i < SCULL_INDEX_FANOUT; i++) {
+		if (!node->slots[i])
+			continue;
+		if (level) {
+			scull_free_node(dev, node->slots[i], level - 1, qsets, quanta);
+			continue;
+		}
+		scull_free_qset(dev, node->slots[i], quanta);
+		(*qsets)++;
+	}
+	kfree(node);
+	dev->nr_nodes--;
+}
+
+/*
+ * Empty out the scull device; must be called with the device
+ * semaphore held.
+ */
+int scull_trim(struct scull_dev *dev)
+{
+	unsigned long qsets = 0, quanta = 0;
+
+	if (dev->data)
+		scull_free_node(dev, dev->data, dev->height - 1, &qsets, &quanta);
+	trace_scull_trim(dev->index, dev->size, qsets, quanta);
+	dev->generation++; /* the qset pointers kept outside dev->sem are gone */
+	dev->size = 0;
+	dev->nr_qsets = 0;
+	dev->nr_quanta = 0;
+	dev->nr_extents = 0;
+	dev->nr_nodes = 0;
+	dev->nr_spilled = 0;
+	scull_set_geometry(dev, scull_quantum, scull_qset);
+	dev->data = NULL;
+	dev->height = 0;
+	return 0;
+}
+
+/*
+ * Free what the subtree of @node, @level levels above the quantum sets
+ * and starting at item @first, holds past item @last. Returns whether it
+ * is left empty.
+ */
+static bool scull_truncate_node(struct scull_dev *dev, struct scull_node *node,
+		int level, u64 first, u64 last, unsigned long *qsets, unsigned long *quanta)
+{
+	int shift = level * SCULL_INDEX_SHIFT, i;
+	bool empty = true;
+	u64 item;
+
+	for (i = 0; i < SCULL_INDEX_FANOUT; i++) {
+		if (!node->slots[i])
+			continue;
+		/* a slot covering every item is the first one */
+		item = shift < 64 ? first + ((u64)i << shift) : first;
+		if (item > last) {
+			if (level) {
+				scull_free_node(dev, node->slots[i], level - 1, qsets, quanta);
+			} else {
+				scull_free_qset(dev, node->slots[i], quanta);
+				(*qsets)++;
+			}
+			node->slots[i] = NULL;
+			continue;
+		}
+		/* only the path to @last is cut, the slots before are whole */
+		if (level && (shift >= 64 || last - item < (1ULL << shift) - 1) &&
+		    scull_truncate_node(dev, node->slots[i], level - 1, item, last,
+				qsets, quanta)) {
+			kfree(node->slots[i]);
+			dev->nr_nodes--;
+			node->slots[i] = NULL;
+			continue;
+		}
+		empty = false;
+	}
+	return empty;
+}
+
+/*
+ * Cut @dev down to @size bytes, or grow it to @size with a hole. Only
+ * the quanta wholly past @size are freed, with the quantum sets and the
+ * nodes of the index left empty, and the quanta kept are zeroed past
+ * @size. Unlike scull_trim() the geometry stays.
+ */
+int scull_truncate_locked(struct scull_dev *dev, loff_t size)
+{
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	unsigned long qsets = 0, quanta = 0;
+	struct scull_qset *dptr;
+	size_t n;
+	int j, retval;
+
+	if (size < 0)
+		return -EINVAL;
+	if ((u64)size > scull_max_size)
+		return -EFBIG;
+	if (size >= dev->size) {
+		dev->size = size;
+		return 0;
+	}
+
+	if (!size) {
+		if (dev->data)
+			scull_free_node(dev, dev->data, dev->height - 1, &qsets, &quanta);
+		dev->data = NULL;
+		dev->height = 0;
+		goto out;
+	}
+
+	/* the last byte kept */
+	scull_locate(dev, size - 1, &loc);
+	dptr = scull_lookup(dev, loc.item);
+	if (dptr && dptr->data && dptr->data[loc.s_pos]) {
+		if (scull_spilled(dptr, loc.s_pos)) {
+			retval = scull_spill_in(dev, dptr, loc.s_pos);
+			if (retval)
+				return retval;
+		}
+		/* the rest of the quantum, and of the extent it is in */
+		n = dev->quantum - loc.q_pos - 1;
+		for (j = 0; dptr->extent && j <= loc.s_pos; j++)
+			if (dptr->extent[j] && j + dptr->extent[j] > loc.s_pos + 1)
+				n += (size_t)(j + dptr->extent[j] - loc.s_pos - 1) * dev->quantum;
+		memset((char *)dptr->data[loc.s_pos] + loc.q_pos + 1, 0, n);
+	}
+	if (dptr)
+		scull_free_quanta(dev, dptr, loc.s_pos + 1, &quanta);
+	if (dev->data && scull_truncate_node(dev, dev->data, dev->height - 1, 0,
+			loc.item, &qsets, &quanta)) {
+		kfree(dev->data);
+		dev->nr_nodes--;
+		dev->data = NULL;
+		dev->height = 0;
+	}
+out:
+	trace_scull_trim(dev->index, dev->size, qsets, quanta);
+	dev->generation++; /* the qset pointers kept outside dev->sem are gone */
+	dev->size = size;
+	return 0;
+}
+
+/* what scull_check() finds in the index */
+struct scull_census {
+	unsigned long nodes;
+	unsigned long qsets;
+	unsigned long quanta;
+	unsigned long extents;
+	unsigned long spilled;
+	int bad;
+};
+
+static void scull_census(struct scull_dev *dev, struct scull_node *node,
+		int level, struct scull_census *c)
+{
+	struct scull_qset *dptr;
+	int i, j, k;
+
+	c->nodes++;
+	for (i = 0; i < SCULL_INDEX_FANOUT; i++) {
+		if (!node->slots[i])
+			continue;
+		if (level) {
+			scull_census(dev, node->slots[i], level - 1, c);
+			continue;
+		}
+		dptr = node->slots[i];
+		c->qsets++;
+		if (!dptr->data)
+			continue;
+		for (j = 0; j < dev->qset; j++) {
+			if (dptr->data[j])
+				c->quanta++;
+			if (scull_spilled(dptr, j))
+				c->spilled++;
+		}
+		if (!dptr->extent)
+			continue;
+		/* the quanta of an extent follow each other in its allocation */
+		for (j = 0; j < dev->qset; j++) {
+			if (!dptr->extent[j])
+				continue;
+			c->extents++;
+			if (scull_spilled(dptr, j))
+				c->bad = 1;     /* extents are spilled one quantum at a time */
+			if (j + dptr->extent[j] > dev->qset) {
+				c->bad = 1;
+				continue;
+			}
+			for (k = 1; k < dptr->extent[j]; k++)
+				if (dptr->data[j + k] != dptr->data[j] + (size_t)k * dev->quantum ||
+				    dptr->extent[j + k])
+					c->bad = 1;
+		}
+	}
+}
+
+/*
+ * Walk the whole index and compare it with the counters kept by
+ * scull_follow(), scull_write_locked() and scull_trim(). Called with
+ * dev->sem held. It costs as much as the device is large: it is for the
+ * scull_check parameter and the fuzzer, not for normal use.
+ * Returns 0, or -EIO after logging what does not match.
+ */
+int scull_check(struct scull_dev *dev)
+{
+	struct scull_census c = { 0 };
+
+	if (!dev->data != !dev->height || dev->height > SCULL_INDEX_MAX_HEIGHT)
+		c.bad = 1;
+	else if (dev->data)
+		scull_census(dev, dev->data, dev->height - 1, &c);
+
+	if (c.bad || c.nodes != dev->nr_nodes || c.qsets != dev->nr_qsets ||
+	    c.quanta != dev->nr_quanta || c.extents != dev->nr_extents ||
+	    c.spilled != dev->nr_spilled) {
+		pr_err("scull%d: index height %d, found %lu nodes %lu qsets %lu quanta %lu extents %lu spilled, counted %lu %lu %lu %lu %lu\n",
+				dev->index, dev->height, c.nodes, c.qsets, c.quanta, c.extents,
+				c.spilled, dev->nr_nodes, dev->nr_qsets, dev->nr_quanta,
+				dev->nr_extents, dev->nr_spilled);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* the bottom node holding the slot of item @n, NULL if there is none */
+static struct scull_node *scull_leaf(struct scull_dev *dev, u64 n)
+{
+	struct scull_node *node = dev->data;
+	int level;
+
+	if (!node || !scull_index_covers(dev->height, n))
+		return NULL;
+	for (level = dev->height - 1; level > 0; level--) {
+		node = node->slots[scull_index_slot(n, level)];
+		if (!node)
+			return NULL;
+	}
+	return node;
+}
+
+/*
+ * The quantum set of item @n, NULL if it was never written.
+ * Never allocates anything, reads of holes go through here.
+ */
+struct scull_qset *scull_lookup(struct scull_dev *dev, u64 n)
+{
+	struct scull_node *node = scull_leaf(dev, n);
+
+	return node ? node->slots[scull_index_slot(n, 0)] : NULL;
+}
+
+/*
+ * The first quantum set at item *@n or after it, *@n is set to its item.
+ * NULL if there is none.
+ */
+static struct scull_qset *scull_next_in(struct scull_node *node, int level, u64 *n)
+{
+	int i = scull_index_slot(*n, level);
+	u64 span = 1ULL << (level * SCULL_INDEX_SHIFT);
+	u64 first = 0;  /* the first item under @node */
+	void *found;
+
+	if ((level + 1) * SCULL_INDEX_SHIFT < 64)
+		first = *n & ~(span * SCULL_INDEX_FANOUT - 1);
+
+	for (; i < SCULL_INDEX_FANOUT; i++) {
+		if (node->slots[i]) {
+			found = level ? scull_next_in(node->slots[i], level - 1, n) :
+					node->slots[i];
+			if (found)
+				return found;
+		}
+		/* nothing more under slot i: go to the start of slot i + 1 */
+		*n = first + (i + 1) * span;
+	}
+	return NULL;
+}
+
+struct scull_qset *scull_next_qset(struct scull_dev *dev, u64 *n)
+{
+	if (!dev->data || !scull_index_covers(dev->height, *n))
+		return NULL;
+	return scull_next_in(dev->data, dev->height - 1, n);
+}
+
+/*
+ * The bottom node holding the slot of item @n, growing the tree and
+ * allocating the nodes on the way if need be. NULL if out of memory.
+ */
+static struct scull_node *scull_leaf_alloc(struct scull_dev *dev, u64 n)
+{
+	struct scull_node *node;
+	int level, slot;
+
+	/* grow the tree until it covers @n, the old root becomes slot 0 */
+	while (!dev->data || !scull_index_covers(dev->height, n)) {
+		node = scull_node_alloc(dev);
+		if (!node)
+			return NULL;
+		if (dev->data)
+			node->slots[0] = dev->data;
+		dev->data = node;
+		dev->height++;
+	}
+
+	/* then walk it down */
+	node = dev->data;
+	for (level = dev->height - 1; level > 0; level--) {
+		slot = scull_index_slot(n, level);
+		if (!node->slots[slot]) {
+			node->slots[slot] = scull_node_alloc(dev);
+			if (!node->slots[slot])
+				return NULL;
+		}
+		node = node->slots[slot];
+	}
+	return node;
+}
+
+/* the quantum set in @slot of the bottom node @node, allocated if need be */
+static struct scull_qset *scull_qset_alloc(struct scull_dev *dev,
+		struct scull_node *node, int slot, u64 n)
+{
+	struct scull_qset *qs = node->slots[slot];
+
+	if (!qs) {
+		qs = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
+		trace_scull_alloc(dev->index, SCULL_ALLOC_QSET, n, -1,
+				  sizeof(struct scull_qset), qs != NULL);
+		if (qs == NULL)
+			return NULL;
+		memset(qs, 0, sizeof(struct scull_qset));
+		node->slots[slot] = qs;
+		dev->nr_qsets++;
+		trace_scull_follow(dev->index, n, 1);
+	}
+	return qs;
+}
+
+/*
+* @n: num of quantum_set
+*
+* return the quantum set of item @n, allocating it and the index nodes
+* on the way if need be. Items before @n are left alone.
+*/
+struct scull_qset *scull_follow(struct scull_dev *dev, u64 n)
+{
+	struct scull_node *node = scull_leaf_alloc(dev, n);
+
+	return node ? scull_qset_alloc(dev, node, scull_index_slot(n, 0), n) : NULL;
+}
+
+/*
+ * The bottom node of item @n through the cursor of a file: sequential
+ * reads and writes stay in the same node for SCULL_INDEX_FANOUT quantum
+ * sets, and find it without walking down from dev->data. The node is
+ * kept only while dev->generation does not change: scull_trim() frees
+ * the nodes, growing the tree does not move them.
+ */
+static struct scull_node *scull_cursor_leaf(struct scull_dev *dev,
+		struct scull_cursor *cur, u64 n, bool alloc)
+{
+	u64 first = n & ~(u64)(SCULL_INDEX_FANOUT - 1);
+	struct scull_node *node;
+
+	if (cur && cur->leaf && cur->generation == dev->generation &&
+	    cur->first == first)
+		return cur->leaf;
+
+	node = alloc ? scull_leaf_alloc(dev, n) : scull_leaf(dev, n);
+	if (cur && node) {
+		cur->leaf = node;
+		cur->first = first;
+		cur->generation = dev->generation;
+	}
+	return node;
+}
+
+/*
+ * Start fetching the quantum after the one of @loc into the cache: the
+ * next call of a file streaming through the device goes there.
+ */
+static void scull_prefetch_next(struct scull_dev *dev, struct scull_cursor *cur,
+		struct scull_qset *dptr, struct scull_loc *loc)
+{
+	int slot;
+
+	if (loc->s_pos + 1 < dev->qset) {
+		if (dptr->data[loc->s_pos + 1] && !scull_spilled(dptr, loc->s_pos + 1))
+			prefetch(dptr->data[loc->s_pos + 1]);
+		return;
+	}
+
+	/* the first quantum of the next quantum set, if in the same node */
+	slot = scull_index_slot(loc->item, 0) + 1;
+	if (!cur || slot == SCULL_INDEX_FANOUT)
+		return;
+	dptr = cur->leaf->slots[slot];
+	if (dptr && dptr->data && dptr->data[0] && !scull_spilled(dptr, 0))
+		prefetch(dptr->data[0]);
+}
+
+/*
+ * Set the geometry of @dev. When both sizes are powers of two (and
+ * scull_pow2 is set) scull_locate() shifts and masks instead of dividing.
+ */
+void scull_set_geometry(struct scull_dev *dev, int quantum, int qset)
+{
+	dev->quantum = quantum;
+	dev->qset = qset;
+	if (scull_pow2 && is_power_of_2(quantum) && is_power_of_2(qset)) {
+		dev->quantum_shift = ilog2(quantum);
+		dev->item_shift = dev->quantum_shift + ilog2(qset);
+	} else {
+		dev->quantum_shift = dev->item_shift = -1;
+	}
+}
+
+/*
+ * find listitem, qset index, and offset in the quantum
+ * @pos must not be negative
+ */
+void scull_locate(struct scull_dev *dev, loff_t pos, struct scull_loc *loc)
+{
+	u32 quantum_size = dev->quantum; //bytes of a quantum
+	u32 qset_size = dev->qset;  //num of quantum of a quantum set
+	u64 item_size = (u64)quantum_size * qset_size; /* how many bytes in a listitem */
+	u64 rest;
+	u32 q_pos;
+
+	if (dev->item_shift >= 0) {
+		loc->item = pos >> dev->item_shift;
+		loc->s_pos = (pos >> dev->quantum_shift) & (qset_size - 1);
+		loc->q_pos = pos & (quantum_size - 1);
+		return;
+	}
+
+	loc->item = div64_u64_rem(pos, item_size, &rest);// how many list items the current position is more than
+	loc->s_pos = div_u64_rem(rest, quantum_size, &q_pos); //the rest bytes can fully occupy s_pos quantuns
+	loc->q_pos = q_pos; //the last byte position in a quantum
+}
+
+/*
+ * How much of @count bytes at @q_pos of quantum @s_pos can be copied at
+ * once: up to the end of the quantum, or of the quanta after it which
+ * are contiguous with it, as those of an extent are.
+ */
+static size_t scull_contig(struct scull_dev *dev, struct scull_qset *dptr,
+		int s_pos, int q_pos, size_t count)
+{
+	char *first = dptr->data[s_pos];
+	size_t avail = dev->quantum - q_pos;
+	int j;
+
+	for (j = s_pos + 1; avail < count && j < dev->qset; j++) {
+		if (dptr->data[j] != first + (size_t)(j - s_pos) * dev->quantum)
+			break;
+		avail += dev->quantum;
+	}
+	return min_t(size_t, count, avail);
+}
+
+/*
+ * Find the bytes a read of @count at @pos gets, cut at the end of the
+ * quantum (or of its extent) and of the device, and set @from to the
+ * first. Returns how many, 0 at the end of the device. In a hole @from
+ * is NULL, and the count that of the hole up to the end of its quantum:
+ * the bytes are zeroes.
+ * @loc tells where @pos was found, item is -1 if it was past the end.
+ * @cur is the cursor of the file, or NULL.
+ */
+static ssize_t scull_read_prepare(struct scull_dev *dev, size_t count, loff_t pos,
+		struct scull_loc *loc, struct scull_cursor *cur, const char **from)
+{
+	struct scull_node *node;
+	struct scull_qset *dptr;
+	int quantum_size = dev->quantum;
+
+	loc->item = loc->s_pos = -1;
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= dev->size)
+		return 0;
+
+	if (count > dev->size - pos)
+		count = dev->size - pos;
+
+	scull_locate(dev, pos, loc);
+
+	/* holes read as zeroes, and are not filled in by reading them */
+	node = scull_cursor_leaf(dev, cur, loc->item, false);
+	dptr = node ? node->slots[scull_index_slot(loc->item, 0)] : NULL;
+
+	if (dptr == NULL || !dptr->data || !dptr->data[loc->s_pos]) {
+		*from = NULL;
+		return min_t(size_t, count, quantum_size - loc->q_pos);
+	}
+	if (!dptr->referenced)
+		dptr->referenced = true;
+	if (scull_spilled(dptr, loc->s_pos)) {
+		int retval = scull_spill_in(dev, dptr, loc->s_pos);
+
+		if (retval)
+			return retval;
+	}
+
+	/* read only up to the end of this quantum, or of its extent */
+	if (count > quantum_size - loc->q_pos)
+		count = scull_contig(dev, dptr, loc->s_pos, loc->q_pos, count);
+
+	*from = (const char *)dptr->data[loc->s_pos] + loc->q_pos;
+	if (loc->q_pos + count == quantum_size)
+		scull_prefetch_next(dev, cur, dptr, loc);
+	return count;
+}
+
+/*
+ * The body of scull_read(), called with dev->sem held.
+ */
+ssize_t scull_read_locked(struct scull_dev *dev, char __user *buf, size_t count,
+		loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	const char *from = NULL;
+	ssize_t retval;
+
+	retval = scull_read_prepare(dev, count, *f_pos, loc, cur, &from);
+	if (retval <= 0)
+		return retval;
+
+	if (from ? copy_to_user(buf, from, retval) : clear_user(buf, retval))
+		return -EFAULT;
+	*f_pos += retval;
+	return retval;
+}
+
+/*
+ * The same into a kernel buffer, for the io_uring commands run by a
+ * worker, see uring.c.
+ */
+ssize_t scull_read_kernel_locked(struct scull_dev *dev, char *buf, size_t count,
+		loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	const char *from = NULL;
+	ssize_t retval;
+
+	retval = scull_read_prepare(dev, count, *f_pos, loc, cur, &from);
+	if (retval <= 0)
+		return retval;
+
+	if (from)
+		memcpy(buf, from, retval);
+	else
+		memset(buf, 0, retval);
+	*f_pos += retval;
+	return retval;
+}
+
+/*
+ * Where the bytes at @pos are, for going over them in the kernel without
+ * a copy (compute.c): sets @from to them and returns how many there are
+ * in a row, at most @count, 0 at the end of the device. In a hole @from
+ * is NULL, and the count that of the hole up to the end of its quantum.
+ */
+ssize_t scull_peek_locked(struct scull_dev *dev, loff_t pos, size_t count,
+		const char **from)
+{
+	struct scull_loc loc;
+
+	return scull_read_prepare(dev, count, pos, &loc, NULL, from);
+}
+
+/*
+ * How many quanta to allocate at @s_pos, as one extent if more than one:
+ * twice what @cur wrote in a row up to @pos, as far as the next quantum
+ * already there. 1 for writes that do not follow the previous one.
+ */
+static int scull_extent_size(struct scull_dev *dev, struct scull_qset *dptr,
+		int s_pos, loff_t pos, struct scull_cursor *cur)
+{
+	u64 run = cur && pos == cur->write_end ? cur->write_run : 0;
+	u64 nr = 2 * div_u64(run, dev->quantum);
+	int j;
+
+	if (nr <= 1)
+		return 1;
+	nr = min_t(u64, nr, READ_ONCE(scull_extent_max) / dev->quantum);
+	nr = min_t(u64, nr, USHRT_MAX);     /* what dptr->extent[] holds */
+	nr = min_t(u64, nr, dev->qset - s_pos);
+	nr = min_t(u64, nr, div_u64(scull_max_size - pos, dev->quantum) + 1);
+	for (j = 1; j < nr; j++)
+		if (dptr->data[s_pos + j])
+			break;
+	return j < nr ? j : nr;
+}
+
+/*
+ * An allocation failed by scull_inject_enomem(), checked before the
+ * reserve of the device too so that a loaded one does not hide them.
+ */
+static bool scull_alloc_injected(struct scull_dev *dev, s64 item, int s_pos)
+{
+	if (!scull_inject_enomem(dev))
+		return false;
+	trace_scull_alloc(dev->index, SCULL_ALLOC_QUANTUM, item, s_pos,
+			  dev->quantum, false);
+	return true;
+}
+
+/*
+ * Allocate quantum @s_pos of @dptr, and the @nr - 1 after it as one
+ * extent if @nr > 1. Falls back to a single quantum if the extent
+ * cannot be had.
+ */
+static int scull_quantum_alloc(struct scull_dev *dev, struct scull_qset *dptr,
+		s64 item, int s_pos, int nr)
+{
+	int quantum_size = dev->quantum;
+	char *ext = NULL;
+	int j;
+
+	if (nr > 1 && !dptr->extent) {
+		dptr->extent = kzalloc(dev->qset * sizeof(*dptr->extent), GFP_KERNEL);
+	}
+	if (nr > 1 && dptr->extent) {
+		ext = kvzalloc((size_t)nr * quantum_size, GFP_KERNEL | __GFP_NOWARN);
+		trace_scull_alloc(dev->index, SCULL_ALLOC_EXTENT, item, s_pos,
+				  (size_t)nr * quantum_size, ext != NULL);
+	}
+	if (ext) {
+		for (j = 0; j < nr; j++)
+			dptr->data[s_pos + j] = ext + (size_t)j * quantum_size;
+		dptr->extent[s_pos] = nr;
+		dev->nr_quanta += nr;
+		dev->nr_extents++;
+		return 0;
+	}
+
+	/* each quantum has quantum_size bytes, zeroes until written */
+	dptr->data[s_pos] = kzalloc(quantum_size, GFP_KERNEL);
+	trace_scull_alloc(dev->index, SCULL_ALLOC_QUANTUM, item, s_pos,
+			  quantum_size, dptr->data[s_pos] != NULL);
+	if (!dptr->data[s_pos])
+		return -ENOMEM;
+	dev->nr_quanta++;
+	return 0;
+}
+
+/*
+ * The quanta of a writer: from the reserve of the device if it has one
+ * ready, otherwise allocated here, which is a stall of everybody waiting
+ * for dev->sem and is timed as such.
+ */
+static int scull_writer_alloc(struct scull_dev *dev, struct scull_qset *dptr,
+		s64 item, int s_pos, int nr)
+{
+	struct scull_allocstat *st = &dev->alloc;
+	u64 start, ns;
+	int retval;
+
+	if (scull_alloc_injected(dev, item, s_pos))
+		return -ENOMEM;
+	if (nr == 1) {
+		dptr->data[s_pos] = scull_pool_get(dev);
+		if (dptr->data[s_pos]) {
+			dev->nr_quanta++;
+			st->hits++;
+			return 0;
+		}
+	}
+
+	start = ktime_get_ns();
+	retval = scull_quantum_alloc(dev, dptr, item, s_pos, nr);
+	ns = ktime_get_ns() - start;
+	st->stalls++;
+	st->stall_ns += ns;
+	if (ns > st->stall_max_ns)
+		st->stall_max_ns = ns;
+	dev->stall_hist[scull_lat_bucket(ns)]++;
+	return retval;
+}
+
+/* the quantum set of @item, with its array of quanta, allocated as needed */
+static struct scull_qset *scull_qset_data(struct scull_dev *dev, s64 item,
+		struct scull_cursor *cur)
+{
+	struct scull_node *node;
+	struct scull_qset *dptr;
+	int qset_size = dev->qset;  //num of quantum of a quantum set
+
+	/* find the quantum set, allocating the path to it */
+	node = scull_cursor_leaf(dev, cur, item, true);
+	if (node == NULL)
+		return NULL;
+	dptr = scull_qset_alloc(dev, node, scull_index_slot(item, 0), item);
+	if (dptr == NULL)
+		return NULL;
+
+	if (!dptr->data) {
+		/* an quantum set has qset_size quantums*/
+		dptr->data = kmalloc(qset_size * sizeof(char*), GFP_KERNEL);
+		trace_scull_alloc(dev->index, SCULL_ALLOC_DATA, item, -1,
+				  qset_size * sizeof(char*), dptr->data != NULL);
+		if (!dptr->data)
+			return NULL;
+		memset(dptr->data, 0, qset_size * sizeof(char*));
+	}
+	return dptr;
+}
+
+/*
+ * Find where a write of @count bytes at @pos goes, allocating the path,
+ * the quantum set and the quantum as needed. @count is cut at the end of
+ * the quantum, or of the extent, and at scull_max_size, @to is set to
+ * the first byte.
+ */
+int scull_write_prepare(struct scull_dev *dev, loff_t pos, size_t *count,
+		struct scull_loc *loc, struct scull_cursor *cur, char **to)
+{
+	struct scull_qset *dptr;
+	int quantum_size = dev->quantum; //bytes of a quantum
+	s64 item;
+	int s_pos, retval;
+
+	if (pos < 0)
+		return -EINVAL;
+	if ((u64)pos >= scull_max_size)
+		return -EFBIG;
+	if (*count > scull_max_size - pos)
+		*count = scull_max_size - pos;
+
+	scull_locate(dev, pos, loc);
+	item = loc->item;
+	s_pos = loc->s_pos;
+
+	dptr = scull_qset_data(dev, item, cur);
+	if (dptr == NULL)
+		return -ENOMEM;
+
+	if (!dptr->data[s_pos]) {
+		retval = scull_writer_alloc(dev, dptr, item, s_pos,
+				scull_extent_size(dev, dptr, s_pos, pos, cur));
+		if (retval)
+			return retval;
+	} else if (scull_spilled(dptr, s_pos)) {
+		/* the bytes around the write are wanted back too */
+		retval = scull_spill_in(dev, dptr, s_pos);
+		if (retval)
+			return retval;
+	}
+	if (!dptr->referenced)
+		dptr->referenced = true;
+
+	/* write only up to the end of this quantum, or of its extent */
+	if (*count > quantum_size - loc->q_pos)
+		*count = scull_contig(dev, dptr, s_pos, loc->q_pos, *count);
+
+	*to = (char *)dptr->data[s_pos] + loc->q_pos;
+	if (loc->q_pos + *count == quantum_size)
+		scull_prefetch_next(dev, cur, dptr, loc);
+	if (cur) {
+		cur->write_run = pos == cur->write_end ? cur->write_run + *count : *count;
+		cur->write_end = pos + *count;
+		if (cur->write_end > cur->write_max)
+			cur->write_max = cur->write_end;
+	}
+	return 0;
+}
+
+/* @count bytes were written at *f_pos */
+static void scull_write_done(struct scull_dev *dev, loff_t *f_pos, size_t count)
+{
+	*f_pos += count;
+
+	/* update the size */
+	if (dev->size < *f_pos)
+		dev->size = *f_pos;
+}
+
+/*
+ * The body of scull_write(), called with dev->sem held.
+ */
+ssize_t scull_write_locked(struct scull_dev *dev, const char __user *buf, size_t count,
+		loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	char *to;
+	int retval;
+
+	retval = scull_write_prepare(dev, *f_pos, &count, loc, cur, &to);
+	if (retval)
+		return retval;
+
+	if (copy_from_user(to, buf, count))
+		return -EFAULT;
+
+	scull_write_done(dev, f_pos, count);
+	return count;
+}
+
+/*
+ * The same from a kernel buffer, for the write-combining flush.
+ */
+ssize_t scull_write_kernel_locked(struct scull_dev *dev, const char *buf, size_t count,
+		loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	char *to;
+	int retval;
+
+	retval = scull_write_prepare(dev, *f_pos, &count, loc, cur, &to);
+	if (retval)
+		return retval;
+
+	memcpy(to, buf, count);
+	scull_write_done(dev, f_pos, count);
+	return count;
+}
+
+/*
+ * SCULL_IOC_FALLOCATE, called with dev->sem held: allocate the quanta of
+ * @offset to @offset + @len that are not there yet, in extents as large
+ * as scull_extent_max allows, and zero them. The caller checked the
+ * range against scull_max_size. What was allocated before a failure
+ * stays, as with fallocate() on a file system running out of space.
+ * A large range takes long with dev->sem held: a fatal signal stops it
+ * with EINTR between two quantum sets.
+ */
+int scull_fallocate_locked(struct scull_dev *dev, loff_t offset, loff_t len,
+		bool keep_size)
+{
+	int quantum_size = dev->quantum;
+	int max = min_t(u64, READ_ONCE(scull_extent_max) / quantum_size, USHRT_MAX);
+	loff_t pos = offset, end = offset + len;
+	struct scull_qset *dptr;
+	struct scull_loc loc;
+	int j, last, nr, retval;
+	u64 left;
+
+	while (pos < end) {
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		cond_resched();
+
+		scull_locate(dev, pos, &loc);
+		dptr = scull_qset_data(dev, loc.item, NULL);
+		if (!dptr)
+			return -ENOMEM;
+
+		/* the quanta of the range in this quantum set */
+		pos -= loc.q_pos;
+		left = div_u64(end - pos + quantum_size - 1, quantum_size);
+		last = min_t(u64, dev->qset - 1, loc.s_pos + left - 1);
+		for (j = loc.s_pos; j <= last; j += nr) {
+			nr = 1;
+			if (dptr->data[j])
+				continue;
+			while (nr < max && j + nr <= last && !dptr->data[j + nr])
+				nr++;
+			if (scull_alloc_injected(dev, loc.item, j))
+				return -ENOMEM;
+			retval = scull_quantum_alloc(dev, dptr, loc.item, j, nr);
+			if (retval)
+				return retval;
+			if (!dptr->extent || !dptr->extent[j])
+				nr = 1;     /* the extent could not be had */
+			dev->alloc.fallocated += nr;
+		}
+		pos += (loff_t)(last - loc.s_pos + 1) * quantum_size;
+	}
+
+	if (!keep_size && dev->size < end)
+		dev->size = end;
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * qset_kunit.c -- KUnit tests of the quantum map
+ *
+ * Built into scull.ko only on request, "make KUNIT=y", for a 6.0 or later
+ * kernel with CONFIG_KUNIT (before 6.0 kunit_test_suite() was the
+ * module_init() of a module of its own). The suite then runs each time
+ * the module is loaded, in a UML or QEMU kernel for instance, and the
+ * results are in the kernel log and in
+ * /sys/kernel/debug/kunit/scull_qset/results.
+ *
+ * The cases are those of "scull_fuzz -b" (user/fuzz.c) on a device of the
+ * module itself: scull_locate() at the edges of a quantum and of a
+ * quantum set, for geometries with and without shifts, reads at and past
+ * dev->size and in holes, and scull_truncate_locked() and scull_trim()
+ * down to nothing. scull_check() goes over the index after each step.
+ *
+ * scull_qset_bench times write-fill, follow and trim at 1 MB, 100 MB and
+ * 1 GB with the default geometry, one line each:
+ *	scull_qset: fill 1048576 bytes 263 quanta 91234 ns
+ * the format does not change, so the logs of two releases compare with
+ * diff. A size over a quarter of the RAM is left out with a "skip" line:
+ * the allocations of quanta would rather call the OOM killer than fail.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/mm.h>       /* totalram_pages() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/math64.h>   /* div64_u64_rem() */
+#include <linux/sched.h>    /* cond_resched() */
+#include <linux/ktime.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <kunit/test.h>
+
+#include "scull.h"
+
+/* a device of its own for each case, freed by scull_kunit_exit() */
+static int scull_kunit_init(struct kunit *test)
+{
+	struct scull_dev *dev = kzalloc(sizeof(struct scull_dev), GFP_KERNEL);
+
+	if (!dev)
+		return -ENOMEM;
+	scull_dev_init(dev, 0);
+	test->priv = dev;
+	return 0;
+}
+
+static void scull_kunit_exit(struct kunit *test)
+{
+	struct scull_dev *dev = test->priv;
+
+	scull_dev_destroy(dev);
+	kfree(dev);
+}
+
+/* the whole index agrees with the counters */
+static void scull_kunit_check(struct kunit *test, struct scull_dev *dev)
+{
+	KUNIT_EXPECT_EQ(test, scull_check(dev), 0);
+}
+
+/* write @len bytes of @c at @pos, as a write(2) loop would */
+static void scull_kunit_write(struct kunit *test, struct scull_dev *dev,
+		loff_t pos, size_t len, char c)
+{
+	struct scull_loc loc;
+	char buf[64];
+	ssize_t n;
+
+	memset(buf, c, sizeof(buf));
+	while (len) {
+		n = scull_write_kernel_locked(dev, buf, min(len, sizeof(buf)), &pos,
+				&loc, NULL);
+		KUNIT_ASSERT_GT(test, n, 0);
+		len -= n;
+	}
+	scull_kunit_check(test, dev);
+}
+
+/* one read of up to @len bytes at @pos: what it returns, and all bytes @c */
+static ssize_t scull_kunit_read(struct kunit *test, struct scull_dev *dev,
+		loff_t pos, size_t len, char c)
+{
+	struct scull_loc loc;
+	char buf[64];
+	ssize_t n, i;
+
+	n = scull_read_kernel_locked(dev, buf, min(len, sizeof(buf)), &pos, &loc, NULL);
+	for (i = 0; i < n; i++)
+		KUNIT_EXPECT_EQ(test, buf[i], c);
+	return n;
+}
+
+static const int scull_kunit_geometry[][2] = {
+	{ 4000, 1000 }, /* the defaults, divisions */
+	{ 4096, 1024 }, /* shifts and masks, if scull_pow2 */
+	{ 1, 1 },
+	{ 3, 5 },
+	{ 8, 4 },
+};
+
+static void scull_locate_test(struct kunit *test)
+{
+	struct scull_dev *dev = test->priv;
+	struct scull_loc loc;
+	u64 item_size, q, qs, rest;
+	loff_t pos[10];
+	int g, i;
+
+	for (g = 0; g < ARRAY_SIZE(scull_kunit_geometry); g++) {
+		q = scull_kunit_geometry[g][0];
+		qs = scull_kunit_geometry[g][1];
+		scull_set_geometry(dev, q, qs);
+		item_size = q * qs;
+
+		pos[0] = 0;
+		pos[1] = q - 1;             /* last byte of the first quantum */
+		pos[2] = q;                 /* first of the second */
+		pos[3] = item_size - 1;     /* last byte of the first quantum set */
+		pos[4] = item_size;         /* first of the second */
+		pos[5] = item_size + q;
+		pos[6] = 3 * item_size - 1;
+		pos[7] = (1LL << 32) + 5;   /* past 32 bits */
+		pos[8] = (1LL << 44) - 1;
+		pos[9] = scull_max_size - 1;
+
+		for (i = 0; i < ARRAY_SIZE(pos); i++) {
+			scull_locate(dev, pos[i], &loc);
+			KUNIT_EXPECT_EQ(test, loc.item, (s64)div64_u64_rem(pos[i], item_size, &rest));
+			KUNIT_EXPECT_EQ(test, loc.s_pos, (int)div64_u64(rest, q));
+			KUNIT_EXPECT_EQ(test, loc.q_pos, (int)(rest - div64_u64(rest, q) * q));
+		}
+	}
+}
+
+/* quantum 8, quantum set 4: an item is 32 bytes */
+static void scull_boundary_test(struct kunit *test)
+{
+	struct scull_dev *dev = test->priv;
+
+	down(&dev->sem);
+	scull_set_geometry(dev, 8, 4);
+
+	scull_kunit_write(test, dev, 7, 1, 'a');    /* last byte of a quantum */
+	scull_kunit_write(test, dev, 8, 1, 'b');    /* first of the next one */
+	KUNIT_EXPECT_EQ(test, dev->size, 9);
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 2);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 7, 64, 'a'), 1);  /* up to the quantum end */
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 8, 64, 'b'), 1);  /* up to dev->size */
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 9, 64, 0), 0);    /* at dev->size */
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 100, 64, 0), 0);  /* past it */
+
+	scull_kunit_write(test, dev, 31, 1, 'c');   /* last byte of a quantum set */
+	scull_kunit_write(test, dev, 32, 1, 'd');   /* first of the next one */
+	KUNIT_EXPECT_EQ(test, dev->nr_qsets, 2);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 31, 64, 'c'), 1);
+
+	/* sparse: items 2 to 4 are holes, and so are quanta of items present */
+	scull_kunit_write(test, dev, 5 * 32 + 3, 2, 'e');
+	KUNIT_EXPECT_EQ(test, dev->size, 5 * 32 + 5);
+	KUNIT_EXPECT_EQ(test, dev->nr_qsets, 3);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 3 * 32 + 1, 64, 0), 7);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 16, 64, 0), 8);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 5 * 32, 3, 0), 3);  /* unwritten, in a quantum */
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 5);   /* reading holes allocates nothing */
+
+	/* far out, through the upper levels of the index */
+	scull_kunit_write(test, dev, (1LL << 40) + 1, 1, 'f');
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 1LL << 40, 1, 0), 1);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, (1LL << 40) + 1, 64, 'f'), 1);
+	scull_kunit_check(test, dev);
+	up(&dev->sem);
+}
+
+static void scull_trim_test(struct kunit *test)
+{
+	struct scull_dev *dev = test->priv;
+
+	down(&dev->sem);
+	scull_set_geometry(dev, 8, 4);
+	scull_kunit_write(test, dev, 0, 6 * 32, 'a');
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 24);
+
+	/* inside a quantum: the rest of it reads as zeroes if grown again */
+	KUNIT_EXPECT_EQ(test, scull_truncate_locked(dev, 2 * 32 + 3), 0);
+	scull_kunit_check(test, dev);
+	KUNIT_EXPECT_EQ(test, dev->size, 2 * 32 + 3);
+	KUNIT_EXPECT_EQ(test, dev->nr_qsets, 3);
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 9);
+	KUNIT_EXPECT_EQ(test, scull_truncate_locked(dev, 3 * 32), 0);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 2 * 32, 3, 'a'), 3);
+	KUNIT_EXPECT_EQ(test, scull_kunit_read(test, dev, 2 * 32 + 3, 64, 0), 5);
+
+	/* at the edge of a quantum set: the last one goes whole */
+	KUNIT_EXPECT_EQ(test, scull_truncate_locked(dev, 2 * 32), 0);
+	scull_kunit_check(test, dev);
+	KUNIT_EXPECT_EQ(test, dev->nr_qsets, 2);
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 8);
+
+	KUNIT_EXPECT_EQ(test, scull_truncate_locked(dev, -1), -EINVAL);
+	KUNIT_EXPECT_EQ(test, scull_truncate_locked(dev, scull_max_size + 1), -EFBIG);
+
+	scull_trim(dev);
+	scull_kunit_check(test, dev);
+	KUNIT_EXPECT_EQ(test, dev->size, 0);
+	KUNIT_EXPECT_EQ(test, dev->nr_quanta, 0);
+	KUNIT_EXPECT_EQ(test, dev->nr_qsets, 0);
+	KUNIT_EXPECT_EQ(test, dev->nr_nodes, 0);
+	KUNIT_EXPECT_PTR_EQ(test, dev->data, NULL);
+	KUNIT_EXPECT_EQ(test, dev->quantum, scull_quantum);   /* the geometry of the module */
+	up(&dev->sem);
+}
+
+/* fill @size bytes with whole quanta */
+static int scull_kunit_fill(struct scull_dev *dev, u64 size, const char *buf)
+{
+	struct scull_loc loc;
+	loff_t pos = 0;
+	ssize_t n;
+
+	while (pos < size) {
+		n = scull_write_kernel_locked(dev, buf, min_t(u64, dev->quantum, size - pos),
+				&pos, &loc, NULL);
+		if (n < 0)
+			return n;
+		cond_resched();
+	}
+	return 0;
+}
+
+static void scull_qset_bench(struct kunit *test)
+{
+	static const u64 sizes[] = { 1ULL << 20, 100ULL << 20, 1ULL << 30 };
+	struct scull_dev *dev = test->priv;
+	u64 start, ns, item, items;
+	char *buf;
+	int i;
+
+	buf = kunit_kzalloc(test, scull_quantum, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	down(&dev->sem);
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		if (sizes[i] > ((u64)totalram_pages() << PAGE_SHIFT) / 4) {
+			kunit_info(test, "scull_qset: skip %llu bytes", sizes[i]);
+			continue;
+		}
+		start = ktime_get_ns();
+		if (scull_kunit_fill(dev, sizes[i], buf)) {
+			scull_trim(dev);
+			kunit_info(test, "scull_qset: skip %llu bytes", sizes[i]);
+			continue;
+		}
+		ns = ktime_get_ns() - start;
+		kunit_info(test, "scull_qset: fill %llu bytes %lu quanta %llu ns",
+			   sizes[i], dev->nr_quanta, ns);
+
+		items = div64_u64(sizes[i] - 1, (u64)dev->quantum * dev->qset) + 1;
+		start = ktime_get_ns();
+		for (item = 0; item < items; item++)
+			KUNIT_EXPECT_PTR_NE(test, scull_follow(dev, item), NULL);
+		ns = ktime_get_ns() - start;
+		kunit_info(test, "scull_qset: follow %llu bytes %llu qsets %llu ns",
+			   sizes[i], items, ns);
+
+		scull_kunit_check(test, dev);
+		start = ktime_get_ns();
+		scull_trim(dev);
+		ns = ktime_get_ns() - start;
+		kunit_info(test, "scull_qset: trim %llu bytes %llu ns", sizes[i], ns);
+	}
+	up(&dev->sem);
+}
+
+static struct kunit_case scull_qset_cases[] = {
+	KUNIT_CASE(scull_locate_test),
+	KUNIT_CASE(scull_boundary_test),
+	KUNIT_CASE(scull_trim_test),
+	KUNIT_CASE(scull_qset_bench),
+	{}
+};
+
+static struct kunit_suite scull_qset_suite = {
+	.name = "scull_qset",
+	.init = scull_kunit_init,
+	.exit = scull_kunit_exit,
+	.test_cases = scull_qset_cases,
+};
+
+kunit_test_suite(scull_qset_suite);
@@ -0,0 +1,265 @@
+/*
+ * record.c -- the record mode of a device
+ *
+ * In SCULL_MODE_RECORD every write() is one record, appended to the
+ * device, and every read() returns one whole record. The file position
+ * is a record number, not a byte offset: lseek(fd, n, SEEK_SET) goes to
+ * record n, SEEK_END counts from the number of records.
+ *
+ * The bytes of the records follow each other in the quanta, as in byte
+ * mode. Where each one starts is kept in a table of offsets, in chunks
+ * of SCULL_REC_CHUNK so that it grows without copying: finding record n
+ * is two array lookups, whatever n is. Record n ends where record n + 1
+ * starts, the last one at dev->size.
+ *
+ * Everything here is called with dev->sem held.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+#define SCULL_REC_CHUNK     512     /* offsets per chunk, 4 KB */
+
+/*
+ * @chunks: @nr_chunks pointers, to SCULL_REC_CHUNK offsets each or NULL
+ * @nr: how many records there are
+ * @generation: dev->generation when @nr was last right; a trim bumps it,
+ *	which empties the table without scull_trim() knowing about it
+ */
+struct scull_records {
+	u64 **chunks;
+	unsigned long nr_chunks;
+	u64 nr;
+	unsigned long generation;
+};
+
+/* the table of @dev, emptied if the device was trimmed since */
+static struct scull_records *scull_rec_table(struct scull_dev *dev)
+{
+	struct scull_records *rec = dev->rec;
+
+	if (rec->generation != dev->generation) {
+		rec->nr = 0;
+		rec->generation = dev->generation;
+	}
+	return rec;
+}
+
+static inline u64 *scull_rec_off(struct scull_records *rec, u64 n)
+{
+	return &rec->chunks[n / SCULL_REC_CHUNK][n % SCULL_REC_CHUNK];
+}
+
+/* make room for the offset of record rec->nr */
+static int scull_rec_grow(struct scull_records *rec)
+{
+	unsigned long c = rec->nr / SCULL_REC_CHUNK, n;
+	u64 **chunks;
+
+	if (c >= rec->nr_chunks) {
+		n = max_t(unsigned long, 8, 2 * rec->nr_chunks);
+		chunks = kmalloc(n * sizeof(*chunks), GFP_KERNEL);
+		if (!chunks)
+			return -ENOMEM;
+		memset(chunks, 0, n * sizeof(*chunks));
+		if (rec->nr_chunks)
+			memcpy(chunks, rec->chunks, rec->nr_chunks * sizeof(*chunks));
+		kfree(rec->chunks);
+		rec->chunks = chunks;
+		rec->nr_chunks = n;
+	}
+	if (!rec->chunks[c]) {
+		rec->chunks[c] = kmalloc(SCULL_REC_CHUNK * sizeof(u64), GFP_KERNEL);
+		if (!rec->chunks[c])
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Give @dev its table, before it is first put in record mode. Unlike the
+ * table of scull_log_setup() it is only used under dev->sem.
+ */
+int scull_rec_setup(struct scull_dev *dev)
+{
+	struct scull_records *rec;
+
+	if (dev->rec)
+		return 0;
+	rec = kmalloc(sizeof(struct scull_records), GFP_KERNEL);
+	if (!rec)
+		return -ENOMEM;
+	memset(rec, 0, sizeof(struct scull_records));
+	rec->generation = dev->generation;
+	dev->rec = rec;
+	return 0;
+}
+
+/* the device leaves record mode, or goes away */
+void scull_rec_free(struct scull_dev *dev)
+{
+	struct scull_records *rec = dev->rec;
+	unsigned long i;
+
+	if (!rec)
+		return;
+	for (i = 0; i < rec->nr_chunks; i++)
+		kfree(rec->chunks[i]);
+	kfree(rec->chunks);
+	kfree(rec);
+	dev->rec = NULL;
+}
+
+/* how many records there are, where lseek() finds SEEK_END */
+u64 scull_rec_count(struct scull_dev *dev)
+{
+	return scull_rec_table(dev)->nr;
+}
+
+/*
+ * Append @count bytes as one record. Either all of it is there or none:
+ * dev->size only moves once every byte is copied. *f_pos is set past the
+ * new record.
+ */
+ssize_t scull_rec_write_locked(struct scull_dev *dev, const char __user *buf,
+		size_t count, loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	struct scull_records *rec = scull_rec_table(dev);
+	loff_t start = dev->size, pos = start;
+	size_t done, len;
+	char *to;
+	int retval;
+
+	if (!count)
+		return 0;
+	if (count > SCULL_REC_MAX_SIZE)
+		return -EMSGSIZE;
+	if ((u64)start + count > scull_max_size)
+		return -EFBIG;
+	retval = scull_rec_grow(rec);
+	if (retval)
+		return retval;
+
+	for (done = 0; done < count; done += len, pos += len) {
+		len = count - done;
+		retval = scull_write_prepare(dev, pos, &len, loc, cur, &to);
+		if (retval)
+			return retval;
+		if (copy_from_user(to, buf + done, len))
+			return -EFAULT;
+	}
+
+	*scull_rec_off(rec, rec->nr) = start;
+	rec->nr++;
+	dev->size = start + count;
+	*f_pos = rec->nr;
+	return count;
+}
+
+/* copy record @n, of @len bytes, to @buf */
+static int scull_rec_copy(struct scull_dev *dev, struct scull_records *rec, u64 n,
+		char __user *buf, size_t len, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	loff_t pos = *scull_rec_off(rec, n);
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = scull_read_locked(dev, buf + done, len - done, &pos, loc, cur);
+		if (ret <= 0)
+			return ret ? ret : -EIO;    /* records have no holes */
+		done += ret;
+	}
+	return 0;
+}
+
+static size_t scull_rec_len(struct scull_dev *dev, struct scull_records *rec, u64 n)
+{
+	u64 end = n + 1 < rec->nr ? *scull_rec_off(rec, n + 1) : dev->size;
+
+	return end - *scull_rec_off(rec, n);
+}
+
+/*
+ * Read record *f_pos, and move to the next one. A buffer smaller than
+ * the record gets -EMSGSIZE and the position stays, so that the record
+ * can be read again with a larger one. Past the last record is EOF.
+ */
+ssize_t scull_rec_read_locked(struct scull_dev *dev, char __user *buf, size_t count,
+		loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur)
+{
+	struct scull_records *rec = scull_rec_table(dev);
+	size_t len;
+	int retval;
+
+	loc->item = loc->s_pos = -1;
+	if (*f_pos < 0)
+		return -EINVAL;
+	if (*f_pos >= rec->nr)
+		return 0;
+
+	len = scull_rec_len(dev, rec, *f_pos);
+	if (count < len)
+		return -EMSGSIZE;
+	retval = scull_rec_copy(dev, rec, *f_pos, buf, len, loc, cur);
+	if (retval)
+		return retval;
+	(*f_pos)++;
+	return len;
+}
+
+/*
+ * SCULL_IOC_READ_RECORDS: read as many records from *f_pos as fit in
+ * b->buf, end to end, and their lengths into b->lens. Returns the number
+ * of records, 0 at EOF, -EMSGSIZE if not even the first one fits.
+ */
+int scull_rec_read_batch_locked(struct scull_dev *dev, struct scull_rec_batch *b,
+		loff_t *f_pos, struct scull_cursor *cur)
+{
+	struct scull_records *rec = scull_rec_table(dev);
+	char __user *buf = (char __user *)(uintptr_t)b->buf;
+	__u32 __user *lens = (__u32 __user *)(uintptr_t)b->lens;
+	struct scull_loc loc;
+	u64 n = *f_pos;
+	size_t len;
+	__u32 len32;
+	int retval;
+
+	b->nr = 0;
+	b->bytes = 0;
+	if (*f_pos < 0)
+		return -EINVAL;
+	for (; n < rec->nr && b->nr < b->max; n++) {
+		len = scull_rec_len(dev, rec, n);
+		if (len > b->size - b->bytes)
+			break;
+		retval = scull_rec_copy(dev, rec, n, buf + b->bytes, len, &loc, cur);
+		len32 = len;
+		if (!retval && copy_to_user(lens + b->nr, &len32, sizeof(len32)))
+			retval = -EFAULT;
+		if (retval)
+			return b->nr ? b->nr : retval;
+		b->nr++;
+		b->bytes += len;
+		*f_pos = n + 1;
+	}
+	if (!b->nr && n < rec->nr && b->max)
+		return -EMSGSIZE;
+	return b->nr;
+}
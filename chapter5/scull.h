@@ -26,17 +26,18 @@
 #define SCULL_QSET 1000
 #endif
 
+/*
+ * In the kernel every PDEBUG is a dynamic debug site: compiled in, but a
+ * patched-out branch until it is turned on through
+ * /sys/kernel/debug/dynamic_debug/control (or always on if built with
+ * -DDEBUG and no CONFIG_DYNAMIC_DEBUG). In user space SCULL_DEBUG decides.
+ */
 #undef PDEBUG   /* undef it, just in case */
-//#define SCULL_DEBUG
-#ifdef SCULL_DEBUG
 #ifdef __KERNEL__
-    /* debugging is on in kernel space */
-    #define PDEBUG(fmt, args...) printk(KERN_DEBUG "scull: " fmt, ## args)
-#else
+    #define PDEBUG(fmt, args...) pr_debug(fmt, ## args)
+#elif defined(SCULL_DEBUG)
     /* debugging is on in user space */
     #define PDEBUG(fmt, args...) fprintf(stderr, fmt, ##args)
-#endif
-
 #else
     #define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
@@ -44,10 +45,41 @@
 #undef PDEBUGG
 #define PDEBUGG(fmt, args...) /* nothing: it's a placeholder */
 
+/* what was allocated, reported by the scull_alloc tracepoint */
+#define SCULL_ALLOC_QSET    0   /* a struct scull_qset list item */
+#define SCULL_ALLOC_DATA    1   /* the pointer array of a quantum set */
+#define SCULL_ALLOC_QUANTUM 2   /* a quantum */
+#define SCULL_ALLOC_EXTENT  3   /* quanta allocated together, see qset.c */
+
+/*
+ * The largest extent of quanta allocated for a sequential writer, in
+ * bytes; 0 allocates every quantum on its own.
+ */
+#ifndef SCULL_EXTENT_MAX
+#define SCULL_EXTENT_MAX    (4 << 20)
+#endif
+
+/* ready quanta kept for the writers of each device, see pool.c */
+#ifndef SCULL_RESERVE
+#define SCULL_RESERVE       32
+#endif
+
+/*
+ * Writes must end below this, the rest of the device is a sparse hole
+ * costing nothing until written. Can be raised up to MAX_LFS_FILESIZE.
+ */
+#ifndef SCULL_MAX_SIZE
+#define SCULL_MAX_SIZE (1ULL << 44) /* 16 TB */
+#endif
+
 /*
  * Representation of scull quantum sets.
  * @data: an array of pointers, which point to a quantum
- * @next: point to the next scull_qset
+ * @extent: NULL until the first extent, then @extent[i] is the number of
+ *	quanta of the extent starting at quantum i, 0 if none does
+ * @spilled: NULL until the first spill, then bit i is set while quantum i
+ *	is in the backing file of spill.c, @data[i] holding its slot
+ * @referenced: read or written since the clock of spill.c last went by
  *
  * the size of @data is defined by scull_dev->qset (default SCULL_QUANTUM 4000).
  * the size of each quantum is defined by scull_dev->quantum (default SCULL_QSET 1000).
@@ -55,25 +87,696 @@
  */
 struct scull_qset {
     void **data;
-    struct scull_qset *next;
+    unsigned short *extent;
+    unsigned long *spilled;
+    bool referenced;
+};
+
+/*
+ * Whether quantum @j of @dptr is spilled: @dptr->data[j] is then not a
+ * pointer (no alignment tells them apart, the quanta inside an extent
+ * being at any multiple of the quantum). Only scull_read_prepare(),
+ * scull_write_prepare(), scull_trim() and scull_truncate_locked() ever
+ * meet one.
+ */
+static inline bool scull_spilled(const struct scull_qset *dptr, int j)
+{
+    return dptr->spilled && test_bit(j, dptr->spilled);
+}
+
+/*
+ * A node of the index of quantum sets, see qset.c. 6 bits of the item
+ * number per level; 11 levels cover any 64-bit item.
+ */
+#define SCULL_INDEX_SHIFT       6
+#define SCULL_INDEX_FANOUT      (1 << SCULL_INDEX_SHIFT)
+#define SCULL_INDEX_MAX_HEIGHT  ((64 + SCULL_INDEX_SHIFT - 1) / SCULL_INDEX_SHIFT)
+
+struct scull_node {
+    void *slots[SCULL_INDEX_FANOUT];
+};
+
+/*
+ * Lock profiling of scull_dev->sem, see scull_lock()/scull_unlock().
+ * Who took the semaphore is one of the SCULL_OP_* below.
+ */
+#define SCULL_OP_OPEN       0
+#define SCULL_OP_READ       1
+#define SCULL_OP_WRITE      2
+#define SCULL_OP_NR         3
+
+/* bucket i counts the times which were < 2^i ns (and >= 2^(i-1) ns) */
+#define SCULL_LAT_BUCKETS   32
+
+static inline int scull_lat_bucket(u64 ns)
+{
+    int i = fls64(ns);
+
+    return i < SCULL_LAT_BUCKETS ? i : SCULL_LAT_BUCKETS - 1;
+}
+
+/*
+ * @acquired: how many times the semaphore was taken while profiling
+ * @wait_total/@wait_max: time spent in down_interruptible()
+ * @hold_total/@hold_max: time between down_interruptible() and up()
+ * @max_op/@max_pos: operation and file position of the longest holder
+ * @start/@op/@pos: the current holder, @start is 0 if it is not profiled
+ */
+struct scull_lockstat {
+    unsigned long acquired;
+    u64 wait_total;
+    u64 wait_max;
+    u64 hold_total;
+    u64 hold_max;
+    int max_op;
+    loff_t max_pos;
+    unsigned long wait_hist[SCULL_LAT_BUCKETS];
+    unsigned long hold_hist[SCULL_LAT_BUCKETS];
+
+    u64 start;
+    int op;
+    loff_t pos;
+};
+
+/*
+ * Latency and failure injection, set per device by SCULL_IOC_SET_INJECT
+ * (CAP_SYS_ADMIN only) and read back, with the counters, by
+ * SCULL_IOC_GET_INJECT.
+ *
+ * @delay_mode: one of SCULL_DELAY_*, the delay is added to every
+ *	read and write after dev->sem is released
+ * @delay_us: the fixed delay, or the smallest one
+ * @delay_max_us: the largest delay of uniform and pareto
+ * @pareto_alpha: shape of the pareto tail, times 100 (150 is 1.5)
+ * @enomem_ppm: quantum allocations failing with -ENOMEM, per million
+ * @short_ppm: reads and writes transferring less than asked, per million
+ * @seed: seed of the per-device generator, 0 for the default one
+ * @delayed ... @short_xfers: what was injected since the last SET
+ */
+#define SCULL_DELAY_NONE     0
+#define SCULL_DELAY_FIXED    1
+#define SCULL_DELAY_UNIFORM  2
+#define SCULL_DELAY_PARETO   3
+
+#define SCULL_INJECT_MAX_US  10000000  /* no delay is longer than 10 s */
+
+struct scull_inject {
+    __u32 delay_mode;
+    __u32 delay_us;
+    __u32 delay_max_us;
+    __u32 pareto_alpha;
+    __u32 enomem_ppm;
+    __u32 short_ppm;
+    __u64 seed;
+
+    __u64 delayed;
+    __u64 delay_total_us;
+    __u64 enomem;
+    __u64 short_xfers;
+};
+
+/*
+ * Write combining of one open file, set by SCULL_IOC_SET_WCOMBINE and
+ * read back, with the counters, by SCULL_IOC_GET_WCOMBINE.
+ *
+ * @size: bytes buffered at most, 0 turns it off. A buffer never spans
+ *	two quanta, so it is cut to the quantum.
+ * @flush_ms: buffered bytes reach the device at most this late, which is
+ *	how stale other readers may be. 0: only when the buffer fills, on
+ *	fsync() and on close. Reads of the same file always see its writes.
+ * @writes: writes taken into the buffer since the last SET
+ * @flushes: times the buffer was written to the device
+ */
+#define SCULL_WC_MAX_MS      10000
+
+struct scull_wcombine {
+    __u32 size;
+    __u32 flush_ms;
+    __u64 writes;
+    __u64 flushes;
+};
+
+/*
+ * What a device is, set by SCULL_IOC_SET_MODE (which empties it).
+ */
+#define SCULL_MODE_BYTES     0  /* a byte stream, the classic scull */
+#define SCULL_MODE_LOG       1  /* appends only, see log.c */
+#define SCULL_MODE_RECORD    2  /* one record per write, see record.c */
+#define SCULL_MODE_KV        3  /* values looked up by key, see kv.c */
+#define SCULL_MODE_MAX       3
+
+struct scull_log;
+struct scull_records;
+struct scull_kv;
+struct scull_pool;
+
+/*
+ * The quanta the writers needed, read by SCULL_IOC_GET_ALLOCSTAT, see
+ * pool.c. A writer takes a quantum from the reserve of ready ones if it
+ * can, otherwise it allocates it itself with dev->sem held: that is a
+ * stall, and the time it took is counted.
+ * @reserve: quanta the reserve is refilled to, the scull_reserve parameter
+ * @ready: quanta in the reserve now
+ * @hits: quanta taken from the reserve
+ * @stalls, @stall_ns, @stall_max_ns: quanta or extents the writers
+ *	allocated themselves, and the time that took
+ * @refills: quanta allocated into the reserve by its worker
+ * @fallocated: quanta allocated by fallocate, see SCULL_IOC_FALLOCATE
+ */
+struct scull_allocstat {
+    __u32 reserve;
+    __u32 ready;
+    __u64 hits;
+    __u64 stalls;
+    __u64 stall_ns;
+    __u64 stall_max_ns;
+    __u64 refills;
+    __u64 fallocated;
+};
+
+/*
+ * SCULL_IOC_FALLOCATE: fallocate(2) for the device, whose VFS call never
+ * reaches a character device. The quanta of @offset to @offset + @len
+ * are allocated, those not there before are zeroed, and unless @mode has
+ * SCULL_FALLOC_KEEP_SIZE the device grows to @offset + @len. Byte mode
+ * only.
+ */
+#define SCULL_FALLOC_KEEP_SIZE  0x01    /* FALLOC_FL_KEEP_SIZE */
+
+struct scull_falloc {
+    __u64 offset;
+    __u64 len;
+    __u32 mode;
+    __u32 pad;
+};
+
+/*
+ * SCULL_IOC_TRUNCATE: ftruncate(2) for the device, which the VFS refuses
+ * for anything but a regular file. The argument points to the new size
+ * (__u64). Cutting frees only the quanta past it, and zeroes the rest of
+ * the last quantum kept; growing leaves a hole. Byte mode only.
+ *
+ * SCULL_IOC_SET_REWRITE 1: from then on, opening the device write-only
+ * no longer empties it. The quanta are rewritten in place, and when the
+ * file is released the device is cut where its furthest write ended, so
+ * that a writer rewriting it from the start leaves what it would have
+ * after emptying it, without freeing and allocating every quantum again.
+ * Meanwhile readers see the old bytes past what was rewritten. Byte mode
+ * only, the other modes are emptied as before.
+ */
+
+/*
+ * SCULL_IOC_GET_SPILLSTAT: the quanta of the device in the backing file
+ * of scull_spill, see spill.c.
+ * @spilled: quanta in the file now
+ * @spills: quanta written to the file and freed
+ * @refaults, @refault_ns, @refault_max_ns: quanta read back by a read or
+ *	a write needing them, and the time that took
+ * @errors: spills or refaults failing, the quantum stays where it was
+ */
+struct scull_spillstat {
+    __u64 spilled;
+    __u64 spills;
+    __u64 refaults;
+    __u64 refault_ns;
+    __u64 refault_max_ns;
+    __u64 errors;
+};
+
+/*
+ * SCULL_IOC_IOTRACE_READ: the read()s and write()s of a device, oldest
+ * first, from the ring SCULL_IOC_IOTRACE gave it; see iotrace.c.
+ * @ts_ns: ktime_get_ns() when the call came in
+ * @pos, @len: the file position and the bytes asked for
+ * @result: the bytes read or written, or -errno
+ * @lat_ns: from @ts_ns to the return, at most U32_MAX (4.3 s)
+ * @wait_ns: of @lat_ns, the wait for dev->sem, at most U32_MAX
+ * @pid: of the thread
+ * @op: SCULL_OP_READ or SCULL_OP_WRITE
+ */
+#define SCULL_IOTRACE_MAX    (1U << 20)  /* records of a ring at most */
+
+struct scull_iotrace_rec {
+    __u64 ts_ns;
+    __u64 pos;
+    __u32 len;
+    __s32 result;
+    __u32 lat_ns;
+    __u32 wait_ns;
+    __u32 pid;
+    __u8 op;
+    __u8 pad[3];
+};
+
+/*
+ * @buf: room for @nr struct scull_iotrace_rec
+ * @got: records copied there, set by the call
+ * @lost: records dropped so far because the ring was full, likewise
+ */
+struct scull_iotrace_read {
+    __u64 buf;
+    __u32 nr;
+    __u32 got;
+    __u64 lost;
+};
+
+/*
+ * SCULL_IOC_CHECKSUM: the checksum of the @len bytes at @pos, or of those
+ * up to the end of the device, computed where they are; see compute.c.
+ * Holes count as zeroes.
+ * @algo: SCULL_CSUM_CRC32C or SCULL_CSUM_XXH64
+ * @seed: 0 for the usual CRC-32C, or the @result of the bytes before to
+ *	go on from there; the seed of XXH64
+ * @result, @done: the checksum and the bytes it covers, set by the call,
+ *	also when a signal stopped it (EINTR)
+ */
+#define SCULL_CSUM_CRC32C    1
+#define SCULL_CSUM_XXH64     2
+
+struct scull_csum {
+    __u64 pos;
+    __u64 len;
+    __u32 algo;
+    __u32 flags;        /* 0 */
+    __u64 seed;
+    __u64 result;
+    __u64 done;
+};
+
+/*
+ * SCULL_IOC_FIND: where the bytes of @pattern are in the @len bytes at
+ * @pos, overlapping matches too, in order. Holes count as zeroes.
+ * @pattern: @pattern_len bytes, at most SCULL_FIND_PATTERN_MAX
+ * @matches: room for @max offsets in the device (__u64)
+ * @nr: offsets put there, set by the call
+ * @next: where to search on from, set by the call: after the last match
+ *	if @matches got full, else where it stopped, the end of the range or
+ *	of the device, or where a signal stopped it (EINTR)
+ */
+#define SCULL_FIND_PATTERN_MAX  256
+
+struct scull_find {
+    __u64 pos;
+    __u64 len;
+    __u64 pattern;
+    __u32 pattern_len;
+    __u32 max;
+    __u64 matches;
+    __u32 nr;
+    __u32 flags;        /* 0 */
+    __u64 next;
+};
+
+/*
+ * SCULL_IOC_READ_RECORDS: many records in one call, from the file
+ * position on, in record mode.
+ * @buf: where the records are put end to end, @size bytes
+ * @lens: where their lengths are put, room for @max of them
+ * @nr, @bytes: records and bytes read, set by the call
+ */
+#define SCULL_REC_MAX_SIZE   (1U << 30)  /* bytes of a record at most */
+
+struct scull_rec_batch {
+    __u64 buf;
+    __u64 lens;
+    __u32 size;
+    __u32 max;
+    __u32 nr;
+    __u32 bytes;
+};
+
+/*
+ * The SCULL_IOC_KV_* ioctls of KV mode.
+ * @key, @klen: the key, 1 to SCULL_KV_KEY_MAX bytes
+ * @val, @vlen: the value of a put; for a get the buffer and its size,
+ *	@vlen is then set to the length of the value
+ * @ttl_ms: of a put, 0 for the scull_kv_ttl_ms parameter (0: no TTL)
+ * @result: of each get of SCULL_IOC_KV_MGET, 0 or -errno
+ */
+#define SCULL_KV_KEY_MAX     250
+#define SCULL_KV_VAL_MAX     (1U << 20)
+#define SCULL_KV_MGET_MAX    256         /* gets of one SCULL_IOC_KV_MGET */
+#define SCULL_KV_MAX_BYTES   (64UL << 20)  /* default memory of a device */
+
+struct scull_kv_op {
+    __u64 key;
+    __u64 val;
+    __u32 klen;
+    __u32 vlen;
+    __u32 ttl_ms;
+    __s32 result;
+};
+
+/* @ops: @nr struct scull_kv_op, @found is set to the keys found */
+struct scull_kv_mget {
+    __u64 ops;
+    __u32 nr;
+    __u32 found;
+};
+
+/* @bytes: what the items take, evictions start past @max_bytes */
+struct scull_kv_stats {
+    __u64 items;
+    __u64 bytes;
+    __u64 max_bytes;
+    __u64 hits;
+    __u64 misses;
+    __u64 evictions;
+    __u64 expired;
+};
+
+/*
+ * io_uring passthrough, IORING_OP_URING_CMD on an open device, see
+ * uring.c. The sqe->cmd_op is one of SCULL_URING_*, the 16 bytes of
+ * sqe->cmd a struct scull_uring_cmd.
+ *
+ * READ and WRITE: @addr points to @nr struct scull_uring_io, all done
+ * under one hold of dev->sem, in order. Each io is a pread() or a
+ * pwrite() of @len bytes at @pos into or from @buf. @result is set to the
+ * bytes of the io or -errno, the CQE gets the bytes of the whole batch
+ * (or the first error if there are none). Byte mode only.
+ * STATS: @addr points to a struct scull_uring_stats to fill, @nr is 0.
+ */
+#define SCULL_URING_READ         1
+#define SCULL_URING_WRITE        2
+/* 3 is not used: holes are zeroes for READ, there is nothing else to snapshot */
+#define SCULL_URING_STATS        4
+
+#define SCULL_URING_MAX_IOS      64
+#define SCULL_URING_MAX_BYTES    (16U << 20)    /* of all the ios of a batch */
+
+struct scull_uring_cmd {
+    __u64 addr;
+    __u32 nr;
+    __u32 flags;        /* 0 */
+};
+
+struct scull_uring_io {
+    __u64 pos;
+    __u64 buf;
+    __u32 len;
+    __s32 result;
+};
+
+/* what /proc/scullmem shows of the device, and SCULL_IOC_GET_ALLOCSTAT */
+struct scull_uring_stats {
+    __u64 size;
+    __u64 qsets;
+    __u64 quanta;
+    __u64 nodes;
+    __u64 extents;
+    __u64 generation;
+    __u32 mode;
+    __u32 pad;
+    struct scull_allocstat alloc;
 };
 
 /*
-* @data: pointer to first quantum_set, multi quantum_set linked as a single list
+* @data: root of the index of quantum sets, @height levels high (0 if empty)
 * @quantum: bytes of a quantum
 * @qset: how many quantum(s) in a quantum_set
+* @quantum_shift, @item_shift: log2 of @quantum and of @quantum * @qset,
+*	-1 if they are not powers of two, see scull_set_geometry()
 * @size: the total size of the data stored in this device
+* @index: which scull device this is, scull0 has index 0
+* @lockstat: wait and hold times of @sem, protected by @sem itself
+* @generation: bumped whenever quantum sets are freed
+* @nr_qsets, @nr_quanta, @nr_nodes, @nr_extents: what is allocated, read
+*	without @sem by /proc/scullmem; the quanta of extents are in @nr_quanta
+* @first_open_ns: time the first open took to allocate and set up the device
+* @inject, @inject_rnd: fault injection and its random state, under @sem
+* @mode: one of SCULL_MODE_*, changed under @sem and, once there is one,
+*	@log->rwsem
+* @log: the state of the log mode, from the first SCULL_IOC_SET_MODE to it
+* @rec: the offsets of the records while in record mode, under @sem
+* @kv: the items of KV mode, from the first SCULL_IOC_SET_MODE to it
+* @pool: the reserve of ready quanta, from the first write allocating one
+* @alloc, @stall_hist: what the writers allocated, and how long they
+*	stalled for it, under @sem
+* @nr_spilled, @spill, @refault_hist: quanta in the backing file, what
+*	was spilled and read back and how long that took, under @sem
+* @spill_hand: the item the clock of spill.c looks at next, under @sem
+* @iotrace: the ring of SCULL_IOC_IOTRACE, found under RCU, NULL if none
+* @rewrite: opening it write-only rewrites it in place instead of emptying
+*	it, see SCULL_IOC_SET_REWRITE
+*
+* The devices are allocated when they are first opened, see scull_get_dev().
 */
 struct scull_dev {
-    struct scull_qset *data;
+    struct scull_node *data;
+    int height;
+    int index;
     int quantum;
     int qset;
-    unsigned long size;         /* amount of data stored here */
+    int quantum_shift;
+    int item_shift;
+    loff_t size;                /* amount of data stored here */
     unsigned long access_key;   /* used by sculluid and scullpriv */
+    unsigned long generation;
+    unsigned long nr_qsets;
+    unsigned long nr_quanta;
+    unsigned long nr_nodes;
+    unsigned long nr_extents;
     struct semaphore sem;       /* mutual exclusion semaphore */
-    struct cdev cdev;           /* Char device structure */
+    struct scull_lockstat lockstat;
+    u64 first_open_ns;
+    struct scull_inject inject;
+    u64 inject_rnd;
+    int mode;
+    struct scull_log *log;
+    struct scull_records *rec;
+    struct scull_kv *kv;
+    struct scull_pool *pool;
+    struct scull_allocstat alloc;
+    unsigned long stall_hist[SCULL_LAT_BUCKETS];
+    unsigned long nr_spilled;
+    struct scull_spillstat spill;
+    unsigned long refault_hist[SCULL_LAT_BUCKETS];
+    u64 spill_hand;
+    struct scull_iotrace *iotrace;
+    bool rewrite;
 };
  
+/*
+ * where a file position falls in the device, see scull_locate()
+ * @item: quantum set, its item number in the dev->data index
+ * @s_pos: quantum in that quantum set
+ * @q_pos: byte in that quantum
+ */
+struct scull_loc {
+    s64 item;
+    int s_pos;
+    int q_pos;
+};
+
+/*
+ * The cursor of an open file: the bottom node of the index its last read
+ * or write went through, see scull_cursor_leaf(). Only used under
+ * dev->sem; all zeroes is a cursor pointing nowhere.
+ * @leaf: the node, holding the slots of items @first to @first + 63
+ * @generation: dev->generation when @leaf was found
+ * @write_end, @write_run: where the last write ended, and how many bytes
+ *	were written in a row up to there, which sizes the extents
+ * @write_max: where the furthest write ended, for SCULL_IOC_SET_REWRITE
+ */
+struct scull_cursor {
+    struct scull_node *leaf;
+    u64 first;
+    unsigned long generation;
+    loff_t write_end;
+    u64 write_run;
+    loff_t write_max;
+};
+
+extern int scull_quantum;
+extern int scull_qset;
+extern bool scull_pow2;
+extern unsigned long long scull_max_size;
+extern unsigned int scull_extent_max;
+
+#ifdef __KERNEL__
+/*
+ * One open file of a device, filp->private_data.
+ * @cur: where the last read or write ended, under dev->sem
+ * @wc: write-combining settings and counters
+ * @wc_buf: @wc_len bytes to be written at @wc_pos, never more than @wc_limit
+ * @wc_error: error of a flush not reported yet, see scull_wc_flush()
+ * @wc_lock: protects the wc_ fields, taken before dev->sem
+ * @rewrite: opened write-only to rewrite the device in place, which is
+ *	cut at @cur.write_max when the file is released
+ */
+struct scull_file {
+    struct scull_dev *dev;
+    struct scull_cursor cur;
+    bool rewrite;
+    struct mutex wc_lock;
+    struct scull_wcombine wc;
+    char *wc_buf;
+    loff_t wc_pos;
+    size_t wc_len;
+    size_t wc_limit;
+    int wc_error;
+    struct delayed_work wc_work;
+};
+
+extern int scull_nr_devs;
+extern unsigned long scull_kv_max_bytes;
+extern unsigned int scull_kv_ttl_ms;
+extern unsigned int scull_reserve;
+extern struct scull_dev **scull_devices;
+
+/*
+ * The file operations of the bare devices in main.c, shared with the
+ * devices of access.c.
+ */
+void scull_dev_init(struct scull_dev *dev, int index);
+void scull_dev_destroy(struct scull_dev *dev);
+int scull_file_open(struct file *filp, struct scull_dev *dev);
+int scull_release(struct inode *inode, struct file *filp);
+ssize_t scull_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t scull_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
+loff_t scull_llseek(struct file *filp, loff_t off, int whence);
+int scull_fsync(struct file *filp, loff_t start, loff_t end, int datasync);
+long scull_fallocate(struct file *filp, int mode, loff_t offset, loff_t len);
+long scull_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+/*
+ * Write combining in wcombine.c
+ */
+void scull_wc_init(struct scull_file *sf);
+int scull_wc_set(struct scull_file *sf, const struct scull_wcombine *conf);
+ssize_t scull_wc_write(struct scull_file *sf, const char __user *buf, size_t count,
+        loff_t *f_pos);
+int scull_wc_flush(struct scull_file *sf, bool report);
+int scull_wc_release(struct scull_file *sf);
+
+/*
+ * KV mode in kv.c, without dev->sem
+ */
+int scull_kv_setup(struct scull_dev *dev);
+void scull_kv_clear(struct scull_dev *dev);
+void scull_kv_free(struct scull_dev *dev);
+long scull_kv_ioctl(struct scull_dev *dev, unsigned int cmd, unsigned long arg,
+        bool write);
+
+/*
+ * The reserve of ready quanta in pool.c; scull_pool_get() with dev->sem
+ * held. In user space there is no reserve, see scull_user.h.
+ */
+void *scull_pool_get(struct scull_dev *dev);
+void scull_pool_stat(struct scull_dev *dev, struct scull_allocstat *st);
+void scull_pool_free(struct scull_dev *dev);
+
+/*
+ * The io_uring commands in uring.c; .uring_cmd is there from 5.19 on.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+#define SCULL_URING
+struct io_uring_cmd;
+int scull_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+int scull_uring_init(void);
+void scull_uring_exit(void);
+#else
+static inline int scull_uring_init(void) { return 0; }
+static inline void scull_uring_exit(void) { }
+#endif
+
+/*
+ * The shrinker of spill.c, registered when scull_spill names a file
+ */
+int scull_spill_init(const char *path);
+void scull_spill_exit(void);
+
+/*
+ * The ring of the reads and writes in iotrace.c. scull_iotrace_add() is
+ * given the time the call started, 0 if the device had no ring then.
+ */
+int scull_iotrace_set(struct scull_dev *dev, unsigned long nr);
+int scull_iotrace_read(struct scull_dev *dev, struct scull_iotrace_read *rd);
+void scull_iotrace_add(struct scull_dev *dev, int op, u64 start, loff_t pos,
+        size_t len, ssize_t result, u64 wait_ns);
+void scull_iotrace_free(struct scull_dev *dev);
+
+/*
+ * sculluid, scullwuid and scullpriv in access.c
+ */
+int scull_access_init(dev_t firstdev);
+void scull_access_cleanup(void);
+#endif
+
+/*
+ * The storage in qset.c, all called with dev->sem held.
+ */
+int scull_trim(struct scull_dev *dev);
+int scull_truncate_locked(struct scull_dev *dev, loff_t size);
+int scull_check(struct scull_dev *dev);
+void scull_set_geometry(struct scull_dev *dev, int quantum, int qset);
+struct scull_qset *scull_follow(struct scull_dev *dev, u64 n);
+struct scull_qset *scull_lookup(struct scull_dev *dev, u64 n);
+struct scull_qset *scull_next_qset(struct scull_dev *dev, u64 *n);
+void scull_locate(struct scull_dev *dev, loff_t pos, struct scull_loc *loc);
+ssize_t scull_read_locked(struct scull_dev *dev, char __user *buf, size_t count,
+        loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+ssize_t scull_read_kernel_locked(struct scull_dev *dev, char *buf, size_t count,
+        loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+ssize_t scull_write_locked(struct scull_dev *dev, const char __user *buf, size_t count,
+        loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+ssize_t scull_write_kernel_locked(struct scull_dev *dev, const char *buf, size_t count,
+        loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+ssize_t scull_peek_locked(struct scull_dev *dev, loff_t pos, size_t count,
+        const char **from);
+int scull_write_prepare(struct scull_dev *dev, loff_t pos, size_t *count,
+        struct scull_loc *loc, struct scull_cursor *cur, char **to);
+int scull_fallocate_locked(struct scull_dev *dev, loff_t offset, loff_t len,
+        bool keep_size);
+
+/*
+ * The log mode in log.c, called without dev->sem
+ */
+int scull_log_setup(struct scull_dev *dev);
+void scull_log_free(struct scull_dev *dev);
+struct scull_log *scull_log_block(struct scull_dev *dev);
+void scull_log_unblock(struct scull_dev *dev, struct scull_log *log);
+ssize_t scull_log_write(struct scull_dev *dev, struct scull_cursor *cur,
+        const char __user *buf, size_t count, loff_t *f_pos);
+
+/*
+ * The record mode in record.c, with dev->sem held
+ */
+int scull_rec_setup(struct scull_dev *dev);
+void scull_rec_free(struct scull_dev *dev);
+u64 scull_rec_count(struct scull_dev *dev);
+ssize_t scull_rec_read_locked(struct scull_dev *dev, char __user *buf, size_t count,
+        loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+ssize_t scull_rec_write_locked(struct scull_dev *dev, const char __user *buf,
+        size_t count, loff_t *f_pos, struct scull_loc *loc, struct scull_cursor *cur);
+int scull_rec_read_batch_locked(struct scull_dev *dev, struct scull_rec_batch *b,
+        loff_t *f_pos, struct scull_cursor *cur);
+
+/*
+ * The backing file of spill.c: quanta are spilled to it and read back
+ * with dev->sem held.
+ */
+int scull_spill_open(const char *path, int slot_size);
+void scull_spill_close(void);
+unsigned long scull_spill_dev(struct scull_dev *dev, unsigned long nr);
+int scull_spill_in(struct scull_dev *dev, struct scull_qset *dptr, int s_pos);
+void scull_spill_drop(void *q);
+
+/*
+ * The checksums and searches of compute.c, which take dev->sem
+ */
+int scull_checksum(struct scull_dev *dev, struct scull_csum *cs);
+int scull_find(struct scull_dev *dev, struct scull_find *f);
+
+/*
+ * Fault injection in inject.c, also called with dev->sem held.
+ */
+int scull_inject_set(struct scull_dev *dev, const struct scull_inject *conf);
+u32 scull_inject_delay(struct scull_dev *dev);
+bool scull_inject_enomem(struct scull_dev *dev);
+size_t scull_inject_short(struct scull_dev *dev, size_t count);
+
 /*
  * Ioctl definitions
  */
@@ -90,9 +793,31 @@ struct scull_dev {
  *   _IOWR  an ioctl with both write and read parameters.
  */
 #define SCULL_IOC_MAKE_FAULTY_WRITE    _IO(SCULL_IOC_MAGIC, 0)
+#define SCULL_IOC_SET_INJECT           _IOW(SCULL_IOC_MAGIC, 1, struct scull_inject)
+#define SCULL_IOC_GET_INJECT           _IOR(SCULL_IOC_MAGIC, 2, struct scull_inject)
+#define SCULL_IOC_SET_WCOMBINE         _IOW(SCULL_IOC_MAGIC, 3, struct scull_wcombine)
+#define SCULL_IOC_GET_WCOMBINE         _IOR(SCULL_IOC_MAGIC, 4, struct scull_wcombine)
+#define SCULL_IOC_SET_MODE             _IO(SCULL_IOC_MAGIC, 5)  /* arg: SCULL_MODE_* */
+#define SCULL_IOC_GET_MODE             _IO(SCULL_IOC_MAGIC, 6)  /* returns it */
+#define SCULL_IOC_READ_RECORDS         _IOWR(SCULL_IOC_MAGIC, 7, struct scull_rec_batch)
+#define SCULL_IOC_KV_PUT               _IOW(SCULL_IOC_MAGIC, 8, struct scull_kv_op)
+#define SCULL_IOC_KV_GET               _IOWR(SCULL_IOC_MAGIC, 9, struct scull_kv_op)
+#define SCULL_IOC_KV_DELETE            _IOW(SCULL_IOC_MAGIC, 10, struct scull_kv_op)
+#define SCULL_IOC_KV_MGET              _IOWR(SCULL_IOC_MAGIC, 11, struct scull_kv_mget)
+#define SCULL_IOC_KV_STATS             _IOR(SCULL_IOC_MAGIC, 12, struct scull_kv_stats)
+#define SCULL_IOC_FALLOCATE            _IOW(SCULL_IOC_MAGIC, 13, struct scull_falloc)
+#define SCULL_IOC_GET_ALLOCSTAT        _IOR(SCULL_IOC_MAGIC, 14, struct scull_allocstat)
+#define SCULL_IOC_SPILL                _IO(SCULL_IOC_MAGIC, 15) /* arg: quanta, returns those spilled */
+#define SCULL_IOC_GET_SPILLSTAT        _IOR(SCULL_IOC_MAGIC, 16, struct scull_spillstat)
+#define SCULL_IOC_IOTRACE              _IO(SCULL_IOC_MAGIC, 17) /* arg: records, a power of 2; 0: none */
+#define SCULL_IOC_IOTRACE_READ         _IOWR(SCULL_IOC_MAGIC, 18, struct scull_iotrace_read)
+#define SCULL_IOC_CHECKSUM             _IOWR(SCULL_IOC_MAGIC, 19, struct scull_csum)
+#define SCULL_IOC_FIND                 _IOWR(SCULL_IOC_MAGIC, 20, struct scull_find)
+#define SCULL_IOC_TRUNCATE             _IOW(SCULL_IOC_MAGIC, 21, __u64)
+#define SCULL_IOC_SET_REWRITE          _IO(SCULL_IOC_MAGIC, 22) /* arg: 0 or 1, returns the old one */
 /* define the max command of ioctrl. 
- * here is the last one is 0 in MAKE_FAULTY_WRITE 
+ * here is the last one is 22 in SET_REWRITE 
  */
-#define SCULL_IOC_MAX    0
+#define SCULL_IOC_MAX    22
 
 #endif
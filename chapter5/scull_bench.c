@@ -0,0 +1,927 @@
+/*
+ * scull_bench: throughput and latency of /dev/scullN
+ *
+ * Runs sequential or random read/write workloads against a scull device
+ * with a given block size, queue depth, number of threads and processes,
+ * and prints throughput and latency percentiles as text, json or csv.
+ * Every thread opens the device by itself, so threads * processes is the
+ * number of concurrent openers.
+ *
+ * examples:
+ *   ./scull_bench -w randrw -M 70 -b 512 -t 4 -s 64m -T 10
+ *   ./scull_bench -w read -q 8 -p 2 -o json
+ *   ./scull_bench -w randwrite -U 16 -q 4
+ *   ./scull_bench -w randread -c -q 64
+ *
+ * scull_bench.sh sweeps device size, openers and geometry.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <aio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/types.h>
+#include <linux/io_uring.h>
+
+#include "libscull.h"
+
+#define SCULL_DEVICE "/dev/scull0"
+#define SCULL_PARAMS "/sys/module/scull/parameters/"
+
+/* same as in scull.h */
+struct scull_wcombine {
+    __u32 size;
+    __u32 flush_ms;
+    __u64 writes;
+    __u64 flushes;
+};
+#define SCULL_IOC_SET_WCOMBINE _IOW('c', 3, struct scull_wcombine)
+#define SCULL_IOC_SET_MODE     _IO('c', 5)
+#define SCULL_MODE_BYTES       0
+#define SCULL_MODE_LOG         1
+
+struct scull_uring_cmd {
+    __u64 addr;
+    __u32 nr;
+    __u32 flags;
+};
+struct scull_uring_io {
+    __u64 pos;
+    __u64 buf;
+    __u32 len;
+    __s32 result;
+};
+#define SCULL_URING_READ       1
+#define SCULL_URING_WRITE      2
+#define SCULL_URING_MAX_IOS    64
+
+/*
+ * Latency histogram: the bucket of a value is its most significant bit
+ * plus the LAT_SUB_BITS bits after it, which keeps every percentile
+ * within about 6% of the real value.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  (64 * LAT_SUB)
+
+struct result {
+    uint64_t ops;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes;
+    uint64_t short_ops;      /* transfers shorter than the block size */
+    uint64_t errors;
+    uint64_t start_ns;       /* CLOCK_MONOTONIC, comparable across processes */
+    uint64_t end_ns;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t lat[LAT_BUCKETS];
+    int engine;              /* of libscull, with -c */
+};
+
+enum workload { WL_READ, WL_WRITE, WL_RW, WL_RANDREAD, WL_RANDWRITE, WL_RANDRW };
+
+static const char *wl_names[] = {
+    [WL_READ] = "read", [WL_WRITE] = "write", [WL_RW] = "rw",
+    [WL_RANDREAD] = "randread", [WL_RANDWRITE] = "randwrite", [WL_RANDRW] = "randrw",
+};
+
+static struct {
+    const char *device;
+    enum workload wl;
+    int read_pct;            /* share of reads for rw and randrw */
+    size_t bs;
+    int qd;
+    int threads;
+    int procs;
+    uint64_t size;           /* bytes of the device the workload covers */
+    uint64_t ops;            /* per thread, 0: use runtime */
+    double runtime;          /* seconds */
+    int prefill;
+    unsigned int seed;
+    const char *format;
+    const char *label;
+    unsigned int wcombine;   /* write-combining buffer of each opener, 0: off */
+    unsigned int flush_ms;
+    int log;                 /* put the device in log mode first */
+    int uring;               /* blocks per io_uring command, 0: no io_uring */
+    int lib;                 /* through libscull */
+} cfg = {
+    .device = SCULL_DEVICE, .wl = WL_READ, .read_pct = 50, .bs = 4000,
+    .qd = 1, .threads = 1, .procs = 1, .size = 16 << 20, .runtime = 5,
+    .prefill = 1, .seed = 1, .format = "text", .label = "", .flush_ms = 10,
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int lat_bucket(uint64_t v)
+{
+    int msb;
+
+    if (v < LAT_SUB)
+        return v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+           ((v >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* the middle of the values falling in bucket @b */
+static uint64_t lat_value(int b)
+{
+    int shift = b / LAT_SUB - 1;
+    uint64_t lo;
+
+    if (b < LAT_SUB)
+        return b;
+    lo = (uint64_t)(LAT_SUB + b % LAT_SUB) << shift;
+    return lo + ((1ULL << shift) >> 1);
+}
+
+static void lat_add(struct result *r, uint64_t v)
+{
+    r->lat[lat_bucket(v)]++;
+    r->lat_sum += v;
+    if (!r->lat_min || v < r->lat_min)
+        r->lat_min = v;
+    if (v > r->lat_max)
+        r->lat_max = v;
+}
+
+static uint64_t lat_percentile(const struct result *r, double pct)
+{
+    uint64_t want = (uint64_t)(r->ops * pct / 100.0), seen = 0;
+    int b;
+
+    if (want >= r->ops)
+        want = r->ops - 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        seen += r->lat[b];
+        if (seen > want)
+            return lat_value(b);
+    }
+    return r->lat_max;
+}
+
+static void result_merge(struct result *to, const struct result *from)
+{
+    int b;
+
+    to->ops += from->ops;
+    to->reads += from->reads;
+    to->writes += from->writes;
+    to->bytes += from->bytes;
+    to->short_ops += from->short_ops;
+    to->errors += from->errors;
+    if (from->ops && (!to->start_ns || from->start_ns < to->start_ns))
+        to->start_ns = from->start_ns;
+    if (from->end_ns > to->end_ns)
+        to->end_ns = from->end_ns;
+    if (from->lat_min && (!to->lat_min || from->lat_min < to->lat_min))
+        to->lat_min = from->lat_min;
+    if (from->lat_max > to->lat_max)
+        to->lat_max = from->lat_max;
+    to->lat_sum += from->lat_sum;
+    for (b = 0; b < LAT_BUCKETS; b++)
+        to->lat[b] += from->lat[b];
+    if (from->engine)
+        to->engine = from->engine;
+}
+
+/* xorshift64*, one state per thread */
+static uint64_t rnd_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+struct worker {
+    int id;                  /* global thread number */
+    uint64_t rnd;
+    uint64_t next_off;       /* sequential workloads */
+    struct result *res;
+    pthread_barrier_t *barrier;
+};
+
+static uint64_t nr_blocks(void)
+{
+    uint64_t n = cfg.size / cfg.bs;
+
+    return n ? n : 1;
+}
+
+static int next_is_read(struct worker *w)
+{
+    switch (cfg.wl) {
+    case WL_READ: case WL_RANDREAD:
+        return 1;
+    case WL_WRITE: case WL_RANDWRITE:
+        return 0;
+    default:
+        return (int)(rnd_next(&w->rnd) % 100) < cfg.read_pct;
+    }
+}
+
+static off_t next_offset(struct worker *w)
+{
+    uint64_t blk;
+
+    if (cfg.wl >= WL_RANDREAD) {
+        blk = rnd_next(&w->rnd) % nr_blocks();
+    } else {
+        /* the threads stream through the device one after the other */
+        blk = w->next_off++ % nr_blocks();
+    }
+    return (off_t)(blk * cfg.bs);
+}
+
+static void account(struct worker *w, int is_read, ssize_t ret, uint64_t lat)
+{
+    struct result *r = w->res;
+
+    if (ret < 0) {
+        r->errors++;
+        return;
+    }
+    r->ops++;
+    if (is_read)
+        r->reads++;
+    else
+        r->writes++;
+    r->bytes += ret;
+    if ((size_t)ret < cfg.bs)
+        r->short_ops++;
+    lat_add(r, lat);
+}
+
+static int done(uint64_t issued, uint64_t deadline)
+{
+    if (cfg.ops)
+        return issued >= cfg.ops;
+    /* checking the clock on every call would be measured as well */
+    return (issued & 63) == 0 && now_ns() >= deadline;
+}
+
+/* queue depth 1: plain pread/pwrite */
+static void run_sync(struct worker *w, int fd, char *buf, uint64_t deadline)
+{
+    uint64_t issued = 0, t0;
+    ssize_t ret;
+    off_t off;
+    int rd;
+
+    while (!done(issued, deadline)) {
+        rd = next_is_read(w);
+        off = next_offset(w);
+        t0 = now_ns();
+        if (rd)
+            ret = pread(fd, buf, cfg.bs, off);
+        else
+            ret = pwrite(fd, buf, cfg.bs, off);
+        account(w, rd, ret, now_ns() - t0);
+        issued++;
+    }
+}
+
+/* queue depth > 1: keep cfg.qd POSIX aio requests in flight */
+static void run_aio(struct worker *w, int fd, char *buf, uint64_t deadline)
+{
+    struct aiocb *cbs = calloc(cfg.qd, sizeof(*cbs));
+    const struct aiocb **list = calloc(cfg.qd, sizeof(*list));
+    uint64_t *t0 = calloc(cfg.qd, sizeof(*t0));
+    int *rd = calloc(cfg.qd, sizeof(*rd));
+    uint64_t issued = 0;
+    int i, inflight = 0, err;
+
+    if (!cbs || !list || !t0 || !rd) {
+        fprintf(stderr, "scull_bench: out of memory\n");
+        exit(1);
+    }
+
+    for (;;) {
+        for (i = 0; i < cfg.qd; i++) {
+            if (list[i] || done(issued, deadline))
+                continue;
+            memset(&cbs[i], 0, sizeof(cbs[i]));
+            cbs[i].aio_fildes = fd;
+            cbs[i].aio_buf = buf + i * cfg.bs;
+            cbs[i].aio_nbytes = cfg.bs;
+            cbs[i].aio_offset = next_offset(w);
+            rd[i] = next_is_read(w);
+            t0[i] = now_ns();
+            err = rd[i] ? aio_read(&cbs[i]) : aio_write(&cbs[i]);
+            issued++;
+            if (err) {
+                w->res->errors++;
+                continue;
+            }
+            list[i] = &cbs[i];
+            inflight++;
+        }
+        if (!inflight)
+            break;
+
+        aio_suspend(list, cfg.qd, NULL);
+        for (i = 0; i < cfg.qd; i++) {
+            if (!list[i] || aio_error(&cbs[i]) == EINPROGRESS)
+                continue;
+            account(w, rd[i], aio_return(&cbs[i]), now_ns() - t0[i]);
+            list[i] = NULL;
+            inflight--;
+        }
+    }
+    free(cbs);
+    free(list);
+    free(t0);
+    free(rd);
+}
+
+/*
+ * The rings of an io_uring, set up with the raw system calls: there is
+ * no liburing to depend on.
+ */
+struct uring {
+    int fd;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+static int uring_setup(struct uring *u, unsigned int entries)
+{
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+        return -1;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && cq_len > sq_len)
+        sq_len = cq_len;
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              u->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  u->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        return -1;
+    u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/* queue a SCULL_URING_* command of @nr ios, submitted by uring_enter() */
+static void uring_queue(struct uring *u, int fd, int op, struct scull_uring_io *ios,
+                        unsigned int nr, uint64_t user_data)
+{
+    unsigned int tail = *u->sq_tail, idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    struct scull_uring_cmd cmd = { .addr = (uintptr_t)ios, .nr = nr };
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd;
+    sqe->cmd_op = op;
+    sqe->user_data = user_data;
+    memcpy(sqe->cmd, &cmd, sizeof(cmd));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int uring_enter(struct uring *u, unsigned int submit, unsigned int wait)
+{
+    return syscall(__NR_io_uring_enter, u->fd, submit, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/*
+ * -U: cfg.qd io_uring commands in flight, each a SCULL_URING_READ or
+ * SCULL_URING_WRITE of cfg.uring blocks. Every block is accounted as an
+ * operation, with the latency of its command.
+ */
+static void run_uring(struct worker *w, int fd, char *buf, uint64_t deadline)
+{
+    struct scull_uring_io *ios = calloc((size_t)cfg.qd * cfg.uring, sizeof(*ios));
+    uint64_t *t0 = calloc(cfg.qd, sizeof(*t0));
+    int *rd = calloc(cfg.qd, sizeof(*rd));
+    unsigned int head, queued, inflight = 0;
+    struct io_uring_cqe *cqe;
+    uint64_t issued = 0, lat;
+    struct scull_uring_io *io;
+    struct uring u;
+    int i, j;
+
+    if (!ios || !t0 || !rd) {
+        fprintf(stderr, "scull_bench: out of memory\n");
+        exit(1);
+    }
+    if (uring_setup(&u, cfg.qd)) {
+        perror("io_uring_setup");
+        exit(1);
+    }
+
+    /* t0[i] is 0 while slot i is free */
+    for (;;) {
+        queued = 0;
+        for (i = 0; i < cfg.qd; i++) {
+            /* done() wants one more op at a time, a command is cfg.uring */
+            if (t0[i] || (cfg.ops ? issued >= cfg.ops : now_ns() >= deadline))
+                continue;
+            rd[i] = next_is_read(w);
+            for (j = 0; j < cfg.uring; j++) {
+                io = &ios[i * cfg.uring + j];
+                io->pos = next_offset(w);
+                io->buf = (uintptr_t)(buf + ((size_t)i * cfg.uring + j) * cfg.bs);
+                io->len = cfg.bs;
+                io->result = 0;
+            }
+            uring_queue(&u, fd, rd[i] ? SCULL_URING_READ : SCULL_URING_WRITE,
+                        &ios[i * cfg.uring], cfg.uring, i);
+            t0[i] = now_ns();
+            issued += cfg.uring;
+            queued++;
+        }
+        inflight += queued;
+        if (!inflight)
+            break;
+        if (uring_enter(&u, queued, 1) < 0) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+
+        head = *u.cq_head;
+        while (head != __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &u.cqes[head & *u.cq_mask];
+            i = cqe->user_data;
+            lat = now_ns() - t0[i];
+            for (j = 0; j < cfg.uring; j++) {
+                io = &ios[i * cfg.uring + j];
+                account(w, rd[i], cqe->res < 0 ? cqe->res : io->result, lat);
+            }
+            t0[i] = 0;
+            inflight--;
+            head++;
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+    }
+    close(u.fd);
+    free(ios);
+    free(t0);
+    free(rd);
+}
+
+/* an I/O of run_lib() in flight, its completion accounted by lib_done() */
+struct lib_slot {
+    struct worker *w;
+    int rd;
+    int busy;
+    uint64_t t0;
+};
+
+static void lib_done(void *arg, ssize_t ret)
+{
+    struct lib_slot *s = arg;
+
+    account(s->w, s->rd, ret, now_ns() - s->t0);
+    s->busy = 0;
+}
+
+/*
+ * -c: cfg.qd blocks in flight through libscull, on the engine it picks
+ * for the device; with -U, in io_uring commands of up to cfg.uring.
+ */
+static void run_lib(struct worker *w, struct libscull *h, char *buf, uint64_t deadline)
+{
+    struct lib_slot *slots = calloc(cfg.qd, sizeof(*slots));
+    uint64_t issued = 0;
+    struct lib_slot *s;
+    char *b;
+    int i, ret;
+
+    if (!slots) {
+        fprintf(stderr, "scull_bench: out of memory\n");
+        exit(1);
+    }
+    for (;;) {
+        for (i = 0; i < cfg.qd; i++) {
+            s = &slots[i];
+            if (s->busy || done(issued, deadline))
+                continue;
+            s->w = w;
+            s->rd = next_is_read(w);
+            s->busy = 1;
+            s->t0 = now_ns();
+            b = buf + (size_t)i * cfg.bs;
+            if (s->rd)
+                ret = libscull_read(h, b, cfg.bs, next_offset(w), lib_done, s);
+            else
+                ret = libscull_write(h, b, cfg.bs, next_offset(w), lib_done, s);
+            if (ret < 0) {
+                perror("libscull");
+                exit(1);
+            }
+            issued++;
+        }
+        if (!libscull_inflight(h))
+            break;
+        if (libscull_wait(h, 1) < 0) {
+            perror("libscull_wait");
+            exit(1);
+        }
+    }
+    free(slots);
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct libscull *h = NULL;
+    uint64_t deadline;
+    size_t nbufs;
+    char *buf;
+    int fd;
+
+    /* O_RDWR: scull trims the device when it is opened write-only */
+    if (cfg.lib) {
+        struct libscull_opts opts = { .depth = cfg.qd, .batch = cfg.uring };
+
+        h = libscull_open(cfg.device, O_RDWR, &opts);
+        fd = h ? libscull_fd(h) : -1;
+    } else {
+        fd = open(cfg.device, O_RDWR);
+    }
+    if (fd < 0) {
+        perror(cfg.device);
+        exit(1);
+    }
+    if (cfg.wcombine) {
+        struct scull_wcombine wc = { .size = cfg.wcombine, .flush_ms = cfg.flush_ms };
+
+        if (ioctl(fd, SCULL_IOC_SET_WCOMBINE, &wc) < 0) {
+            perror("SCULL_IOC_SET_WCOMBINE");
+            exit(1);
+        }
+    }
+    nbufs = cfg.qd * (cfg.uring && !cfg.lib ? cfg.uring : 1);
+    buf = malloc(cfg.bs * nbufs);
+    if (!buf) {
+        fprintf(stderr, "scull_bench: out of memory\n");
+        exit(1);
+    }
+    memset(buf, 'a' + w->id % 26, cfg.bs * nbufs);
+    w->next_off = (uint64_t)w->id * (nr_blocks() / (cfg.threads * cfg.procs));
+
+    pthread_barrier_wait(w->barrier);
+    w->res->start_ns = now_ns();
+    deadline = w->res->start_ns + (uint64_t)(cfg.runtime * 1e9);
+    if (h)
+        run_lib(w, h, buf, deadline);
+    else if (cfg.uring)
+        run_uring(w, fd, buf, deadline);
+    else if (cfg.qd == 1)
+        run_sync(w, fd, buf, deadline);
+    else
+        run_aio(w, fd, buf, deadline);
+    /* the buffered writes are part of the run */
+    if (cfg.wcombine && fsync(fd) < 0)
+        w->res->errors++;
+    w->res->end_ns = now_ns();
+
+    free(buf);
+    if (h) {
+        w->res->engine = libscull_engine(h);
+        libscull_close(h);
+    } else {
+        close(fd);
+    }
+    return NULL;
+}
+
+/* one process: cfg.threads workers, their results summed into @res */
+static void run_process(int proc, struct result *res)
+{
+    pthread_t *tids = calloc(cfg.threads, sizeof(*tids));
+    struct worker *ws = calloc(cfg.threads, sizeof(*ws));
+    struct result *rs = calloc(cfg.threads, sizeof(*rs));
+    pthread_barrier_t barrier;
+    int i;
+
+    if (!tids || !ws || !rs) {
+        fprintf(stderr, "scull_bench: out of memory\n");
+        exit(1);
+    }
+    pthread_barrier_init(&barrier, NULL, cfg.threads);
+    for (i = 0; i < cfg.threads; i++) {
+        ws[i].id = proc * cfg.threads + i;
+        ws[i].rnd = ((uint64_t)cfg.seed << 32) ^ (ws[i].id + 1) * 0x9e3779b97f4a7c15ULL;
+        ws[i].res = &rs[i];
+        ws[i].barrier = &barrier;
+        if (pthread_create(&tids[i], NULL, worker_main, &ws[i])) {
+            fprintf(stderr, "scull_bench: cannot create thread\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < cfg.threads; i++) {
+        pthread_join(tids[i], NULL);
+        result_merge(res, &rs[i]);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(tids);
+    free(ws);
+    free(rs);
+}
+
+/* empty the device and put it in the mode of the run */
+static int set_mode(void)
+{
+    int fd = open(cfg.device, O_RDWR);
+    int ret;
+
+    if (fd < 0) {
+        perror(cfg.device);
+        return -1;
+    }
+    ret = ioctl(fd, SCULL_IOC_SET_MODE, cfg.log ? SCULL_MODE_LOG : SCULL_MODE_BYTES);
+    if (ret < 0)
+        perror("SCULL_IOC_SET_MODE");
+    close(fd);
+    return ret;
+}
+
+/* read workloads need data below cfg.size, or they only measure EOF */
+static int prefill(void)
+{
+    size_t chunk = 1 << 20;
+    uint64_t done_bytes = 0;
+    char *buf = malloc(chunk);
+    ssize_t ret;
+    int fd;
+
+    if (!buf)
+        return -1;
+    memset(buf, 'x', chunk);
+    fd = open(cfg.device, O_WRONLY); /* trims the device */
+    if (fd < 0) {
+        perror(cfg.device);
+        free(buf);
+        return -1;
+    }
+    while (done_bytes < cfg.size) {
+        size_t n = cfg.size - done_bytes < chunk ? cfg.size - done_bytes : chunk;
+
+        ret = write(fd, buf, n);
+        if (ret <= 0) {
+            perror("prefill");
+            break;
+        }
+        done_bytes += ret;
+    }
+    close(fd);
+    free(buf);
+    return done_bytes < cfg.size ? -1 : 0;
+}
+
+static long read_param(const char *name)
+{
+    char path[128];
+    long v = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), SCULL_PARAMS "%s", name);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "%ld", &v) != 1)
+        v = -1;
+    fclose(f);
+    return v;
+}
+
+static void report(const struct result *r)
+{
+    double secs = r->end_ns > r->start_ns ? (r->end_ns - r->start_ns) / 1e9 : 0;
+    double mbps = secs ? r->bytes / secs / (1 << 20) : 0;
+    double iops = secs ? r->ops / secs : 0;
+    double avg = r->ops ? (double)r->lat_sum / r->ops : 0;
+    uint64_t p50 = 0, p99 = 0, p999 = 0;
+    long quantum = read_param("scull_quantum"), qset = read_param("scull_qset");
+    int openers = cfg.threads * cfg.procs;
+
+    if (r->ops) {
+        p50 = lat_percentile(r, 50);
+        p99 = lat_percentile(r, 99);
+        p999 = lat_percentile(r, 99.9);
+    }
+
+    if (!strcmp(cfg.format, "json")) {
+        printf("{\"label\":\"%s\",\"device\":\"%s\",\"workload\":\"%s\",\"read_pct\":%d,"
+               "\"bs\":%zu,\"qd\":%d,\"threads\":%d,\"procs\":%d,\"openers\":%d,"
+               "\"size\":%llu,\"quantum\":%ld,\"qset\":%ld,\"wcombine\":%u,\"log\":%d,"
+               "\"seconds\":%.3f,\"ops\":%llu,\"reads\":%llu,\"writes\":%llu,"
+               "\"bytes\":%llu,\"short\":%llu,\"errors\":%llu,"
+               "\"mib_s\":%.2f,\"iops\":%.0f,\"lat_ns\":{\"min\":%llu,\"avg\":%.0f,"
+               "\"p50\":%llu,\"p99\":%llu,\"p99_9\":%llu,\"max\":%llu}}\n",
+               cfg.label, cfg.device, wl_names[cfg.wl], cfg.read_pct,
+               cfg.bs, cfg.qd, cfg.threads, cfg.procs, openers,
+               (unsigned long long)cfg.size, quantum, qset, cfg.wcombine, cfg.log,
+               secs, (unsigned long long)r->ops, (unsigned long long)r->reads,
+               (unsigned long long)r->writes, (unsigned long long)r->bytes,
+               (unsigned long long)r->short_ops, (unsigned long long)r->errors,
+               mbps, iops, (unsigned long long)r->lat_min, avg,
+               (unsigned long long)p50, (unsigned long long)p99,
+               (unsigned long long)p999, (unsigned long long)r->lat_max);
+    } else if (!strcmp(cfg.format, "csv")) {
+        printf("label,device,workload,read_pct,bs,qd,threads,procs,openers,size,quantum,qset,"
+               "seconds,ops,reads,writes,bytes,short,errors,mib_s,iops,"
+               "lat_min,lat_avg,lat_p50,lat_p99,lat_p99_9,lat_max\n");
+        printf("%s,%s,%s,%d,%zu,%d,%d,%d,%d,%llu,%ld,%ld,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,"
+               "%.2f,%.0f,%llu,%.0f,%llu,%llu,%llu,%llu\n",
+               cfg.label, cfg.device, wl_names[cfg.wl], cfg.read_pct,
+               cfg.bs, cfg.qd, cfg.threads, cfg.procs, openers,
+               (unsigned long long)cfg.size, quantum, qset,
+               secs, (unsigned long long)r->ops, (unsigned long long)r->reads,
+               (unsigned long long)r->writes, (unsigned long long)r->bytes,
+               (unsigned long long)r->short_ops, (unsigned long long)r->errors,
+               mbps, iops, (unsigned long long)r->lat_min, avg,
+               (unsigned long long)p50, (unsigned long long)p99,
+               (unsigned long long)p999, (unsigned long long)r->lat_max);
+    } else {
+        printf("%s %s bs=%zu qd=%d threads=%d procs=%d size=%llu quantum=%ld qset=%ld wcombine=%u%s",
+               cfg.device, wl_names[cfg.wl], cfg.bs, cfg.qd, cfg.threads, cfg.procs,
+               (unsigned long long)cfg.size, quantum, qset, cfg.wcombine,
+               cfg.log ? " log" : "");
+        if (cfg.uring)
+            printf(" uring=%d", cfg.uring);
+        if (cfg.lib)
+            printf(" libscull=%s", libscull_engine_name(r->engine));
+        printf("\n");
+        printf("  %llu ops (%llu reads, %llu writes, %llu short, %llu errors) in %.3f s\n",
+               (unsigned long long)r->ops, (unsigned long long)r->reads,
+               (unsigned long long)r->writes, (unsigned long long)r->short_ops,
+               (unsigned long long)r->errors, secs);
+        printf("  %.2f MiB/s, %.0f IOPS\n", mbps, iops);
+        printf("  latency ns: min %llu avg %.0f p50 %llu p99 %llu p99.9 %llu max %llu\n",
+               (unsigned long long)r->lat_min, avg, (unsigned long long)p50,
+               (unsigned long long)p99, (unsigned long long)p999,
+               (unsigned long long)r->lat_max);
+    }
+}
+
+static uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'g': case 'G': v <<= 10; /* fall through */
+    case 'm': case 'M': v <<= 10; /* fall through */
+    case 'k': case 'K': v <<= 10;
+    }
+    return v;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: scull_bench [options]\n"
+        "  -d dev    device (" SCULL_DEVICE ")\n"
+        "  -w wl     read|write|rw|randread|randwrite|randrw (read)\n"
+        "  -M pct    percentage of reads for rw and randrw (50)\n"
+        "  -b size   block size (4000)\n"
+        "  -q depth  requests in flight per thread (1)\n"
+        "  -t n      threads per process (1)\n"
+        "  -p n      processes (1)\n"
+        "  -s size   bytes of the device to cover (16m)\n"
+        "  -n ops    operations per thread, instead of a runtime\n"
+        "  -T secs   runtime (5)\n"
+        "  -N        do not prefill the device before the run\n"
+        "  -S seed   random seed (1)\n"
+        "  -o fmt    text|json|csv (text)\n"
+        "  -l label  free text copied to json and csv output\n"
+        "  -W size   write-combining buffer of each opener (off)\n"
+        "  -F ms     flush delay of the write-combining buffer (10)\n"
+        "  -L        put the device in log mode: every write appends\n"
+        "  -U n      io_uring commands of n blocks each, -q of them in flight\n"
+        "  -c        through libscull, -q blocks in flight (-U: per command)\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct result *shared, total;
+    int c, i, status;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "d:w:M:b:q:t:p:s:n:T:NS:o:l:W:F:LU:ch")) != -1) {
+        switch (c) {
+        case 'd': cfg.device = optarg; break;
+        case 'w':
+            for (i = 0; i <= WL_RANDRW; i++)
+                if (!strcmp(optarg, wl_names[i]))
+                    break;
+            if (i > WL_RANDRW)
+                usage();
+            cfg.wl = i;
+            break;
+        case 'M': cfg.read_pct = atoi(optarg); break;
+        case 'b': cfg.bs = parse_size(optarg); break;
+        case 'q': cfg.qd = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'p': cfg.procs = atoi(optarg); break;
+        case 's': cfg.size = parse_size(optarg); break;
+        case 'n': cfg.ops = strtoull(optarg, NULL, 0); break;
+        case 'T': cfg.runtime = atof(optarg); break;
+        case 'N': cfg.prefill = 0; break;
+        case 'S': cfg.seed = atoi(optarg); break;
+        case 'o': cfg.format = optarg; break;
+        case 'l': cfg.label = optarg; break;
+        case 'W': cfg.wcombine = parse_size(optarg); break;
+        case 'F': cfg.flush_ms = atoi(optarg); break;
+        case 'L': cfg.log = 1; break;
+        case 'U': cfg.uring = atoi(optarg); break;
+        case 'c': cfg.lib = 1; break;
+        default: usage();
+        }
+    }
+    if (!cfg.bs || cfg.qd < 1 || cfg.threads < 1 || cfg.procs < 1 ||
+        cfg.read_pct < 0 || cfg.read_pct > 100 ||
+        cfg.uring < 0 || cfg.uring > SCULL_URING_MAX_IOS)
+        usage();
+
+    /* before the prefill, which then appends in log mode */
+    if (cfg.log && set_mode())
+        return 1;
+    if (cfg.prefill && cfg.wl != WL_WRITE && cfg.wl != WL_RANDWRITE && prefill())
+        return 1;
+
+    /* each process reports into its own slot of a shared mapping */
+    shared = mmap(NULL, cfg.procs * sizeof(*shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(shared, 0, cfg.procs * sizeof(*shared));
+
+    if (cfg.procs == 1) {
+        run_process(0, &shared[0]);
+    } else {
+        for (i = 0; i < cfg.procs; i++) {
+            pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+            if (pid == 0) {
+                run_process(i, &shared[i]);
+                _exit(0);
+            }
+        }
+        while (wait(&status) > 0)
+            ;
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < cfg.procs; i++)
+        result_merge(&total, &shared[i]);
+    report(&total);
+    munmap(shared, cfg.procs * sizeof(*shared));
+    return total.errors ? 1 : 0;
+}
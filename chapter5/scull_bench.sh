@@ -0,0 +1,31 @@
+#! /bin/sh
+# Sweep scull_bench over the scaling dimensions of scull:
+# geometry (scull_quantum/scull_qset), device size and concurrent openers.
+# Reloads the module for every geometry, so it must run as root.
+# One json line per run goes to stdout, e.g.
+#	sudo ./scull_bench.sh > results.json
+#
+# The lists can be overridden from the environment.
+geometries=${GEOMETRIES:-"4000:1000 4096:1024 65536:64"}   # quantum:qset
+sizes=${SIZES:-"1m 64m 512m"}
+openers=${OPENERS:-"1 4 16"}
+workloads=${WORKLOADS:-"read write randread randwrite randrw"}
+bs=${BS:-4000}
+runtime=${RUNTIME:-5}
+
+for g in $geometries; do
+	quantum=${g%:*}
+	qset=${g#*:}
+	./scull_unload.sh 2>/dev/null
+	./scull_load.sh scull_quantum=$quantum scull_qset=$qset || exit 1
+
+	for size in $sizes; do
+		for n in $openers; do
+			for wl in $workloads; do
+				./scull_bench -w $wl -b $bs -s $size -t $n -T $runtime \
+					-o json -l "q$quantum-s$qset" || exit 1
+			done
+		done
+	done
+done
+./scull_unload.sh
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <error.h>
 #include <unistd.h>
 #include <sys/ioctl.h> /* _IO */
 #include <fcntl.h> /* O_RDWR */
+#include <linux/types.h> /* __u32, __u64 */
 
 /*
  * Ioctl definitions
@@ -14,6 +16,27 @@
 #define SCULL_IOC_MAGIC  'c'
 /* Please use a different 8-bit number in your code */
 
+/* same as struct scull_inject in scull.h */
+#define SCULL_DELAY_NONE     0
+#define SCULL_DELAY_FIXED    1
+#define SCULL_DELAY_UNIFORM  2
+#define SCULL_DELAY_PARETO   3
+
+struct scull_inject {
+    __u32 delay_mode;
+    __u32 delay_us;
+    __u32 delay_max_us;
+    __u32 pareto_alpha;
+    __u32 enomem_ppm;
+    __u32 short_ppm;
+    __u64 seed;
+
+    __u64 delayed;
+    __u64 delay_total_us;
+    __u64 enomem;
+    __u64 short_xfers;
+};
+
 /* If you are adding new ioctl's to the kernel, you should use the _IO
  * macros defined in <linux/ioctl.h>:
  *   _IO    an ioctl with no parameters
@@ -22,27 +45,380 @@
  *   _IOWR  an ioctl with both write and read parameters.
  */
 #define SCULL_IOC_MAKE_FAULTY_WRITE    _IO(SCULL_IOC_MAGIC, 0)
+#define SCULL_IOC_SET_INJECT           _IOW(SCULL_IOC_MAGIC, 1, struct scull_inject)
+#define SCULL_IOC_GET_INJECT           _IOR(SCULL_IOC_MAGIC, 2, struct scull_inject)
+/* 3 and 4 are the write combining ones, see scull_bench.c */
+#define SCULL_IOC_SET_MODE             _IO(SCULL_IOC_MAGIC, 5)
+#define SCULL_IOC_GET_MODE             _IO(SCULL_IOC_MAGIC, 6)
+
+/* same as in scull.h */
+struct scull_kv_op {
+    __u64 key;
+    __u64 val;
+    __u32 klen;
+    __u32 vlen;
+    __u32 ttl_ms;
+    __s32 result;
+};
+
+struct scull_kv_stats {
+    __u64 items;
+    __u64 bytes;
+    __u64 max_bytes;
+    __u64 hits;
+    __u64 misses;
+    __u64 evictions;
+    __u64 expired;
+};
+
+/* 7 is SCULL_IOC_READ_RECORDS */
+#define SCULL_IOC_KV_PUT               _IOW(SCULL_IOC_MAGIC, 8, struct scull_kv_op)
+#define SCULL_IOC_KV_GET               _IOWR(SCULL_IOC_MAGIC, 9, struct scull_kv_op)
+#define SCULL_IOC_KV_DELETE            _IOW(SCULL_IOC_MAGIC, 10, struct scull_kv_op)
+#define SCULL_IOC_KV_STATS             _IOR(SCULL_IOC_MAGIC, 12, struct scull_kv_stats)
+
+/* same as in scull.h */
+#define SCULL_FALLOC_KEEP_SIZE  0x01
+
+struct scull_falloc {
+    __u64 offset;
+    __u64 len;
+    __u32 mode;
+    __u32 pad;
+};
+
+struct scull_allocstat {
+    __u32 reserve;
+    __u32 ready;
+    __u64 hits;
+    __u64 stalls;
+    __u64 stall_ns;
+    __u64 stall_max_ns;
+    __u64 refills;
+    __u64 fallocated;
+};
+
+#define SCULL_IOC_FALLOCATE            _IOW(SCULL_IOC_MAGIC, 13, struct scull_falloc)
+#define SCULL_IOC_GET_ALLOCSTAT        _IOR(SCULL_IOC_MAGIC, 14, struct scull_allocstat)
+
+struct scull_spillstat {
+    __u64 spilled;
+    __u64 spills;
+    __u64 refaults;
+    __u64 refault_ns;
+    __u64 refault_max_ns;
+    __u64 errors;
+};
+
+#define SCULL_IOC_SPILL                _IO(SCULL_IOC_MAGIC, 15)
+#define SCULL_IOC_GET_SPILLSTAT        _IOR(SCULL_IOC_MAGIC, 16, struct scull_spillstat)
+
+/* same as in scull.h */
+#define SCULL_CSUM_CRC32C    1
+#define SCULL_CSUM_XXH64     2
+
+struct scull_csum {
+    __u64 pos;
+    __u64 len;
+    __u32 algo;
+    __u32 flags;
+    __u64 seed;
+    __u64 result;
+    __u64 done;
+};
+
+#define SCULL_FIND_PATTERN_MAX  256
+
+struct scull_find {
+    __u64 pos;
+    __u64 len;
+    __u64 pattern;
+    __u32 pattern_len;
+    __u32 max;
+    __u64 matches;
+    __u32 nr;
+    __u32 flags;
+    __u64 next;
+};
+
+/* 17 and 18 are the iotrace ring, see scull_replay.c */
+#define SCULL_IOC_CHECKSUM             _IOWR(SCULL_IOC_MAGIC, 19, struct scull_csum)
+#define SCULL_IOC_FIND                 _IOWR(SCULL_IOC_MAGIC, 20, struct scull_find)
+#define SCULL_IOC_TRUNCATE             _IOW(SCULL_IOC_MAGIC, 21, __u64)
+#define SCULL_IOC_SET_REWRITE          _IO(SCULL_IOC_MAGIC, 22)
 /* define the max command of ioctrl.
- * here is the last one is 0 in MAKE_FAULTY_WRITE
+ * here is the last one is 22 in SET_REWRITE
  */
-#define SCULL_IOC_MAX    0
+#define SCULL_IOC_MAX    22
+
+/* same as in scull.h */
+#define SCULL_MODE_BYTES     0
+#define SCULL_MODE_LOG       1
+#define SCULL_MODE_RECORD    2
+#define SCULL_MODE_KV        3
+#define SCULL_KV_VAL_MAX     (1U << 20)
 
 #define SCULL_DEVICE "/dev/scull"
-#define SCULL_DEVICE_SIZE sizeof(SCULL_DEVICE)
+#define SCULL_DEVICE_SIZE (sizeof(SCULL_DEVICE) + 8)
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: scull_ioctl_app [N]            oops in the write of scullN\n"
+        "       scull_ioctl_app N inject [delay=fixed|uniform|pareto] [us=MIN]\n"
+        "                       [max=MAX] [alpha=A*100] [enomem=PPM] [short=PPM] [seed=S]\n"
+        "       scull_ioctl_app N inject        (no settings: stop injecting)\n"
+        "       scull_ioctl_app N stats\n"
+        "       scull_ioctl_app N mode [bytes|log|record|kv]  (the device is emptied)\n"
+        "       scull_ioctl_app N kv put KEY VALUE [TTL_MS] | get KEY | del KEY | stats\n"
+        "       scull_ioctl_app N fallocate OFFSET LEN [keep]\n"
+        "       scull_ioctl_app N alloc          (reserve and allocation stalls)\n"
+        "       scull_ioctl_app N spill [QUANTA] (spill the coldest, or show the spills)\n"
+        "       scull_ioctl_app N crc32c|xxh64 [POS [LEN]]  (of the device, or of LEN at POS)\n"
+        "       scull_ioctl_app N find PATTERN [POS [LEN]]  (the offsets where it is)\n"
+        "       scull_ioctl_app N truncate SIZE\n"
+        "       scull_ioctl_app N rewrite [0|1]  (write-only opens overwrite, no trim)\n");
+    exit(1);
+}
+
+static int set_inject(int fd, int argc, char **argv)
+{
+    struct scull_inject in;
+    int i;
+
+    memset(&in, 0, sizeof(in));
+    for (i = 0; i < argc; i++) {
+        char *val = strchr(argv[i], '=');
+
+        if (!val)
+            usage();
+        *val++ = '\0';
+        if (!strcmp(argv[i], "delay")) {
+            if (!strcmp(val, "fixed"))
+                in.delay_mode = SCULL_DELAY_FIXED;
+            else if (!strcmp(val, "uniform"))
+                in.delay_mode = SCULL_DELAY_UNIFORM;
+            else if (!strcmp(val, "pareto"))
+                in.delay_mode = SCULL_DELAY_PARETO;
+            else
+                usage();
+        } else if (!strcmp(argv[i], "us")) {
+            in.delay_us = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "max")) {
+            in.delay_max_us = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "alpha")) {
+            in.pareto_alpha = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "enomem")) {
+            in.enomem_ppm = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "short")) {
+            in.short_ppm = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "seed")) {
+            in.seed = strtoull(val, NULL, 0);
+        } else {
+            usage();
+        }
+    }
+    if (in.delay_mode == SCULL_DELAY_PARETO && !in.pareto_alpha)
+        in.pareto_alpha = 150;
+
+    return ioctl(fd, SCULL_IOC_SET_INJECT, &in);
+}
+
+static int show_inject(int fd)
+{
+    static const char *modes[] = { "none", "fixed", "uniform", "pareto" };
+    struct scull_inject in;
+
+    if (ioctl(fd, SCULL_IOC_GET_INJECT, &in) < 0)
+        return -1;
+    printf("delay %s us %u max %u alpha %u enomem %u short %u seed %llu\n",
+           in.delay_mode <= SCULL_DELAY_PARETO ? modes[in.delay_mode] : "?",
+           in.delay_us, in.delay_max_us, in.pareto_alpha,
+           in.enomem_ppm, in.short_ppm, (unsigned long long)in.seed);
+    printf("delayed %llu total %llu us, enomem %llu, short %llu\n",
+           (unsigned long long)in.delayed, (unsigned long long)in.delay_total_us,
+           (unsigned long long)in.enomem, (unsigned long long)in.short_xfers);
+    return 0;
+}
+
+static int set_mode(int fd, int argc, char **argv)
+{
+    static const char *modes[] = { "bytes", "log", "record", "kv" };
+    int mode;
+
+    if (!argc) {
+        mode = ioctl(fd, SCULL_IOC_GET_MODE);
+        if (mode < 0)
+            return -1;
+        printf("%s\n", mode <= SCULL_MODE_KV ? modes[mode] : "?");
+        return 0;
+    }
+    for (mode = SCULL_MODE_BYTES; mode <= SCULL_MODE_KV; mode++)
+        if (!strcmp(argv[0], modes[mode]))
+            return ioctl(fd, SCULL_IOC_SET_MODE, mode);
+    usage();
+    return -1;
+}
+
+static int kv(int fd, int argc, char **argv)
+{
+    struct scull_kv_op op = { 0 };
+    struct scull_kv_stats st;
+    char *val;
+    int ret;
+
+    if (argc == 1 && !strcmp(argv[0], "stats")) {
+        if (ioctl(fd, SCULL_IOC_KV_STATS, &st) < 0)
+            return -1;
+        printf("items %llu bytes %llu max %llu hits %llu misses %llu evictions %llu expired %llu\n",
+               (unsigned long long)st.items, (unsigned long long)st.bytes,
+               (unsigned long long)st.max_bytes, (unsigned long long)st.hits,
+               (unsigned long long)st.misses, (unsigned long long)st.evictions,
+               (unsigned long long)st.expired);
+        return 0;
+    }
+    if (argc < 2)
+        usage();
+    op.key = (uintptr_t)argv[1];
+    op.klen = strlen(argv[1]);
+
+    if (!strcmp(argv[0], "put") && (argc == 3 || argc == 4)) {
+        op.val = (uintptr_t)argv[2];
+        op.vlen = strlen(argv[2]);
+        op.ttl_ms = argc == 4 ? strtoul(argv[3], NULL, 0) : 0;
+        return ioctl(fd, SCULL_IOC_KV_PUT, &op);
+    }
+    if (!strcmp(argv[0], "del") && argc == 2)
+        return ioctl(fd, SCULL_IOC_KV_DELETE, &op);
+    if (strcmp(argv[0], "get") || argc != 2)
+        usage();
+
+    val = malloc(SCULL_KV_VAL_MAX);
+    if (!val)
+        return -1;
+    op.val = (uintptr_t)val;
+    op.vlen = SCULL_KV_VAL_MAX;
+    ret = ioctl(fd, SCULL_IOC_KV_GET, &op);
+    if (ret == 0)
+        printf("%.*s\n", (int)op.vlen, val);
+    free(val);
+    return ret;
+}
+
+static int fallocate_dev(int fd, int argc, char **argv)
+{
+    struct scull_falloc fa = { 0 };
+
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "keep")))
+        usage();
+    fa.offset = strtoull(argv[0], NULL, 0);
+    fa.len = strtoull(argv[1], NULL, 0);
+    fa.mode = argc == 3 ? SCULL_FALLOC_KEEP_SIZE : 0;
+    return ioctl(fd, SCULL_IOC_FALLOCATE, &fa);
+}
+
+static int show_alloc(int fd)
+{
+    struct scull_allocstat st;
+
+    if (ioctl(fd, SCULL_IOC_GET_ALLOCSTAT, &st) < 0)
+        return -1;
+    printf("reserve %u ready %u hits %llu refills %llu fallocated %llu\n",
+           st.reserve, st.ready, (unsigned long long)st.hits,
+           (unsigned long long)st.refills, (unsigned long long)st.fallocated);
+    printf("stalls %llu total %llu ns max %llu ns\n",
+           (unsigned long long)st.stalls, (unsigned long long)st.stall_ns,
+           (unsigned long long)st.stall_max_ns);
+    return 0;
+}
+
+static int spill(int fd, int argc, char **argv)
+{
+    struct scull_spillstat st;
+    int ret;
+
+    if (argc > 1)
+        usage();
+    if (argc == 1) {
+        ret = ioctl(fd, SCULL_IOC_SPILL, strtoul(argv[0], NULL, 0));
+        if (ret >= 0)
+            printf("spilled %d quanta\n", ret);
+        return ret;
+    }
+    if (ioctl(fd, SCULL_IOC_GET_SPILLSTAT, &st) < 0)
+        return -1;
+    printf("spilled %llu spills %llu errors %llu\n",
+           (unsigned long long)st.spilled, (unsigned long long)st.spills,
+           (unsigned long long)st.errors);
+    printf("refaults %llu total %llu ns max %llu ns\n",
+           (unsigned long long)st.refaults, (unsigned long long)st.refault_ns,
+           (unsigned long long)st.refault_max_ns);
+    return 0;
+}
+
+/* the range of @argc args, POS [LEN], the whole device by default */
+static void range(int argc, char **argv, __u64 *pos, __u64 *len)
+{
+    if (argc > 2)
+        usage();
+    *pos = argc > 0 ? strtoull(argv[0], NULL, 0) : 0;
+    *len = argc > 1 ? strtoull(argv[1], NULL, 0) : ~0ULL;
+}
+
+static int checksum(int fd, __u32 algo, int argc, char **argv)
+{
+    struct scull_csum cs = { .algo = algo };
+
+    range(argc, argv, &cs.pos, &cs.len);
+    if (ioctl(fd, SCULL_IOC_CHECKSUM, &cs) < 0)
+        return -1;
+    if (algo == SCULL_CSUM_CRC32C)
+        printf("%08llx", (unsigned long long)cs.result);
+    else
+        printf("%016llx", (unsigned long long)cs.result);
+    printf(" %llu bytes at %llu\n", (unsigned long long)cs.done,
+           (unsigned long long)cs.pos);
+    return 0;
+}
+
+static int find(int fd, int argc, char **argv)
+{
+    __u64 matches[1024];
+    struct scull_find f = { .max = 1024 };
+    __u64 end;
+    unsigned int i;
+
+    if (argc < 1)
+        usage();
+    f.pattern = (uintptr_t)argv[0];
+    f.pattern_len = strlen(argv[0]);
+    f.matches = (uintptr_t)matches;
+    range(argc - 1, argv + 1, &f.pos, &f.len);
+    end = f.len > ~0ULL - f.pos ? ~0ULL : f.pos + f.len;
+    do {
+        if (ioctl(fd, SCULL_IOC_FIND, &f) < 0)
+            return -1;
+        for (i = 0; i < f.nr; i++)
+            printf("%llu\n", (unsigned long long)matches[i]);
+        /* matches full: go on after the last one */
+        f.len = end - f.next;
+        f.pos = f.next;
+    } while (f.nr == f.max);
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
     char dev_node[SCULL_DEVICE_SIZE];
-    char device_nr = 0;
+    int device_nr = 0;
     int fd;
     int retval;
 
-    if (argc == 2)
+    if (argc >= 2)
         device_nr = atoi(argv[1]);
 
     memset(dev_node, 0, SCULL_DEVICE_SIZE);
-    sprintf(dev_node,"%s%d", SCULL_DEVICE, device_nr);
-    printf("make oops on %s\n", dev_node);
+    snprintf(dev_node, SCULL_DEVICE_SIZE, "%s%d", SCULL_DEVICE, device_nr);
 
     fd = open(dev_node, O_RDWR);
     if (fd < 0){
@@ -50,6 +426,81 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (argc >= 3 && !strcmp(argv[2], "inject")) {
+        retval = set_inject(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_SET_INJECT");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "stats")) {
+        retval = show_inject(fd);
+        if (retval < 0)
+            perror("SCULL_IOC_GET_INJECT");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "mode")) {
+        retval = set_mode(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_SET_MODE");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "kv")) {
+        retval = kv(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_KV");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "fallocate")) {
+        retval = fallocate_dev(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_FALLOCATE");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "alloc")) {
+        retval = show_alloc(fd);
+        if (retval < 0)
+            perror("SCULL_IOC_GET_ALLOCSTAT");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "spill")) {
+        retval = spill(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_SPILL");
+        return retval < 0 ? retval : 0;
+    }
+    if (argc >= 3 && (!strcmp(argv[2], "crc32c") || !strcmp(argv[2], "xxh64"))) {
+        retval = checksum(fd, argv[2][0] == 'c' ? SCULL_CSUM_CRC32C : SCULL_CSUM_XXH64,
+                          argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_CHECKSUM");
+        return retval;
+    }
+    if (argc >= 3 && !strcmp(argv[2], "find")) {
+        retval = find(fd, argc - 3, argv + 3);
+        if (retval < 0)
+            perror("SCULL_IOC_FIND");
+        return retval;
+    }
+    if (argc == 4 && !strcmp(argv[2], "truncate")) {
+        __u64 size = strtoull(argv[3], NULL, 0);
+
+        retval = ioctl(fd, SCULL_IOC_TRUNCATE, &size);
+        if (retval < 0)
+            perror("SCULL_IOC_TRUNCATE");
+        return retval;
+    }
+    if ((argc == 3 || argc == 4) && !strcmp(argv[2], "rewrite")) {
+        retval = ioctl(fd, SCULL_IOC_SET_REWRITE, argc == 4 ? atoi(argv[3]) : 1);
+        if (retval < 0)
+            perror("SCULL_IOC_SET_REWRITE");
+        else
+            printf("rewrite was %d\n", retval);
+        return retval < 0 ? retval : 0;
+    }
+    if (argc > 2)
+        usage();
+
+    printf("make oops on %s\n", dev_node);
     retval = ioctl(fd, SCULL_IOC_MAKE_FAULTY_WRITE,NULL);
 
     return retval;
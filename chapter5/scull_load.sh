@@ -9,16 +9,23 @@ mode="666"
 /sbin/insmod ./$module.ko $* || exit 1
 
 # remove stale nodes
-rm -f /dev/${device}[0-3]
+rm -f /dev/${device}[0-9]* /dev/${device}uid /dev/${device}wuid /dev/${device}priv
 
 # parse the major number dynamic allocated to scull.
 major=$(awk "\$2==\"$module\" {print \$1}" /proc/devices)
+nr_devs=$(cat /sys/module/$module/parameters/scull_nr_devs)
 
-# make device node
-mknod /dev/${device}0 c $major 0
-mknod /dev/${device}1 c $major 1
-mknod /dev/${device}2 c $major 2
-mknod /dev/${device}3 c $major 3
+# make device node, one per minor
+i=0
+while [ $i -lt $nr_devs ]; do
+	mknod /dev/${device}$i c $major $i
+	i=$((i + 1))
+done
+
+# the access-controlled devices follow the bare ones, see access.c
+mknod /dev/${device}uid  c $major $nr_devs
+mknod /dev/${device}wuid c $major $((nr_devs + 1))
+mknod /dev/${device}priv c $major $((nr_devs + 2))
 
 # give appropriate group/permissions, and change the group.
 # not all distributions have staff, some have "wheel" instead.
@@ -26,5 +33,5 @@ mknod /dev/${device}3 c $major 3
 group="staff"
 grep -q '^staff:' /etc/group || group="wheel"
 
-chgrp $group /dev/${device}[0-3]
-chmod $mode /dev/${device}[0-3]
+chgrp $group /dev/${device}[0-9]* /dev/${device}uid /dev/${device}wuid /dev/${device}priv
+chmod $mode /dev/${device}[0-9]* /dev/${device}uid /dev/${device}wuid /dev/${device}priv
@@ -0,0 +1,48 @@
+#! /bin/sh
+# Load time and first-open latency of scull for a growing number of devices.
+# Must run as root, one line per device count goes to stdout:
+#	sudo ./scull_load_time.sh
+#	devs <n> insmod <us> registered <us> open scull<n-1> first <us> again <us> kernel <ns>
+#
+# insmod and the opens are timed from the shell, so they include the fork
+# and exec of the tools; "registered" is the time scull_init_module
+# reports, and "kernel" what the first open spent setting the device up
+# (from /proc/scullmem).
+module="scull"
+device="scull"
+counts=${COUNTS:-"4 1000 10000"}
+
+now_us() {
+	echo $(($(date +%s%N) / 1000))
+}
+
+for n in $counts; do
+	/sbin/rmmod $module 2>/dev/null
+	rm -f /dev/${device}[0-9]*
+
+	t0=$(now_us)
+	/sbin/insmod ./$module.ko scull_nr_devs=$n || exit 1
+	t1=$(now_us)
+	registered=$(dmesg | grep "scull: $n devices registered in" | tail -1 |
+		sed 's/.* in \([0-9]*\) us/\1/')
+	major=$(awk "\$2==\"$module\" {print \$1}" /proc/devices)
+
+	# only the last device gets a node: it is as far as it gets from scull0
+	last=$((n - 1))
+	mknod /dev/${device}$last c $major $last
+
+	t2=$(now_us)
+	dd if=/dev/${device}$last of=/dev/null count=0 2>/dev/null
+	t3=$(now_us)
+	dd if=/dev/${device}$last of=/dev/null count=0 2>/dev/null
+	t4=$(now_us)
+	kernel=$(grep "^${device}$last:" /proc/scullmem 2>/dev/null |
+		sed 's/.* open \([0-9]*\)ns/\1/')
+
+	echo "devs $n insmod $((t1 - t0))us registered ${registered:-?}us" \
+		"open ${device}$last first $((t3 - t2))us again $((t4 - t3))us" \
+		"kernel ${kernel:-?}ns"
+done
+
+/sbin/rmmod $module
+rm -f /dev/${device}[0-9]*
@@ -0,0 +1,667 @@
+/*
+ * scull_replay: capture the reads and writes of a scull device, and play
+ * them back
+ *
+ *   scull_replay record [-d dev] [-n records] [-T secs] -o trace
+ *	gives the device a ring of records (SCULL_IOC_IOTRACE, see
+ *	iotrace.c) and drains it to the file until the time is up or ^C.
+ *   scull_replay replay [-d dev] [-x speed | -f] [-N] [-o trace] trace
+ *	issues the reads and writes of the trace on the device again, with
+ *	one thread per thread of the trace, each call at the time it came
+ *	in (-x: that many times faster) or as fast as they go (-f). The
+ *	device is emptied first, unless -N. -o captures the replay itself
+ *	as the kernel saw it, to be compared with the replay on another
+ *	build of the module.
+ *   scull_replay stat trace [trace2]
+ *	latency percentiles per operation of a trace, or of two side by
+ *	side. These are the times measured in the kernel, the same for a
+ *	capture and for the -o of a replay.
+ *
+ * example, before and after a change of the module:
+ *   ./scull_replay record -d /dev/scull0 -T 60 -o prod.trace
+ *   ./scull_replay replay -d /dev/scull1 -o old.trace prod.trace
+ *   (load the new module)
+ *   ./scull_replay replay -d /dev/scull1 -o new.trace prod.trace
+ *   ./scull_replay stat old.trace new.trace
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+
+#define SCULL_DEVICE "/dev/scull0"
+
+/* same as in scull.h */
+#define SCULL_OP_READ       1
+#define SCULL_OP_WRITE      2
+
+#define SCULL_IOTRACE_MAX   (1U << 20)
+
+struct scull_iotrace_rec {
+    __u64 ts_ns;
+    __u64 pos;
+    __u32 len;
+    __s32 result;
+    __u32 lat_ns;
+    __u32 wait_ns;
+    __u32 pid;
+    __u8 op;
+    __u8 pad[3];
+};
+
+struct scull_iotrace_read {
+    __u64 buf;
+    __u32 nr;
+    __u32 got;
+    __u64 lost;
+};
+
+#define SCULL_IOC_MAGIC        'c'
+#define SCULL_IOC_IOTRACE      _IO(SCULL_IOC_MAGIC, 17)
+#define SCULL_IOC_IOTRACE_READ _IOWR(SCULL_IOC_MAGIC, 18, struct scull_iotrace_read)
+
+/* a trace file: this header, then the records as the ring gave them */
+#define TRACE_MAGIC "SCULLIOT"
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;       /* 1 */
+    uint32_t rec_size;      /* sizeof(struct scull_iotrace_rec) */
+    uint64_t lost;          /* records the ring had to drop */
+};
+
+#define DRAIN_RECS      4096
+#define DRAIN_MS        50
+#define MAX_THREADS     256
+#define MAX_LEN         (64 << 20)  /* longer calls are cut to this */
+#define LATE_NS         1000000     /* behind the schedule by more is late */
+
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts = { .tv_sec = t / 1000000000ULL, .tv_nsec = t % 1000000000ULL };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: scull_replay record [-d dev] [-n records] [-T secs] -o trace\n"
+        "       scull_replay replay [-d dev] [-x speed | -f] [-N] [-o trace] trace\n"
+        "       scull_replay stat trace [trace2]\n"
+        "  -d dev      device (" SCULL_DEVICE ")\n"
+        "  -n records  of the ring, a power of 2 (65536)\n"
+        "  -T secs     capture for so long (until ^C)\n"
+        "  -x speed    replay that many times faster (1)\n"
+        "  -f          replay as fast as the calls go\n"
+        "  -N          do not empty the device before the replay\n"
+        "  -o trace    where the capture goes; for replay, capture it\n");
+    exit(2);
+}
+
+/* trace files */
+
+static FILE *trace_create(const char *path)
+{
+    struct trace_header h = { .version = 1, .rec_size = sizeof(struct scull_iotrace_rec) };
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    fwrite(&h, sizeof(h), 1, f);
+    return f;
+}
+
+static void trace_finish(FILE *f, const char *path, uint64_t lost)
+{
+    struct trace_header h = { .version = 1, .rec_size = sizeof(struct scull_iotrace_rec),
+                              .lost = lost };
+
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    if (fseek(f, 0, SEEK_SET) || fwrite(&h, sizeof(h), 1, f) != 1 || fclose(f)) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static int rec_cmp_ts(const void *a, const void *b)
+{
+    const struct scull_iotrace_rec *x = a, *y = b;
+
+    return x->ts_ns < y->ts_ns ? -1 : x->ts_ns > y->ts_ns;
+}
+
+/* the records of @path in the order the calls came in */
+static struct scull_iotrace_rec *trace_load(const char *path, size_t *nr, uint64_t *lost)
+{
+    struct scull_iotrace_rec *recs;
+    struct trace_header h;
+    FILE *f = fopen(path, "r");
+    long size;
+
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+        h.version != 1 || h.rec_size != sizeof(*recs)) {
+        fprintf(stderr, "%s: not a scull trace\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - (long)sizeof(h);
+    fseek(f, sizeof(h), SEEK_SET);
+    *nr = size / sizeof(*recs);
+    recs = malloc((*nr ? *nr : 1) * sizeof(*recs));
+    if (!recs || fread(recs, sizeof(*recs), *nr, f) != *nr) {
+        fprintf(stderr, "%s: cannot read the records\n", path);
+        exit(1);
+    }
+    fclose(f);
+    qsort(recs, *nr, sizeof(*recs), rec_cmp_ts);
+    *lost = h.lost;
+    return recs;
+}
+
+/*
+ * Take what is in the ring of @fd to @out. Returns the records taken, or
+ * -1; *@lost is what the ring dropped so far.
+ */
+static long drain(int fd, FILE *out, struct scull_iotrace_rec *buf, uint64_t *lost)
+{
+    struct scull_iotrace_read rd;
+    long n = 0;
+
+    do {
+        rd.buf = (uintptr_t)buf;
+        rd.nr = DRAIN_RECS;
+        rd.got = 0;
+        if (ioctl(fd, SCULL_IOC_IOTRACE_READ, &rd) < 0)
+            return -1;
+        fwrite(buf, sizeof(*buf), rd.got, out);
+        n += rd.got;
+        *lost = rd.lost;
+    } while (rd.got == DRAIN_RECS);
+    return n;
+}
+
+/* a ring for @fd, drained to @path by a thread until capture_stop() */
+struct capture {
+    int fd;
+    const char *path;
+    FILE *out;
+    uint64_t recs;
+    uint64_t lost;
+    pthread_t tid;
+    volatile int done;
+};
+
+static void *capture_main(void *arg)
+{
+    struct capture *c = arg;
+    struct scull_iotrace_rec *buf = malloc(DRAIN_RECS * sizeof(*buf));
+    long n;
+
+    if (!buf) {
+        fprintf(stderr, "scull_replay: out of memory\n");
+        exit(1);
+    }
+    for (;;) {
+        int last = c->done;
+
+        n = drain(c->fd, c->out, buf, &c->lost);
+        if (n < 0) {
+            perror("SCULL_IOC_IOTRACE_READ");
+            exit(1);
+        }
+        c->recs += n;
+        if (last)
+            break;
+        usleep(DRAIN_MS * 1000);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void capture_start(struct capture *c, const char *dev, const char *path,
+                          unsigned long ring)
+{
+    memset(c, 0, sizeof(*c));
+    c->path = path;
+    /* not O_WRONLY, which empties the device */
+    c->fd = open(dev, O_RDONLY);
+    if (c->fd < 0) {
+        perror(dev);
+        exit(1);
+    }
+    if (ioctl(c->fd, SCULL_IOC_IOTRACE, ring) < 0) {
+        perror("SCULL_IOC_IOTRACE");
+        exit(1);
+    }
+    c->out = trace_create(path);
+    if (pthread_create(&c->tid, NULL, capture_main, c)) {
+        fprintf(stderr, "scull_replay: cannot start the capture\n");
+        exit(1);
+    }
+}
+
+static void capture_stop(struct capture *c)
+{
+    c->done = 1;
+    pthread_join(c->tid, NULL);
+    ioctl(c->fd, SCULL_IOC_IOTRACE, 0UL);
+    close(c->fd);
+    trace_finish(c->out, c->path, c->lost);
+}
+
+static int cmd_record(int argc, char **argv)
+{
+    const char *dev = SCULL_DEVICE, *out = NULL;
+    unsigned long ring = 65536;
+    double secs = 0;
+    struct capture c;
+    uint64_t end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:T:o:")) != -1) {
+        switch (opt) {
+        case 'd': dev = optarg; break;
+        case 'n': ring = strtoul(optarg, NULL, 0); break;
+        case 'T': secs = atof(optarg); break;
+        case 'o': out = optarg; break;
+        default: usage();
+        }
+    }
+    if (!out || optind != argc)
+        usage();
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    capture_start(&c, dev, out, ring);
+    end = secs > 0 ? now_ns() + (uint64_t)(secs * 1e9) : 0;
+    while (!stop && (!end || now_ns() < end))
+        usleep(DRAIN_MS * 1000);
+    capture_stop(&c);
+
+    printf("%llu records, %llu lost\n", (unsigned long long)c.recs,
+           (unsigned long long)c.lost);
+    return 0;
+}
+
+/* replay */
+
+struct player {
+    int id;
+    size_t *ops;            /* indexes into recs, in order */
+    size_t nr;
+    size_t len;             /* of the longest call */
+};
+
+static struct {
+    const char *dev;
+    struct scull_iotrace_rec *recs;
+    size_t nr;
+    uint64_t *lat;          /* of each record, as replayed */
+    int64_t *result;
+    uint64_t *behind;       /* of the schedule, when it was issued */
+    double speed;           /* 0: as fast as possible */
+    uint64_t base;          /* when the first record is replayed */
+    pthread_barrier_t barrier;
+} rp = { .dev = SCULL_DEVICE, .speed = 1 };
+
+static void *player_main(void *arg)
+{
+    struct player *p = arg;
+    struct scull_iotrace_rec *r;
+    uint64_t t, t0 = rp.recs[0].ts_ns;
+    size_t i, k, len;
+    ssize_t ret;
+    char *buf;
+    int fd;
+
+    fd = open(rp.dev, O_RDWR);
+    if (fd < 0) {
+        perror(rp.dev);
+        exit(1);
+    }
+    buf = malloc(p->len ? p->len : 1);
+    if (!buf) {
+        fprintf(stderr, "scull_replay: out of memory\n");
+        exit(1);
+    }
+    memset(buf, 'a' + p->id % 26, p->len);
+
+    pthread_barrier_wait(&rp.barrier);
+    for (k = 0; k < p->nr; k++) {
+        i = p->ops[k];
+        r = &rp.recs[i];
+        if (rp.speed) {
+            t = rp.base + (uint64_t)((r->ts_ns - t0) / rp.speed);
+            sleep_until(t);
+            rp.behind[i] = now_ns() - t;
+        }
+        len = r->len < MAX_LEN ? r->len : MAX_LEN;
+        t = now_ns();
+        if (r->op == SCULL_OP_READ)
+            ret = pread(fd, buf, len, r->pos);
+        else
+            ret = pwrite(fd, buf, len, r->pos);
+        rp.lat[i] = now_ns() - t;
+        rp.result[i] = ret < 0 ? -errno : ret;
+    }
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* the @pct percentile of the @n sorted values of @v */
+static uint64_t pctl(const uint64_t *v, size_t n, double pct)
+{
+    size_t i = (size_t)(pct / 100 * n);
+
+    return n ? v[i < n ? i : n - 1] : 0;
+}
+
+static void print_lat(const char *name, uint64_t *v, size_t n)
+{
+    qsort(v, n, sizeof(*v), u64_cmp);
+    printf("  %-5s %8zu ops  p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu ns\n",
+           name, n, (unsigned long long)pctl(v, n, 50), (unsigned long long)pctl(v, n, 90),
+           (unsigned long long)pctl(v, n, 99), (unsigned long long)pctl(v, n, 99.9),
+           (unsigned long long)(n ? v[n - 1] : 0));
+}
+
+static int pid_cmp(const void *a, const void *b)
+{
+    uint32_t x = rp.recs[*(const size_t *)a].pid, y = rp.recs[*(const size_t *)b].pid;
+
+    if (x != y)
+        return x < y ? -1 : 1;
+    /* the order of the calls within a thread */
+    return *(const size_t *)a < *(const size_t *)b ? -1 : 1;
+}
+
+static int cmd_replay(int argc, char **argv)
+{
+    struct player players[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    const char *out = NULL;
+    uint64_t lost, start, secs_ns, late = 0, max_behind = 0;
+    uint64_t *lr, *lw;
+    size_t *order, i, j, nr_r = 0, nr_w = 0, errors = 0, differ = 0;
+    int opt, trim = 1, nr_players = 0, fd;
+    struct capture c;
+    unsigned long ring;
+
+    while ((opt = getopt(argc, argv, "d:x:fNo:")) != -1) {
+        switch (opt) {
+        case 'd': rp.dev = optarg; break;
+        case 'x': rp.speed = atof(optarg); break;
+        case 'f': rp.speed = 0; break;
+        case 'N': trim = 0; break;
+        case 'o': out = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || rp.speed < 0)
+        usage();
+    rp.recs = trace_load(argv[optind], &rp.nr, &lost);
+    if (!rp.nr) {
+        fprintf(stderr, "%s: no records\n", argv[optind]);
+        return 1;
+    }
+    if (lost)
+        fprintf(stderr, "scull_replay: the capture lost %llu records\n",
+                (unsigned long long)lost);
+    rp.lat = calloc(rp.nr, sizeof(*rp.lat));
+    rp.result = calloc(rp.nr, sizeof(*rp.result));
+    rp.behind = calloc(rp.nr, sizeof(*rp.behind));
+    order = malloc(rp.nr * sizeof(*order));
+    if (!rp.lat || !rp.result || !rp.behind || !order) {
+        fprintf(stderr, "scull_replay: out of memory\n");
+        return 1;
+    }
+
+    /* a player per thread of the trace, the last ones shared if too many */
+    for (i = 0; i < rp.nr; i++)
+        order[i] = i;
+    qsort(order, rp.nr, sizeof(*order), pid_cmp);
+    memset(players, 0, sizeof(players));
+    for (i = 0; i < rp.nr; i = j) {
+        struct player *p = &players[nr_players < MAX_THREADS ? nr_players : MAX_THREADS - 1];
+
+        for (j = i; j < rp.nr && rp.recs[order[j]].pid == rp.recs[order[i]].pid; j++)
+            ;
+        if (p->ops) {
+            /* merged: back in the order of the calls */
+            p->ops = realloc(p->ops, (p->nr + j - i) * sizeof(size_t));
+            memcpy(p->ops + p->nr, order + i, (j - i) * sizeof(size_t));
+            p->nr += j - i;
+            qsort(p->ops, p->nr, sizeof(size_t), u64_cmp);
+        } else {
+            p->id = nr_players;
+            p->ops = malloc((j - i) * sizeof(size_t));
+            memcpy(p->ops, order + i, (j - i) * sizeof(size_t));
+            p->nr = j - i;
+            nr_players++;
+        }
+        for (; i < j; i++)
+            if (rp.recs[order[i]].len > p->len)
+                p->len = rp.recs[order[i]].len < MAX_LEN ? rp.recs[order[i]].len : MAX_LEN;
+    }
+    if (nr_players > MAX_THREADS)
+        nr_players = MAX_THREADS;
+
+    if (trim) {
+        /* scull empties a device opened write-only */
+        fd = open(rp.dev, O_WRONLY);
+        if (fd < 0) {
+            perror(rp.dev);
+            return 1;
+        }
+        close(fd);
+    }
+    if (out) {
+        for (ring = 4096; ring < rp.nr && ring < SCULL_IOTRACE_MAX; ring <<= 1)
+            ;
+        capture_start(&c, rp.dev, out, ring);
+    }
+
+    pthread_barrier_init(&rp.barrier, NULL, nr_players + 1);
+    for (i = 0; i < (size_t)nr_players; i++)
+        pthread_create(&tids[i], NULL, player_main, &players[i]);
+    /* the players have opened the device */
+    rp.base = now_ns() + 10000000;
+    pthread_barrier_wait(&rp.barrier);
+    start = now_ns();
+    for (i = 0; i < (size_t)nr_players; i++)
+        pthread_join(tids[i], NULL);
+    secs_ns = now_ns() - start;
+    if (out)
+        capture_stop(&c);
+
+    lr = malloc(rp.nr * sizeof(*lr));
+    lw = malloc(rp.nr * sizeof(*lw));
+    if (!lr || !lw) {
+        fprintf(stderr, "scull_replay: out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < rp.nr; i++) {
+        if (rp.result[i] < 0)
+            errors++;
+        if (rp.result[i] != rp.recs[i].result)
+            differ++;
+        if (rp.behind[i] > LATE_NS)
+            late++;
+        if (rp.behind[i] > max_behind)
+            max_behind = rp.behind[i];
+        if (rp.recs[i].op == SCULL_OP_READ)
+            lr[nr_r++] = rp.lat[i];
+        else
+            lw[nr_w++] = rp.lat[i];
+    }
+
+    printf("%s: %zu calls by %d threads in %.3f s (captured in %.3f s), %zu errors, "
+           "%zu results not as captured\n",
+           rp.dev, rp.nr, nr_players, secs_ns / 1e9,
+           (rp.recs[rp.nr - 1].ts_ns - rp.recs[0].ts_ns) / 1e9, errors, differ);
+    if (rp.speed)
+        printf("  %llu calls late by more than 1 ms, at most %.3f ms\n",
+               (unsigned long long)late, max_behind / 1e6);
+    printf("  latency seen by the replay:\n");
+    print_lat("read", lr, nr_r);
+    print_lat("write", lw, nr_w);
+    if (out)
+        printf("  %llu records captured to %s, %llu lost\n", (unsigned long long)c.recs,
+               out, (unsigned long long)c.lost);
+    return errors ? 1 : 0;
+}
+
+/* stat */
+
+struct op_lat {
+    size_t n, errors;
+    uint64_t *lat, *wait;
+};
+
+static void op_lat_load(const char *path, struct op_lat ol[2])
+{
+    struct scull_iotrace_rec *recs;
+    uint64_t lost;
+    size_t nr, i;
+    int k;
+
+    recs = trace_load(path, &nr, &lost);
+    for (k = 0; k < 2; k++) {
+        memset(&ol[k], 0, sizeof(ol[k]));
+        ol[k].lat = malloc((nr ? nr : 1) * sizeof(uint64_t));
+        ol[k].wait = malloc((nr ? nr : 1) * sizeof(uint64_t));
+        if (!ol[k].lat || !ol[k].wait) {
+            fprintf(stderr, "scull_replay: out of memory\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nr; i++) {
+        struct op_lat *o = &ol[recs[i].op == SCULL_OP_WRITE];
+
+        if (recs[i].result < 0)
+            o->errors++;
+        o->lat[o->n] = recs[i].lat_ns;
+        o->wait[o->n++] = recs[i].wait_ns;
+    }
+    for (k = 0; k < 2; k++) {
+        qsort(ol[k].lat, ol[k].n, sizeof(uint64_t), u64_cmp);
+        qsort(ol[k].wait, ol[k].n, sizeof(uint64_t), u64_cmp);
+    }
+    printf("%s: %zu records, %llu lost\n", path, nr, (unsigned long long)lost);
+    free(recs);
+}
+
+static const double stat_pcts[] = { 50, 90, 99, 99.9, 100 };
+#define NR_PCTS (sizeof(stat_pcts) / sizeof(stat_pcts[0]))
+
+static void stat_line(const char *name, const char *which, const struct op_lat *o,
+                      const uint64_t *v)
+{
+    size_t i;
+
+    printf("%-6s%-7s%9zu%7zu", name, which, o->n, o->errors);
+    for (i = 0; i < NR_PCTS; i++)
+        printf("%11llu", (unsigned long long)pctl(v, o->n, stat_pcts[i]));
+    printf("\n");
+}
+
+static void stat_diff(const struct op_lat *a, const struct op_lat *b)
+{
+    uint64_t x, y;
+    size_t i;
+
+    printf("%-6s%-7s%16s", "", "b/a", "");
+    for (i = 0; i < NR_PCTS; i++) {
+        x = pctl(a->lat, a->n, stat_pcts[i]);
+        y = pctl(b->lat, b->n, stat_pcts[i]);
+        if (x)
+            printf("%+10.1f%%", (double)y * 100 / x - 100);
+        else
+            printf("%11s", "-");
+    }
+    printf("\n");
+}
+
+static int cmd_stat(int argc, char **argv)
+{
+    static const char *names[2] = { "read", "write" };
+    struct op_lat a[2], b[2];
+    int k, two = argc == 3;
+
+    if (argc != 2 && argc != 3)
+        usage();
+    op_lat_load(argv[1], a);
+    if (two)
+        op_lat_load(argv[2], b);
+
+    printf("%-13s%9s%7s%11s%11s%11s%11s%11s  (ns, in the kernel)\n",
+           "", "calls", "errors", "p50", "p90", "p99", "p99.9", "max");
+    for (k = 0; k < 2; k++) {
+        stat_line(names[k], two ? "a" : "", &a[k], a[k].lat);
+        if (two) {
+            stat_line("", "b", &b[k], b[k].lat);
+            stat_diff(&a[k], &b[k]);
+        }
+        stat_line("", two ? "wait a" : "wait", &a[k], a[k].wait);
+        if (two)
+            stat_line("", "wait b", &b[k], b[k].wait);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        usage();
+    if (!strcmp(argv[1], "record"))
+        return cmd_record(argc - 1, argv + 1);
+    if (!strcmp(argv[1], "replay"))
+        return cmd_replay(argc - 1, argv + 1);
+    if (!strcmp(argv[1], "stat"))
+        return cmd_stat(argc - 1, argv + 1);
+    usage();
+    return 2;
+}
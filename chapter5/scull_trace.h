@@ -0,0 +1,167 @@
+/*
+ * Tracepoints of the scull device.
+ *
+ * Enable them with
+ *	echo 1 > /sys/kernel/debug/tracing/events/scull/enable
+ * or record them with "perf record -e 'scull:*'".
+ * When they are disabled every call site is a patched-out branch.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM scull
+
+#if !defined(_SCULL_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _SCULL_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/*
+ * @dev: index of the device
+ * @pos: file position before the call
+ * @count: bytes asked by the caller
+ * @item: quantum set (list item) the position falls in, -1 if not reached
+ * @s_pos: quantum in that quantum set, -1 if not reached
+ * @wait_ns: time spent waiting for dev->sem
+ * @ret: return value of the call
+ */
+DECLARE_EVENT_CLASS(scull_rw,
+
+	TP_PROTO(int dev, loff_t pos, size_t count, s64 item, int s_pos,
+		 u64 wait_ns, ssize_t ret),
+
+	TP_ARGS(dev, pos, count, item, s_pos, wait_ns, ret),
+
+	TP_STRUCT__entry(
+		__field(int,		dev)
+		__field(loff_t,		pos)
+		__field(size_t,		count)
+		__field(s64,		item)
+		__field(int,		s_pos)
+		__field(u64,		wait_ns)
+		__field(ssize_t,	ret)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= dev;
+		__entry->pos		= pos;
+		__entry->count		= count;
+		__entry->item		= item;
+		__entry->s_pos		= s_pos;
+		__entry->wait_ns	= wait_ns;
+		__entry->ret		= ret;
+	),
+
+	TP_printk("scull%d pos=%lld count=%zu item=%lld s_pos=%d wait=%lluns ret=%zd",
+		  __entry->dev, __entry->pos, __entry->count, __entry->item,
+		  __entry->s_pos, __entry->wait_ns, __entry->ret)
+);
+
+DEFINE_EVENT(scull_rw, scull_read,
+
+	TP_PROTO(int dev, loff_t pos, size_t count, s64 item, int s_pos,
+		 u64 wait_ns, ssize_t ret),
+
+	TP_ARGS(dev, pos, count, item, s_pos, wait_ns, ret)
+);
+
+DEFINE_EVENT(scull_rw, scull_write,
+
+	TP_PROTO(int dev, loff_t pos, size_t count, s64 item, int s_pos,
+		 u64 wait_ns, ssize_t ret),
+
+	TP_ARGS(dev, pos, count, item, s_pos, wait_ns, ret)
+);
+
+/*
+ * scull_follow() had to add the quantum set of item @item.
+ * Lookups which find it already there are not traced.
+ */
+TRACE_EVENT(scull_follow,
+
+	TP_PROTO(int dev, u64 item, int added),
+
+	TP_ARGS(dev, item, added),
+
+	TP_STRUCT__entry(
+		__field(int,	dev)
+		__field(u64,	item)
+		__field(int,	added)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dev;
+		__entry->item	= item;
+		__entry->added	= added;
+	),
+
+	TP_printk("scull%d item=%llu added=%d",
+		  __entry->dev, __entry->item, __entry->added)
+);
+
+/* @what is one of SCULL_ALLOC_* in scull.h */
+TRACE_EVENT(scull_alloc,
+
+	TP_PROTO(int dev, int what, s64 item, int s_pos, size_t size, bool ok),
+
+	TP_ARGS(dev, what, item, s_pos, size, ok),
+
+	TP_STRUCT__entry(
+		__field(int,	dev)
+		__field(int,	what)
+		__field(s64,	item)
+		__field(int,	s_pos)
+		__field(size_t,	size)
+		__field(bool,	ok)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dev;
+		__entry->what	= what;
+		__entry->item	= item;
+		__entry->s_pos	= s_pos;
+		__entry->size	= size;
+		__entry->ok	= ok;
+	),
+
+	TP_printk("scull%d %s item=%lld s_pos=%d size=%zu%s",
+		  __entry->dev,
+		  __print_symbolic(__entry->what,
+				   { SCULL_ALLOC_QSET,		"qset" },
+				   { SCULL_ALLOC_DATA,		"data" },
+				   { SCULL_ALLOC_QUANTUM,	"quantum" },
+				   { SCULL_ALLOC_EXTENT,	"extent" }),
+		  __entry->item, __entry->s_pos, __entry->size,
+		  __entry->ok ? "" : " failed")
+);
+
+TRACE_EVENT(scull_trim,
+
+	TP_PROTO(int dev, loff_t size, unsigned long qsets, unsigned long quanta),
+
+	TP_ARGS(dev, size, qsets, quanta),
+
+	TP_STRUCT__entry(
+		__field(int,		dev)
+		__field(loff_t,		size)
+		__field(unsigned long,	qsets)
+		__field(unsigned long,	quanta)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dev;
+		__entry->size	= size;
+		__entry->qsets	= qsets;
+		__entry->quanta	= quanta;
+	),
+
+	TP_printk("scull%d size=%lld qsets=%lu quanta=%lu",
+		  __entry->dev, __entry->size, __entry->qsets, __entry->quanta)
+);
+
+#endif /* _SCULL_TRACE_H_ */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE scull_trace
+#include <trace/define_trace.h>
@@ -5,4 +5,4 @@ device="scull"
 /sbin/rmmod $module
 
 # remove stale nodes
-rm -f /dev/${device}[0-3]
+rm -f /dev/${device}[0-9]* /dev/${device}uid /dev/${device}wuid /dev/${device}priv
@@ -0,0 +1,384 @@
+/*
+ * spill.c -- spilling cold quanta to a backing file
+ *
+ * The quanta are kernel memory the kernel cannot reclaim. With a file
+ * named by the scull_spill parameter, a shrinker writes the quanta of
+ * the quantum sets nobody used lately to it and frees them: memory
+ * pressure then costs the devices speed instead of ending in the OOM
+ * killer. A read or a write meeting a spilled quantum reads it back
+ * first (a refault), the caller sees nothing else.
+ *
+ * The file is cut in slots of one quantum, handed out by an IDA and
+ * given back when the quantum is read back or trimmed. dptr->data[j] of
+ * a spilled quantum holds its slot plus one, so as not to be NULL, and
+ * bit j of dptr->spilled is set, see scull_spilled(). The quanta of
+ * an extent are spilled one by one and the extent freed; they come back
+ * as single quanta.
+ *
+ * Which quanta are cold is found as the kernel does for its pages, with
+ * a clock: a read or a write through a quantum set marks it referenced,
+ * the hand of the device goes round the quantum sets clearing the mark,
+ * and those still clear when it comes back are spilled. Only devices in
+ * byte and record mode are spilled: in log mode the appenders copy into
+ * their quanta without dev->sem.
+ *
+ * Everything but the shrinker is called with dev->sem held, and is built
+ * in user space too, where the fuzzer spills and refaults at will.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/mm.h>       /* kvfree() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/fs.h>       /* filp_open(), kernel_read(), kernel_write() */
+#include <linux/fcntl.h>
+#include <linux/err.h>
+#include <linux/idr.h>
+#include <linux/bitops.h>
+#include <linux/mutex.h>
+#include <linux/sched/mm.h> /* memalloc_nofs_save() */
+#include <linux/shrinker.h>
+#include <linux/ktime.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/version.h>
+#else
+#include "scull_user.h"
+#endif
+
+#include "scull.h"
+
+static struct file *scull_spill_filp;
+static int scull_spill_slot_size;   /* bytes of a slot, the quanta fit in it */
+static DEFINE_IDA(scull_spill_ida);
+
+/* spill to @path from now on, in slots of @slot_size bytes */
+int scull_spill_open(const char *path, int slot_size)
+{
+	struct file *filp;
+
+	filp = filp_open(path, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+	scull_spill_filp = filp;
+	scull_spill_slot_size = slot_size;
+	return 0;
+}
+
+/* no more spills; the slots are given back by trimming the devices */
+void scull_spill_close(void)
+{
+	if (scull_spill_filp)
+		filp_close(scull_spill_filp, NULL);
+	scull_spill_filp = NULL;
+}
+
+static inline int scull_spill_slot(const void *q)
+{
+	return (unsigned long)q - 1;
+}
+
+/* write (@out) or read @len bytes of slot @slot */
+static int scull_spill_io(int slot, void *buf, int len, bool out)
+{
+	loff_t pos = (loff_t)slot * scull_spill_slot_size;
+	ssize_t ret;
+
+	if (out)
+		ret = kernel_write(scull_spill_filp, buf, len, &pos);
+	else
+		ret = kernel_read(scull_spill_filp, buf, len, &pos);
+	if (ret == len)
+		return 0;
+	return ret < 0 ? ret : -EIO;
+}
+
+/* a quantum dropped by scull_trim() */
+void scull_spill_drop(void *q)
+{
+	ida_free(&scull_spill_ida, scull_spill_slot(q));
+}
+
+/* write quantum @q to a slot, which replaces it as quantum @j of @dptr */
+static int scull_spill_out(struct scull_dev *dev, struct scull_qset *dptr,
+		int j, void *q)
+{
+	int slot, retval;
+
+	slot = ida_alloc(&scull_spill_ida, GFP_KERNEL);
+	if (slot < 0)
+		return slot;
+	retval = scull_spill_io(slot, q, dev->quantum, true);
+	if (retval) {
+		ida_free(&scull_spill_ida, slot);
+		return retval;
+	}
+	dptr->data[j] = (void *)((unsigned long)slot + 1);
+	__set_bit(j, dptr->spilled);
+	return 0;
+}
+
+/*
+ * Spill the quanta of @dptr, up to *@budget of them (an extent is
+ * spilled whole, and may go past it), which is counted down.
+ */
+static int scull_spill_qset(struct scull_dev *dev, struct scull_qset *dptr,
+		unsigned long *budget)
+{
+	int j, k, n, retval = 0;
+	char *q;
+
+	if (!dptr->spilled) {
+		dptr->spilled = kcalloc(BITS_TO_LONGS(dev->qset), sizeof(long),
+				GFP_KERNEL);
+		if (!dptr->spilled)
+			return -ENOMEM;
+	}
+
+	for (j = 0; j < dev->qset && *budget; j += n) {
+		q = dptr->data[j];
+		n = 1;
+		if (!q || scull_spilled(dptr, j))
+			continue;
+		if (dptr->extent && dptr->extent[j])
+			n = dptr->extent[j];
+
+		/* the last quantum first: @q finds the others until the end */
+		for (k = n - 1; k >= 0; k--) {
+			retval = scull_spill_out(dev, dptr, j + k,
+					q + (size_t)k * dev->quantum);
+			if (retval)
+				break;
+		}
+		if (retval) {
+			/* put back those written already */
+			for (k++; k < n; k++) {
+				scull_spill_drop(dptr->data[j + k]);
+				__clear_bit(j + k, dptr->spilled);
+				dptr->data[j + k] = q + (size_t)k * dev->quantum;
+			}
+			dev->spill.errors++;
+			return retval;
+		}
+
+		if (n > 1) {
+			kvfree(q);
+			dptr->extent[j] = 0;
+			dev->nr_extents--;
+		} else {
+			kfree(q);
+		}
+		dev->nr_spilled += n;
+		dev->spill.spills += n;
+		*budget -= min_t(unsigned long, *budget, n);
+	}
+	return 0;
+}
+
+/*
+ * Spill about @nr quanta of @dev, the coldest ones as the clock sees
+ * them. Returns how many were spilled.
+ */
+unsigned long scull_spill_dev(struct scull_dev *dev, unsigned long nr)
+{
+	unsigned long budget = nr, spilled = dev->nr_spilled;
+	struct scull_qset *dptr;
+	u64 n = dev->spill_hand;
+	int laps = 0;
+
+	if (!scull_spill_filp || dev->quantum > scull_spill_slot_size)
+		return 0;
+	if (dev->mode != SCULL_MODE_BYTES && dev->mode != SCULL_MODE_RECORD)
+		return 0;
+
+	/*
+	 * Up to the end from the hand, then twice round: once to clear the
+	 * marks, once more to find them still clear.
+	 */
+	while (budget) {
+		dptr = scull_next_qset(dev, &n);
+		if (!dptr) {
+			if (++laps > 2)
+				break;
+			n = 0;
+			continue;
+		}
+		if (dptr->referenced)
+			dptr->referenced = false;
+		else if (dptr->data && scull_spill_qset(dev, dptr, &budget))
+			break;
+		n++;
+	}
+	dev->spill_hand = n;
+	return dev->nr_spilled - spilled;
+}
+
+/*
+ * Read back quantum @s_pos of @dptr from the file, for a read or a write
+ * of it. The time it takes is what such a read pays for the spill.
+ */
+int scull_spill_in(struct scull_dev *dev, struct scull_qset *dptr, int s_pos)
+{
+	struct scull_spillstat *st = &dev->spill;
+	int slot = scull_spill_slot(dptr->data[s_pos]);
+	u64 start = ktime_get_ns(), ns;
+	void *q;
+	int retval;
+
+	q = kmalloc(dev->quantum, GFP_KERNEL);
+	if (!q)
+		return -ENOMEM;
+	retval = scull_spill_io(slot, q, dev->quantum, false);
+	if (retval) {
+		kfree(q);
+		st->errors++;
+		return retval;
+	}
+	ida_free(&scull_spill_ida, slot);
+	dptr->data[s_pos] = q;
+	__clear_bit(s_pos, dptr->spilled);
+	dev->nr_spilled--;
+
+	ns = ktime_get_ns() - start;
+	st->refaults++;
+	st->refault_ns += ns;
+	if (ns > st->refault_max_ns)
+		st->refault_max_ns = ns;
+	dev->refault_hist[scull_lat_bucket(ns)]++;
+	return 0;
+}
+
+#ifdef __KERNEL__
+/*
+ * The shrinker. It writes to a file, so it gives up on reclaim that must
+ * not enter a filesystem, and on any device whose dev->sem is taken: its
+ * holder may be the one reclaiming.
+ */
+static DEFINE_MUTEX(scull_spill_lock);  /* one scan at a time */
+static int scull_spill_next;            /* the device the next scan starts at */
+
+/* the quanta in memory, of the devices which can be spilled */
+static unsigned long scull_spill_count(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	unsigned long n = 0, quanta, spilled;
+	struct scull_dev *dev;
+	int i, mode;
+
+	for (i = 0; i < scull_nr_devs; i++) {
+		dev = READ_ONCE(scull_devices[i]);
+		if (!dev)
+			continue;
+		mode = READ_ONCE(dev->mode);
+		quanta = READ_ONCE(dev->nr_quanta);
+		spilled = READ_ONCE(dev->nr_spilled);
+		/* read without dev->sem, the two may not match */
+		if ((mode == SCULL_MODE_BYTES || mode == SCULL_MODE_RECORD) && quanta > spilled)
+			n += quanta - spilled;
+	}
+	return n;
+}
+
+static unsigned long scull_spill_scan(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	unsigned long freed = 0;
+	struct scull_dev *dev;
+	unsigned int flags;
+	int i;
+
+	if (!(sc->gfp_mask & __GFP_FS))
+		return SHRINK_STOP;
+	/* the scan itself may allocate, and come back here */
+	if (!mutex_trylock(&scull_spill_lock))
+		return SHRINK_STOP;
+	flags = memalloc_nofs_save();
+
+	for (i = 0; i < scull_nr_devs && freed < sc->nr_to_scan; i++) {
+		dev = READ_ONCE(scull_devices[scull_spill_next]);
+		scull_spill_next = (scull_spill_next + 1) % scull_nr_devs;
+		if (!dev || down_trylock(&dev->sem))
+			continue;
+		freed += scull_spill_dev(dev, sc->nr_to_scan - freed);
+		up(&dev->sem);
+	}
+
+	memalloc_nofs_restore(flags);
+	mutex_unlock(&scull_spill_lock);
+	return freed ? freed : SHRINK_STOP;
+}
+
+/* shrinker_alloc() from 6.7, a name from 6.0 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+static struct shrinker *scull_shrinker;
+
+static int scull_shrinker_register(void)
+{
+	scull_shrinker = shrinker_alloc(0, "scull-spill");
+	if (!scull_shrinker)
+		return -ENOMEM;
+	scull_shrinker->count_objects = scull_spill_count;
+	scull_shrinker->scan_objects = scull_spill_scan;
+	shrinker_register(scull_shrinker);
+	return 0;
+}
+
+static void scull_shrinker_unregister(void)
+{
+	shrinker_free(scull_shrinker);
+	scull_shrinker = NULL;
+}
+#else
+static struct shrinker scull_shrinker_s = {
+	.count_objects = scull_spill_count,
+	.scan_objects = scull_spill_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+static struct shrinker *scull_shrinker;
+
+static int scull_shrinker_register(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	int retval = register_shrinker(&scull_shrinker_s, "scull-spill");
+#else
+	int retval = register_shrinker(&scull_shrinker_s);
+#endif
+	if (!retval)
+		scull_shrinker = &scull_shrinker_s;
+	return retval;
+}
+
+static void scull_shrinker_unregister(void)
+{
+	unregister_shrinker(scull_shrinker);
+	scull_shrinker = NULL;
+}
+#endif
+
+/* open @path, if the parameter names one, and start spilling to it */
+int scull_spill_init(const char *path)
+{
+	int retval;
+
+	if (!path || !*path)
+		return 0;
+	retval = scull_spill_open(path, scull_quantum);
+	if (retval) {
+		pr_err("scull: cannot open the spill file %s: %d\n", path, retval);
+		return retval;
+	}
+	retval = scull_shrinker_register();
+	if (retval)
+		scull_spill_close();
+	return retval;
+}
+
+/* before the devices are freed: the shrinker goes through them */
+void scull_spill_exit(void)
+{
+	if (scull_shrinker)
+		scull_shrinker_unregister();
+	scull_spill_close();
+}
+#endif /* __KERNEL__ */
@@ -0,0 +1,357 @@
+/*
+ * uring.c -- io_uring passthrough: the SCULL_URING_* commands
+ *
+ * An IORING_OP_URING_CMD on a scull file reaches scull_uring_cmd(), in
+ * the context of the submitter, which must not wait for dev->sem: the
+ * whole ring would wait behind it.
+ *
+ * - STATS reads counters kept without dev->sem and completes at once.
+ * - READ and WRITE take dev->sem with down_trylock(). If it is
+ *   free the batch runs there, on the buffers of the user, and completes
+ *   at once as well.
+ * - Otherwise the batch is deferred: the data of a write is copied into
+ *   one bounce buffer, a worker of scull_uring_wq waits for dev->sem and
+ *   runs the batch on it, and the completion is posted from the task of
+ *   the submitter with io_uring_cmd_complete_in_task(), which copies the
+ *   data of a read and the results of the ios back to its memory.
+ *
+ * The bytes of the write-combining buffer of the file are written first,
+ * by the worker, which is where any file having one goes. The fault
+ * injection of SCULL_IOC_SET_INJECT is for read() and write() only.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/mm.h>       /* kvmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/version.h>
+#include <linux/uaccess.h>  /* copy_*_user */
+
+#include "scull.h"
+
+#ifdef SCULL_URING
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+    #include <linux/io_uring/cmd.h>
+#else
+    #include <linux/io_uring.h>
+#endif
+
+/*
+ * The completion callback given to io_uring_cmd_complete_in_task():
+ * - before 6.3: (struct io_uring_cmd *)
+ * - 6.3: (struct io_uring_cmd *, unsigned int issue_flags), and
+ *   io_uring_cmd_done() takes the issue flags too
+ * - 6.18: io_uring_cmd_tw_t, (struct io_uring_cmd *, io_tw_token_t), the
+ *   flags from IO_URING_CMD_TASK_WORK_ISSUE_FLAGS(tw); io_uring_cmd_done()
+ *   loses its res2, which io_uring_cmd_done32() has
+ * - 6.19: io_uring_cmd_tw_t is (struct io_tw_req, io_tw_token_t), the
+ *   command from io_uring_cmd_from_tw()
+ * The last two are told by the Makefile from what <linux/io_uring/cmd.h>
+ * declares (SCULL_URING_TW_TOKEN, SCULL_URING_TW_REQ, SCULL_URING_DONE32),
+ * not from the version, so that a backport to a stable or distribution
+ * kernel builds as well. From 6.5 the command is found through the SQE.
+ */
+#if defined(SCULL_URING_TW_REQ)
+    #define SCULL_URING_CB(name)   void name(struct io_tw_req tw_req, io_tw_token_t tw)
+    #define scull_uring_cb_cmd()   io_uring_cmd_from_tw(tw_req)
+    #define scull_uring_cb_flags() IO_URING_CMD_TASK_WORK_ISSUE_FLAGS(tw)
+#elif defined(SCULL_URING_TW_TOKEN)
+    #define SCULL_URING_CB(name)   void name(struct io_uring_cmd *cb_cmd, io_tw_token_t tw)
+    #define scull_uring_cb_cmd()   cb_cmd
+    #define scull_uring_cb_flags() IO_URING_CMD_TASK_WORK_ISSUE_FLAGS(tw)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+    #define SCULL_URING_CB(name)   void name(struct io_uring_cmd *cb_cmd, \
+                                             unsigned int issue_flags)
+    #define scull_uring_cb_cmd()   cb_cmd
+    #define scull_uring_cb_flags() issue_flags
+#else
+    #define SCULL_URING_CB(name)   void name(struct io_uring_cmd *cb_cmd)
+    #define scull_uring_cb_cmd()   cb_cmd
+#endif
+
+#if defined(SCULL_URING_DONE32)
+    #define scull_uring_done(ioucmd, ret)  io_uring_cmd_done(ioucmd, ret, scull_uring_cb_flags())
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+    #define scull_uring_done(ioucmd, ret)  io_uring_cmd_done(ioucmd, ret, 0, scull_uring_cb_flags())
+#else
+    #define scull_uring_done(ioucmd, ret)  io_uring_cmd_done(ioucmd, ret, 0)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+    #define scull_uring_sqe_cmd(ioucmd)  io_uring_sqe_cmd((ioucmd)->sqe)
+#else
+    #define scull_uring_sqe_cmd(ioucmd)  ((ioucmd)->cmd)
+#endif
+
+static struct workqueue_struct *scull_uring_wq;
+
+/*
+ * One READ or WRITE, from the copy of its ios to its completion.
+ * @uios: where the ios are in user space, their results go back there
+ * @bounce: @bytes, the buffers of all the ios end to end, when deferred
+ * @result: what the CQE gets, set by the worker
+ * The pointer to it is kept in ioucmd->pdu while it is deferred.
+ */
+struct scull_uring_req {
+	struct work_struct work;
+	struct io_uring_cmd *ioucmd;
+	struct scull_file *sf;
+	unsigned int op;
+	unsigned int nr;
+	struct scull_uring_io __user *uios;
+	char *bounce;
+	size_t bytes;
+	ssize_t result;
+	struct scull_uring_io ios[SCULL_URING_MAX_IOS];
+};
+
+/*
+ * Do one io, into or from @kbuf if it is bounced or else the buffer of
+ * the user. Returns its bytes, or -errno if there are none.
+ */
+static ssize_t scull_uring_io(struct scull_uring_req *req, struct scull_uring_io *io,
+		char *kbuf)
+{
+	struct scull_dev *dev = req->sf->dev;
+	struct scull_cursor *cur = &req->sf->cur;
+	char __user *ubuf = u64_to_user_ptr(io->buf);
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	loff_t pos = io->pos;
+	size_t done = 0, len;
+	ssize_t ret = 0;
+
+	while (done < io->len) {
+		len = io->len - done;
+		if (req->op == SCULL_URING_WRITE)
+			ret = kbuf ? scull_write_kernel_locked(dev, kbuf + done, len, &pos, &loc, cur)
+				   : scull_write_locked(dev, ubuf + done, len, &pos, &loc, cur);
+		else
+			ret = kbuf ? scull_read_kernel_locked(dev, kbuf + done, len, &pos, &loc, cur)
+				   : scull_read_locked(dev, ubuf + done, len, &pos, &loc, cur);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	return done ? done : ret;
+}
+
+/*
+ * Run the ios of @req in order, with dev->sem held. Returns the bytes of
+ * all of them, or the first error if there are none.
+ */
+static ssize_t scull_uring_run(struct scull_uring_req *req, char *kbuf)
+{
+	struct scull_dev *dev = req->sf->dev;
+	ssize_t ret, total = 0, err = 0;
+	unsigned int i;
+
+	if (dev->mode != SCULL_MODE_BYTES)
+		return -EINVAL;
+	for (i = 0; i < req->nr; i++) {
+		ret = scull_uring_io(req, &req->ios[i], kbuf);
+		req->ios[i].result = ret;
+		if (ret > 0)
+			total += ret;
+		else if (!err)
+			err = ret;
+		if (kbuf)
+			kbuf += req->ios[i].len;
+	}
+	return total ? total : err;
+}
+
+static void scull_uring_free(struct scull_uring_req *req)
+{
+	kvfree(req->bounce);
+	kfree(req);
+}
+
+/*
+ * Back in the task of the submitter: give it the data read and the
+ * results, and post the completion.
+ */
+static SCULL_URING_CB(scull_uring_complete)
+{
+	struct io_uring_cmd *ioucmd = scull_uring_cb_cmd();
+	struct scull_uring_req *req = *(struct scull_uring_req **)ioucmd->pdu;
+	ssize_t ret = req->result;
+	char *kbuf = req->bounce;
+	unsigned int i;
+
+	for (i = 0; i < req->nr && ret >= 0; i++) {
+		struct scull_uring_io *io = &req->ios[i];
+
+		if (req->op != SCULL_URING_WRITE && io->result > 0 &&
+		    copy_to_user(u64_to_user_ptr(io->buf), kbuf, io->result))
+			ret = -EFAULT;
+		kbuf += io->len;
+	}
+	if (ret >= 0 && copy_to_user(req->uios, req->ios, req->nr * sizeof(req->ios[0])))
+		ret = -EFAULT;
+
+	scull_uring_free(req);
+	scull_uring_done(ioucmd, ret);
+}
+
+static void scull_uring_work(struct work_struct *work)
+{
+	struct scull_uring_req *req = container_of(work, struct scull_uring_req, work);
+	struct scull_file *sf = req->sf;
+	struct scull_dev *dev = sf->dev;
+
+	if (READ_ONCE(sf->wc_buf))
+		scull_wc_flush(sf, false);
+	down(&dev->sem);
+	req->result = scull_uring_run(req, req->bounce);
+	up(&dev->sem);
+	io_uring_cmd_complete_in_task(req->ioucmd, scull_uring_complete);
+}
+
+/* hand @req to the worker; the data of a write is copied now */
+static int scull_uring_defer(struct scull_uring_req *req)
+{
+	char *kbuf;
+	unsigned int i;
+
+	req->bounce = kvmalloc(max_t(size_t, req->bytes, 1), GFP_KERNEL);
+	if (!req->bounce)
+		return -ENOMEM;
+	if (req->op == SCULL_URING_WRITE) {
+		for (i = 0, kbuf = req->bounce; i < req->nr; kbuf += req->ios[i++].len)
+			if (copy_from_user(kbuf, u64_to_user_ptr(req->ios[i].buf),
+					   req->ios[i].len))
+				return -EFAULT;
+	}
+
+	*(struct scull_uring_req **)req->ioucmd->pdu = req;
+	INIT_WORK(&req->work, scull_uring_work);
+	queue_work(scull_uring_wq, &req->work);
+	return -EIOCBQUEUED;
+}
+
+static int scull_uring_batch(struct io_uring_cmd *ioucmd, unsigned int op,
+		const struct scull_uring_cmd *cmd)
+{
+	struct scull_file *sf = ioucmd->file->private_data;
+	struct scull_dev *dev = sf->dev;
+	struct scull_uring_req *req;
+	unsigned int i;
+	ssize_t ret;
+
+	if (!cmd->nr || cmd->nr > SCULL_URING_MAX_IOS || cmd->flags)
+		return -EINVAL;
+	if (!(ioucmd->file->f_mode & (op == SCULL_URING_WRITE ? FMODE_WRITE : FMODE_READ)))
+		return -EBADF;
+
+	req = kzalloc(sizeof(struct scull_uring_req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+	req->ioucmd = ioucmd;
+	req->sf = sf;
+	req->op = op;
+	req->nr = cmd->nr;
+	req->uios = u64_to_user_ptr(cmd->addr);
+	if (copy_from_user(req->ios, req->uios, req->nr * sizeof(req->ios[0]))) {
+		ret = -EFAULT;
+		goto out;
+	}
+	for (i = 0; i < req->nr; i++) {
+		req->bytes += req->ios[i].len;
+		req->ios[i].result = 0;
+	}
+	if (req->bytes > SCULL_URING_MAX_BYTES) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* a file with buffered writes goes to the worker, which flushes them */
+	if (!READ_ONCE(sf->wc_buf) && !down_trylock(&dev->sem)) {
+		ret = scull_uring_run(req, NULL);
+		up(&dev->sem);
+		if (copy_to_user(req->uios, req->ios, req->nr * sizeof(req->ios[0])))
+			ret = -EFAULT;
+		goto out;
+	}
+
+	ret = scull_uring_defer(req);
+	if (ret == -EIOCBQUEUED)
+		return ret;
+out:
+	scull_uring_free(req);
+	return ret;
+}
+
+/*
+ * The counters of the device, read without dev->sem like /proc/scullmem:
+ * they may be a little behind a write going on.
+ */
+static int scull_uring_stats(struct scull_dev *dev, const struct scull_uring_cmd *cmd)
+{
+	struct scull_uring_stats st;
+
+	if (cmd->nr || cmd->flags)
+		return -EINVAL;
+	memset(&st, 0, sizeof(st));
+	st.size = READ_ONCE(dev->size);
+	st.qsets = READ_ONCE(dev->nr_qsets);
+	st.quanta = READ_ONCE(dev->nr_quanta);
+	st.nodes = READ_ONCE(dev->nr_nodes);
+	st.extents = READ_ONCE(dev->nr_extents);
+	st.generation = READ_ONCE(dev->generation);
+	st.mode = READ_ONCE(dev->mode);
+	st.alloc = dev->alloc;
+	scull_pool_stat(dev, &st.alloc);
+	if (copy_to_user(u64_to_user_ptr(cmd->addr), &st, sizeof(st)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * The .uring_cmd of every scull file. Returns the result of the CQE, or
+ * -EIOCBQUEUED if it is posted later.
+ */
+int scull_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct scull_file *sf = ioucmd->file->private_data;
+	const struct scull_uring_cmd *sqe_cmd = scull_uring_sqe_cmd(ioucmd);
+	struct scull_uring_cmd cmd;
+
+	/* the SQE is shared with user space: read it once */
+	cmd.addr = READ_ONCE(sqe_cmd->addr);
+	cmd.nr = READ_ONCE(sqe_cmd->nr);
+	cmd.flags = READ_ONCE(sqe_cmd->flags);
+
+	switch (ioucmd->cmd_op) {
+	case SCULL_URING_STATS:
+		return scull_uring_stats(sf->dev, &cmd);
+	case SCULL_URING_READ:
+	case SCULL_URING_WRITE:
+		return scull_uring_batch(ioucmd, ioucmd->cmd_op, &cmd);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/* an unbound queue: the workers wait for dev->sem and sleep a lot */
+int scull_uring_init(void)
+{
+	scull_uring_wq = alloc_workqueue("scull_uring", WQ_UNBOUND, 0);
+	return scull_uring_wq ? 0 : -ENOMEM;
+}
+
+/* the files, and so the commands in flight, are all gone */
+void scull_uring_exit(void)
+{
+	if (scull_uring_wq)
+		destroy_workqueue(scull_uring_wq);
+	scull_uring_wq = NULL;
+}
+
+#endif /* SCULL_URING */
@@ -0,0 +1,560 @@
+/*
+ * scull_fuzz -- fuzz target for the scull storage
+ *
+ * The input picks a small geometry (so that quantum and quantum set
+ * boundaries are hit all the time), how often kmalloc fails, where the
+ * 64 KB window the operations work in starts, and then a list of
+ * operations. Every operation is done both on a scull_dev and on a flat
+ * shadow copy of the window, and any difference aborts. The windows far
+ * out put the index of quantum sets and the 64-bit offset math to work,
+ * the last one straddles scull_max_size.
+ *
+ * Quanta are spilled to a temporary file and read back (spill.c) along
+ * the way: what is read of them must not change.
+ *
+ * The checksums and searches of compute.c go over the same bytes as the
+ * reads, and must find what a plain loop over those finds.
+ *
+ * With extents on, writes through the cursor may allocate several quanta
+ * at once, and writes and reads then go past the end of a quantum: the
+ * shadow only knows the quanta written, so the device may have more, and
+ * what is read of them is not checked.
+ *
+ * Built with -fsanitize=fuzzer it is a libFuzzer target, otherwise it
+ * runs each file given on the command line, or stdin (for AFL):
+ *   make scull_fuzz_libfuzzer CC=clang && ./scull_fuzz_libfuzzer corpus/
+ *   ./scull_fuzz crash-1234
+ *
+ * "./scull_fuzz -b" replays the boundary cases below instead: the edges
+ * of a quantum and of a quantum set, positions past dev->size and holes
+ * of sparse devices, for a few geometries, near 0, far out and at the
+ * end of the device.
+ */
+#include "libscull_store.h"
+
+#define SHADOW_MAX  (1 << 16)   /* positions are 16 bits */
+#define QUANTA_MAX  (SHADOW_MAX + 256)   /* with quantum 1, one per byte */
+
+static unsigned char shadow[SHADOW_MAX + 256];
+static unsigned char written[SHADOW_MAX + 256];
+static unsigned char have_quantum[QUANTA_MAX];
+static unsigned long shadow_size;   /* in the window, 0 if nothing was written */
+static unsigned long shadow_quanta;
+static int extents;                 /* scull_extent_max is not 0 */
+
+/* the cursor of the open file, used by the operations that ask for it */
+static struct scull_cursor cursor;
+
+/* where the window starts, picked by the input */
+static loff_t base;
+static const loff_t bases[16] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    (1LL << 31) - 1000, (1LL << 32) - 3, 1LL << 32, (1LL << 40) + 12345,
+    1LL << 44, (1LL << 50) - 77, (1LL << 62) + 5, SCULL_MAX_SIZE - 0x8000,
+};
+
+#define check(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "scull_fuzz: %s:%d: %s\n",                  \
+                    __FILE__, __LINE__, #cond);                         \
+            abort();                                                    \
+        }                                                               \
+    } while (0)
+
+static void shadow_reset(void)
+{
+    memset(shadow, 0, sizeof(shadow));
+    memset(written, 0, sizeof(written));
+    memset(have_quantum, 0, sizeof(have_quantum));
+    shadow_size = 0;
+    shadow_quanta = 0;
+}
+
+/* the quantum of the window @off falls in */
+static unsigned long window_quantum(struct scull_dev *dev, loff_t off)
+{
+    return (base + off) / dev->quantum - base / dev->quantum;
+}
+
+/* @off is in the window, the device sees base + off */
+static void do_write(struct scull_dev *dev, loff_t off, size_t len, unsigned char fill,
+                     struct scull_cursor *cur)
+{
+    unsigned char buf[256];
+    int quantum = dev->quantum;
+    size_t expect = len;
+    loff_t pos = base + off, p = pos;
+    unsigned long q;
+    ssize_t ret;
+
+    memset(buf, fill, len);
+    if (expect > (size_t)(quantum - pos % quantum))
+        expect = quantum - pos % quantum;
+
+    ret = scull_user_write(dev, cur, buf, len, &p);
+    if ((unsigned long long)pos >= scull_max_size) {
+        check(ret == -EFBIG);
+        check(p == pos);
+        return;
+    }
+    if (expect > scull_max_size - pos)
+        expect = scull_max_size - pos;
+    if (ret == -ENOMEM) {
+        check(scull_user_kmalloc_fail);
+        check(p == pos);
+        return;
+    }
+    if (extents)
+        check(ret >= (ssize_t)expect && (size_t)ret <= len &&
+              (unsigned long long)ret <= scull_max_size - pos);
+    else
+        check(ret == (ssize_t)expect);
+    check(p == pos + ret);
+
+    memcpy(shadow + off, buf, ret);
+    memset(written + off, 1, ret);
+    for (q = window_quantum(dev, off); q <= window_quantum(dev, off + ret - 1); q++) {
+        if (!have_quantum[q]) {
+            have_quantum[q] = 1;
+            shadow_quanta++;
+        }
+    }
+    if ((unsigned long)(off + ret) > shadow_size)
+        shadow_size = off + ret;
+}
+
+static void do_read(struct scull_dev *dev, loff_t off, size_t len, struct scull_cursor *cur)
+{
+    unsigned char buf[256];
+    int quantum = dev->quantum;
+    size_t expect = 0;
+    ssize_t i;
+    loff_t pos = base + off, p = pos;
+    ssize_t ret;
+
+    /* holes read as zeroes, up to the end of their quantum */
+    if ((unsigned long)off < shadow_size) {
+        expect = len;
+        if (expect > shadow_size - off)
+            expect = shadow_size - off;
+        if (expect > (size_t)(quantum - pos % quantum))
+            expect = quantum - pos % quantum;
+    }
+
+    /* reads never allocate, even in holes */
+    ret = scull_user_read(dev, cur, buf, len, &p);
+    if (extents)
+        check(ret >= (ssize_t)expect && (size_t)ret <= len &&
+              (unsigned long)(off + ret) <= (shadow_size > off ? shadow_size : off));
+    else
+        check(ret == (ssize_t)expect);
+    check(p == pos + ret);
+    /* quanta are zeroed when allocated: what was not written is zeroes */
+    for (i = 0; i < ret; i++)
+        check(buf[i] == (written[off + i] ? shadow[off + i] : 0));
+}
+
+/*
+ * Allocate the quanta of @len bytes at @off: those not there before read
+ * as zeroes. Not with kmalloc failing, as the shadow could not tell which
+ * quanta were had, nor with extents, whose quanta may already be there
+ * unwritten.
+ */
+static void do_falloc(struct scull_dev *dev, loff_t off, size_t len, bool keep_size)
+{
+    int quantum = dev->quantum;
+    loff_t pos = base + off, q0, q1, q;
+    unsigned long i, start, end;
+
+    if (scull_user_kmalloc_fail || (unsigned long long)pos + len > scull_max_size)
+        return;
+    check(scull_fallocate_locked(dev, pos, len, keep_size) == 0);
+
+    q0 = pos / quantum;
+    q1 = (pos + len - 1) / quantum;
+    for (q = q0; q <= q1; q++) {
+        unsigned long wq = q - base / quantum;
+
+        if (have_quantum[wq])
+            continue;
+        have_quantum[wq] = 1;
+        shadow_quanta++;
+        if (extents)
+            continue;
+        /* the part of the quantum in the window */
+        start = q * quantum > base ? q * quantum - base : 0;
+        end = (q + 1) * quantum - base;
+        for (i = start; i < end && i < SHADOW_MAX + 256; i++) {
+            shadow[i] = 0;
+            written[i] = 1;
+        }
+    }
+    if (!keep_size && (unsigned long)(off + len) > shadow_size)
+        shadow_size = off + len;
+}
+
+/*
+ * Spill @nr quanta, the coldest first. Not with kmalloc failing: reading
+ * them back would fail too, and the reads could not be checked.
+ */
+static void do_spill(struct scull_dev *dev, unsigned long nr)
+{
+    static int opened;
+    char path[] = "/tmp/scull_fuzz_spill.XXXXXX";
+    unsigned long before = dev->nr_spilled;
+    int fd;
+
+    if (scull_user_kmalloc_fail)
+        return;
+    if (!opened) {
+        /* slots as large as the largest quantum of the inputs */
+        fd = mkstemp(path);
+        check(fd >= 0);
+        close(fd);
+        check(scull_spill_open(path, 64) == 0);
+        unlink(path);
+        opened = 1;
+    }
+    check(scull_spill_dev(dev, nr) <= nr + 0xffff);
+    check(dev->nr_spilled >= before);
+}
+
+/*
+ * Cut the device at @off in the window, or grow it to there; 0 empties
+ * it. What is left of the last quantum kept reads as zeroes.
+ */
+static void do_truncate(struct scull_dev *dev, loff_t off)
+{
+    loff_t size = off ? base + off : 0;
+    unsigned long q, keep;
+    int ret;
+
+    ret = scull_truncate_locked(dev, size);
+    if ((unsigned long long)size > scull_max_size) {
+        check(ret == -EFBIG);
+        return;
+    }
+    check(ret == 0);
+    if (!off) {
+        shadow_reset();
+        return;
+    }
+    if ((unsigned long)off >= shadow_size) {
+        shadow_size = off;
+        return;
+    }
+
+    /* also the zeroes past the size of an earlier cut */
+    memset(written + off, 0, sizeof(written) - off);
+    shadow_size = off;
+    keep = window_quantum(dev, off - 1);
+    for (q = keep + 1; q < QUANTA_MAX; q++) {
+        if (have_quantum[q]) {
+            have_quantum[q] = 0;
+            shadow_quanta--;
+        }
+    }
+    if (have_quantum[keep]) {
+        q = dev->quantum - (base + off) % dev->quantum;
+        if (q < (unsigned long)dev->quantum) {
+            memset(shadow + off, 0, q);
+            memset(written + off, 1, q);
+        }
+    }
+}
+
+/* the checksums of @n bytes at @buf, as SCULL_IOC_CHECKSUM computes them */
+static u64 ref_checksum(u32 algo, const unsigned char *buf, size_t n, u64 seed)
+{
+    struct xxh64_state xxh;
+
+    if (algo == SCULL_CSUM_CRC32C)
+        return ~crc32c(~(u32)seed, buf, n);
+    xxh64_reset(&xxh, seed);
+    xxh64_update(&xxh, buf, n);
+    return xxh64_digest(&xxh);
+}
+
+/*
+ * The checksums and a search (compute.c) of @len bytes at @off must be
+ * those of the bytes read one quantum at a time, holes as zeroes, and
+ * agree with the shadow where it was written. The pattern is taken from
+ * the bytes, so there is at least one match.
+ */
+static void do_compute(struct scull_dev *dev, loff_t off, size_t len)
+{
+    unsigned char buf[256], *pattern;
+    struct scull_loc loc = { .item = -1, .s_pos = -1 };
+    struct scull_csum cs = { 0 };
+    struct scull_find f = { 0 };
+    u64 matches[4];
+    loff_t pos = base + off, p = pos;
+    size_t n = 0, i, k, nr = 0;
+    ssize_t ret;
+
+    /* holes are read as zeroes */
+    while (n < len && p < dev->size) {
+        ret = scull_read_kernel_locked(dev, (char *)buf + n, len - n, &p, &loc, NULL);
+        check(ret > 0);
+        n += ret;
+    }
+    for (i = 0; i < n; i++)
+        check(buf[i] == (written[off + i] ? shadow[off + i] : 0));
+
+    /* whole, and the CRC in two pieces, the first the seed of the second */
+    for (cs.algo = SCULL_CSUM_CRC32C; cs.algo <= SCULL_CSUM_XXH64; cs.algo++) {
+        cs.pos = pos;
+        cs.len = len;
+        cs.seed = len;
+        check(scull_checksum(dev, &cs) == 0);
+        check(cs.done == n);
+        check(cs.result == ref_checksum(cs.algo, buf, n, len));
+    }
+    cs.algo = SCULL_CSUM_CRC32C;
+    cs.pos = pos;
+    cs.len = len / 3;
+    cs.seed = 0;
+    check(scull_checksum(dev, &cs) == 0);
+    cs.pos += cs.done;
+    cs.len = len - cs.done;
+    cs.seed = cs.result;
+    check(scull_checksum(dev, &cs) == 0);
+    check(cs.result == ref_checksum(cs.algo, buf, n, 0));
+
+    if (!n)
+        return;
+    f.pattern_len = 1 + len % 5 < n ? 1 + len % 5 : n;
+    pattern = buf + (n - f.pattern_len) / 2;
+    f.pos = pos;
+    f.len = len;
+    f.pattern = (uintptr_t)pattern;
+    f.matches = (uintptr_t)matches;
+    f.max = 4;
+    ret = scull_find(dev, &f);
+    if (ret == -ENOMEM) {
+        check(scull_user_kmalloc_fail);
+        return;
+    }
+    check(ret == 0);
+    for (i = 0; i + f.pattern_len <= n && nr < f.max; i++) {
+        for (k = 0; k < f.pattern_len && buf[i + k] == pattern[k]; k++)
+            ;
+        if (k == f.pattern_len)
+            check(nr < f.nr && matches[nr++] == (u64)pos + i);
+    }
+    check(nr >= 1 && nr == f.nr);
+    check(f.next == (nr == f.max ? matches[nr - 1] + 1 : (u64)pos + n));
+}
+
+static void check_counters(struct scull_dev *dev)
+{
+    check(dev->size == (shadow_size ? base + (loff_t)shadow_size : 0));
+    check(extents ? dev->nr_quanta >= shadow_quanta : dev->nr_quanta == shadow_quanta);
+    check(scull_check(dev) == 0);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct scull_dev dev;
+    size_t i;
+
+    if (size < 3)
+        return 0;
+
+    shadow_reset();
+    scull_user_kmalloc_calls = 0;
+    scull_user_kmalloc_fail = data[2] & 0x0f;
+    base = bases[data[2] >> 4];
+    /* only the last window is meant to reach the limit */
+    scull_max_size = (data[2] >> 4) == 15 ? SCULL_MAX_SIZE : 1ULL << 63;
+    extents = data[1] & 0x80;
+    scull_extent_max = extents ? SCULL_EXTENT_MAX : 0;
+    scull_user_init(&dev, 1 + data[0] % 64, 1 + data[1] % 16);
+    memset(&cursor, 0, sizeof(cursor));
+
+    /*
+     * op (1), pos (2), len (1), fill (1); bit 2 of op: through the cursor.
+     * op 3 trims with fill 0, fallocates with fill 1 (2: keeping the size),
+     * spills len quanta with fill 3, checksums and searches with fill 4,
+     * truncates at pos with fill 5
+     */
+    for (i = 3; i + 5 <= size; i += 5) {
+        loff_t pos = data[i + 1] | data[i + 2] << 8;
+        size_t len = data[i + 3];
+        struct scull_cursor *cur = data[i] & 4 ? &cursor : NULL;
+
+        switch (data[i] % 4) {
+        case 0:
+        case 1:
+            if (len)
+                do_write(&dev, pos, len, data[i + 4], cur);
+            break;
+        case 2:
+            do_read(&dev, pos, len, cur);
+            break;
+        case 3:
+            if (data[i + 4] == 0) {
+                scull_trim(&dev);
+                shadow_reset();
+            } else if (data[i + 4] <= 2 && len) {
+                do_falloc(&dev, pos, len, data[i + 4] == 2);
+            } else if (data[i + 4] == 3) {
+                do_spill(&dev, len);
+            } else if (data[i + 4] == 4) {
+                do_compute(&dev, pos, len);
+            } else if (data[i + 4] == 5) {
+                do_truncate(&dev, pos);
+            }
+            break;
+        }
+        check_counters(&dev);
+    }
+
+    scull_user_kmalloc_fail = 0;
+    scull_user_destroy(&dev);
+    return 0;
+}
+
+/* Q is the quantum and I the bytes of a quantum set of the geometry */
+enum { OP_WRITE, OP_READ, OP_TRIM, OP_SPILL, OP_COMPUTE, OP_TRUNCATE };
+
+struct boundary_op {
+    int op;
+    int q, i, off;      /* position: q * Q + i * I + off */
+    size_t len;
+};
+
+static const struct boundary_op boundary_ops[] = {
+    { OP_WRITE, 1,  0, -1, 2 },     /* short write at the end of a quantum */
+    { OP_WRITE, 1,  0,  0, 255 },   /* the next quantum, up to its end */
+    { OP_READ,  1,  0, -1, 2 },     /* short read at the end of a quantum */
+    { OP_WRITE, 0,  1, -1, 2 },     /* last byte of a quantum set */
+    { OP_WRITE, 0,  1,  0, 1 },     /* first byte of the next one */
+    { OP_READ,  0,  1, -1, 2 },
+    { OP_READ,  0,  1,  1, 1 },     /* at dev->size */
+    { OP_READ,  0,  1,  5, 3 },     /* past dev->size */
+    { OP_READ,  0,  1,  0, 100 },   /* across dev->size */
+    { OP_WRITE, 0,  5,  3, 3 },     /* sparse: quantum sets 2 to 4 are holes */
+    { OP_READ,  0,  3,  0, 1 },     /* in a hole list item */
+    { OP_READ,  1,  5,  0, 1 },     /* in a missing quantum of a present item */
+    { OP_READ,  0,  5,  2, 4 },
+    { OP_READ,  0,  5,  0, 255 },
+    { OP_COMPUTE, 0, 1, -1, 255 },  /* through the holes, up to dev->size */
+    { OP_TRUNCATE, 1, 5, 1, 0 },    /* inside a quantum of the last item */
+    { OP_READ,  0,  5,  0, 255 },
+    { OP_TRUNCATE, 0, 3, 0, 0 },    /* at a hole item: the last one goes */
+    { OP_TRUNCATE, 0, 6, 0, 0 },    /* grows, with a hole */
+    { OP_READ,  0,  5,  0, 255 },
+    { OP_WRITE, 0,  5,  3, 3 },     /* back again */
+    { OP_SPILL, 0,  0,  0, 1000 },  /* everything, the clock going round */
+    { OP_READ,  0,  1, -1, 2 },     /* read back across two quanta */
+    { OP_WRITE, 1,  0,  1, 2 },     /* write into a spilled quantum */
+    { OP_READ,  1,  0,  0, 4 },
+    { OP_COMPUTE, 0, 0,  0, 255 },  /* spilled quanta are read back */
+    { OP_WRITE, 0, 63,  0, 1 },     /* the last item of a node of the index */
+    { OP_WRITE, 0, 64,  0, 1 },     /* the first of the next node */
+    { OP_TRUNCATE, 0, 63, 0, 0 },   /* both go, and the second node */
+    { OP_TRIM,  0,  0,  0, 0 },
+    { OP_READ,  0,  0,  0, 1 },     /* empty device */
+    { OP_WRITE, 0,  2,  0, 1 },     /* first write far from 0 */
+    { OP_READ,  0,  0,  0, 1 },
+};
+
+static const int boundary_geometries[][2] = {
+    { 1, 1 }, { 4, 3 }, { 7, 3 }, { 64, 16 }, { 100, 7 },
+};
+
+static int boundary_cases(void)
+{
+    unsigned int g, k;
+    int n = 0;
+
+    scull_max_size = SCULL_MAX_SIZE;
+    /* every geometry twice, without extents and with */
+    for (g = 0; g < 6 * sizeof(boundary_geometries) / sizeof(boundary_geometries[0]); g++) {
+        int quantum = boundary_geometries[g / 6][0], qset = boundary_geometries[g / 6][1];
+        struct scull_dev dev;
+
+        extents = g % 6 >= 3;
+        scull_extent_max = extents ? SCULL_EXTENT_MAX : 0;
+
+        /*
+         * each geometry at 0, far out where the index is several levels
+         * high, and across scull_max_size, from the 4th quantum set on
+         */
+        if (g % 3 == 0)
+            base = 0;
+        else if (g % 3 == 1)
+            base = (1LL << 40) + 7;
+        else
+            base = SCULL_MAX_SIZE - 3LL * quantum * qset - 5;
+        shadow_reset();
+        scull_user_init(&dev, quantum, qset);
+        memset(&cursor, 0, sizeof(cursor));
+        for (k = 0; k < sizeof(boundary_ops) / sizeof(boundary_ops[0]); k++) {
+            const struct boundary_op *o = &boundary_ops[k];
+            loff_t pos = (loff_t)o->q * quantum + (loff_t)o->i * quantum * qset + o->off;
+
+            if (pos < 0 || pos + (loff_t)o->len >= SHADOW_MAX)
+                continue;
+            switch (o->op) {
+            case OP_WRITE:
+                do_write(&dev, pos, o->len, 'a' + k, &cursor);
+                break;
+            case OP_READ:
+                do_read(&dev, pos, o->len, &cursor);
+                break;
+            case OP_TRIM:
+                scull_trim(&dev);
+                shadow_reset();
+                break;
+            case OP_SPILL:
+                do_spill(&dev, o->len);
+                break;
+            case OP_COMPUTE:
+                do_compute(&dev, pos, o->len);
+                break;
+            case OP_TRUNCATE:
+                do_truncate(&dev, pos);
+                break;
+            }
+            check_counters(&dev);
+            n++;
+        }
+        scull_user_destroy(&dev);
+    }
+    printf("scull_fuzz: %d boundary operations passed\n", n);
+    return 0;
+}
+
+#ifndef SCULL_LIBFUZZER
+static int run_file(FILE *f)
+{
+    static uint8_t buf[1 << 20];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+
+    return LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2)
+        return run_file(stdin);
+    if (!strcmp(argv[1], "-b"))
+        return boundary_cases();
+
+    for (i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
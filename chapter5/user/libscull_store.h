@@ -0,0 +1,35 @@
+/*
+ * libscull_store.h -- the scull storage (qset.c) as a user-space library
+ *
+ * A device is set up with scull_user_init() and freed with
+ * scull_user_destroy(). The scull_*_locked() functions of scull.h can be
+ * called directly with dev->sem held, or through the wrappers below which
+ * take it like scull_read()/scull_write() do.
+ */
+#ifndef _LIBSCULL_STORE_H_
+#define _LIBSCULL_STORE_H_
+
+#include "scull_user.h"
+#include "scull.h"
+
+void scull_user_init(struct scull_dev *dev, int quantum, int qset);
+void scull_user_destroy(struct scull_dev *dev);
+int scull_user_set_mode(struct scull_dev *dev, int mode);
+
+/*
+ * one call of scull_read()/scull_write(): stops at the end of a quantum,
+ * or is one record in record mode, where *pos is a record number.
+ * @cur plays the cursor of the open file, NULL to walk the index every time
+ */
+ssize_t scull_user_read(struct scull_dev *dev, struct scull_cursor *cur,
+                        void *buf, size_t count, loff_t *pos);
+ssize_t scull_user_write(struct scull_dev *dev, struct scull_cursor *cur,
+                         const void *buf, size_t count, loff_t *pos);
+int scull_user_read_records(struct scull_dev *dev, struct scull_cursor *cur,
+                            struct scull_rec_batch *b, loff_t *pos);
+
+/* loop until @count bytes are done, EOF/hole on read or an error */
+ssize_t scull_user_pread(struct scull_dev *dev, void *buf, size_t count, loff_t pos);
+ssize_t scull_user_pwrite(struct scull_dev *dev, const void *buf, size_t count, loff_t pos);
+
+#endif /* _LIBSCULL_STORE_H_ */
@@ -0,0 +1,575 @@
+/*
+ * scull_qbench -- microbenchmark of the scull storage in user space
+ *
+ * Times the quantum map of qset.c without loading the module: a
+ * sequential fill, a sequential read back, small writes at random
+ * offsets, small sequential reads, the offset math alone, scull_follow()
+ * to the last quantum set (a walk down the index), scull_trim(), and small
+ * writes anywhere below scull_max_size on an empty device, and small
+ * sequential writes one by one (write-small) or gathered in a buffer
+ * flushed once per quantum, as the write combining of wcombine.c does
+ * (write-combine), and small appends from -t threads to a device in log
+ * mode (append) or, for comparison, each holding dev->sem for its whole
+ * copy at dev->size (append-locked). In record mode it times small
+ * records written (record-write), read back at random record numbers
+ * (record-seek) and 64 at a time with SCULL_IOC_READ_RECORDS
+ * (record-batch), against finding a random record of a byte stream of
+ * length-prefixed records by skipping over the prefixes (record-scan,
+ * which does fewer operations as each one costs more). -G turns the power-of-two fast path of scull_locate()
+ * off, to compare it with the divisions, -C the cursor of the file
+ * (every call walks the index from the root, as before the cursor), and
+ * -X the extents of sequential writes (one kmalloc per quantum, as before).
+ * fallocate times scull_fallocate_locked() over the whole size, and
+ * write-falloc the fill again on top of it, which allocates nothing.
+ * After the timings of a size, one more line tells what write-fill
+ * allocated, and how long the writer stalled in the allocations (there
+ * is no reserve of ready quanta in user space, every one is a stall):
+ *   qalloc write-fill size=<bytes> kmalloc=<calls> quanta=<n> extents=<n> stalls=<n> stall_ns=<total> stall_max_ns=<max>
+ * Run it under perf or valgrind to see where the time goes:
+ *   perf record ./scull_qbench -s 256m
+ *   valgrind --tool=massif ./scull_qbench -s 16m
+ *
+ * By default every test runs at 1 MB, 100 MB and 1 GB, three times each,
+ * and the median is reported, so that the output of two releases can be
+ * compared line by line. Every result is one line:
+ *   qbench <test> quantum=<q> qset=<n> size=<bytes> bs=<bytes> ops=<n> ns=<median> ns_op=<avg> mib_s=<rate>
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "libscull_store.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct scull_dev dev;
+static struct scull_cursor cursor;          /* the open file of the tests */
+static struct scull_cursor *cur = &cursor;  /* NULL with -C */
+static int threads = 1;                     /* appenders */
+static int quantum = SCULL_QUANTUM;
+static int qset = SCULL_QSET;
+
+static void report(const char *test, uint64_t size, size_t bs, uint64_t ops,
+                   uint64_t bytes, uint64_t ns)
+{
+    double secs = ns / 1e9;
+
+    printf("qbench %s quantum=%d qset=%d size=%llu bs=%zu ops=%llu ns=%llu ns_op=%.1f mib_s=%.1f\n",
+           test, quantum, qset, (unsigned long long)size, bs,
+           (unsigned long long)ops, (unsigned long long)ns,
+           ops ? (double)ns / ops : 0.0,
+           secs > 0 ? bytes / secs / (1 << 20) : 0.0);
+}
+
+static uint64_t rnd_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+enum { T_FILL, T_READ, T_RAND, T_SMALL, T_LOCATE, T_FOLLOW, T_TRIM, T_SPARSE,
+       T_WSMALL, T_COMBINE, T_APPEND, T_APPEND_LOCKED,
+       T_REC_WRITE, T_REC_SEEK, T_REC_BATCH, T_REC_SCAN, T_FALLOC, T_FALLOC_FILL, T_NR };
+
+static const char *test_names[T_NR] = {
+    "write-fill", "read-seq", "write-rand", "read-small", "locate", "follow-last", "trim",
+    "write-sparse", "write-small", "write-combine", "append", "append-locked",
+    "record-write", "record-seek", "record-batch", "record-scan",
+    "fallocate", "write-falloc",
+};
+
+struct run {
+    uint64_t ns[T_NR];
+    uint64_t ops[T_NR];
+    uint64_t bytes[T_NR];
+    uint64_t sum;       /* of the locate results, so that they are used */
+    uint64_t fill_allocs, fill_quanta, fill_extents;
+    struct scull_allocstat fill_stat;
+};
+
+/* write-combine: write the buffer, one quantum at most, in one go */
+static void combine_flush(const char *wc, uint64_t *wc_pos, size_t *wc_len)
+{
+    struct scull_loc loc;
+    loff_t p = *wc_pos;
+
+    if (!*wc_len)
+        return;
+    down_interruptible(&dev.sem);
+    scull_write_kernel_locked(&dev, wc, *wc_len, &p, &loc, cur);
+    up(&dev.sem);
+    *wc_len = 0;
+}
+
+struct appender {
+    pthread_t tid;
+    int id;
+    int locked;
+    uint64_t ops;
+    size_t bs;
+};
+
+/* one thread of append and append-locked, records of bs bytes of 'A' + id */
+static void *append_main(void *arg)
+{
+    struct appender *a = arg;
+    struct scull_cursor c = { 0 };
+    struct scull_loc loc;
+    char rec[256];
+    uint64_t i;
+    loff_t p, start;
+
+    memset(rec, 'A' + a->id % 26, a->bs);
+    for (i = 0; i < a->ops; i++) {
+        if (!a->locked) {
+            scull_log_write(&dev, &c, rec, a->bs, &p);
+            continue;
+        }
+        down_interruptible(&dev.sem);
+        for (start = p = dev.size; p < start + (loff_t)a->bs; )
+            if (scull_write_locked(&dev, rec + (p - start), start + a->bs - p,
+                                   &p, &loc, &c) <= 0)
+                break;
+        up(&dev.sem);
+    }
+    return NULL;
+}
+
+/*
+ * @ops appends by @threads threads, then check that the device is made of
+ * whole records only, none torn by another appender
+ */
+static int append_run(uint64_t ops, size_t bs, int locked, char *buf, uint64_t *ns)
+{
+    struct appender *as = calloc(threads, sizeof(*as));
+    uint64_t t0, k, total = ops / threads * threads;
+    size_t j;
+    int i;
+
+    scull_user_set_mode(&dev, locked ? SCULL_MODE_BYTES : SCULL_MODE_LOG);
+    t0 = now_ns();
+    for (i = 0; i < threads; i++) {
+        as[i] = (struct appender){ .id = i, .locked = locked, .ops = ops / threads, .bs = bs };
+        pthread_create(&as[i].tid, NULL, append_main, &as[i]);
+    }
+    for (i = 0; i < threads; i++)
+        pthread_join(as[i].tid, NULL);
+    *ns = now_ns() - t0;
+    free(as);
+
+    if ((uint64_t)dev.size != total * bs) {
+        fprintf(stderr, "scull_qbench: %llu bytes appended, %llu expected\n",
+                (unsigned long long)dev.size, (unsigned long long)(total * bs));
+        return -1;
+    }
+    for (k = 0; k < total; k++) {
+        if (scull_user_pread(&dev, buf, bs, k * bs) != (ssize_t)bs)
+            return -1;
+        for (j = 1; j < bs; j++)
+            if (buf[j] != buf[0]) {
+                fprintf(stderr, "scull_qbench: record %llu torn\n", (unsigned long long)k);
+                return -1;
+            }
+    }
+    scull_user_set_mode(&dev, SCULL_MODE_BYTES);
+    return 0;
+}
+
+/*
+ * the record tests, @ops records of @bs bytes, the first four bytes of
+ * each its number. Finding a record by scanning goes through half of
+ * them on average, so record-scan only does @ops / 1000 + 1 of them.
+ */
+static int record_run(uint64_t ops, size_t bs, char *buf, struct run *r)
+{
+    struct scull_rec_batch b;
+    uint32_t lens[64], n, len;
+    uint64_t t0, i, k, rnd = 7, scans = ops / 1000 + 1;
+    loff_t p;
+
+    if (bs < sizeof(n) || scull_user_set_mode(&dev, SCULL_MODE_RECORD))
+        return -1;
+    memset(&cursor, 0, sizeof(cursor));
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        n = i;
+        memcpy(buf, &n, sizeof(n));
+        if (scull_user_write(&dev, cur, buf, bs, &p) != (ssize_t)bs)
+            return -1;
+    }
+    r->ns[T_REC_WRITE] = now_ns() - t0;
+    r->ops[T_REC_WRITE] = ops;
+    r->bytes[T_REC_WRITE] = ops * bs;
+
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        k = rnd_next(&rnd) % ops;
+        p = k;
+        if (scull_user_read(&dev, cur, buf, bs, &p) != (ssize_t)bs ||
+            memcmp(buf, &k, sizeof(n)))    /* little endian */
+            goto bad;
+    }
+    r->ns[T_REC_SEEK] = now_ns() - t0;
+    r->ops[T_REC_SEEK] = ops;
+    r->bytes[T_REC_SEEK] = ops * bs;
+
+    t0 = now_ns();
+    b = (struct scull_rec_batch){ .buf = (uintptr_t)buf, .lens = (uintptr_t)lens,
+                                  .size = 64 * bs, .max = 64 };
+    for (i = 0, p = 0; scull_user_read_records(&dev, cur, &b, &p) > 0; i += b.nr) {
+        memcpy(&n, buf + (b.nr - 1) * bs, sizeof(n));
+        k = i + b.nr - 1;
+        if (n != k || lens[0] != bs)
+            goto bad;
+    }
+    k = i;
+    if (i != ops)
+        goto bad;
+    r->ns[T_REC_BATCH] = now_ns() - t0;
+    r->ops[T_REC_BATCH] = ops;
+    r->bytes[T_REC_BATCH] = ops * bs;
+
+    /* the same records in a byte stream, each after its length */
+    scull_user_set_mode(&dev, SCULL_MODE_BYTES);
+    len = bs;
+    for (i = 0, p = 0; i < ops; i++) {
+        n = i;
+        memcpy(buf, &n, sizeof(n));
+        if (scull_user_pwrite(&dev, &len, sizeof(len), p) != sizeof(len) ||
+            scull_user_pwrite(&dev, buf, bs, p + sizeof(len)) != (ssize_t)bs)
+            return -1;
+        p += sizeof(len) + bs;
+    }
+    t0 = now_ns();
+    for (i = 0; i < scans; i++) {
+        k = rnd_next(&rnd) % ops;
+        for (n = 0, p = 0; n < k; n++) {
+            scull_user_pread(&dev, &len, sizeof(len), p);
+            p += sizeof(len) + len;
+        }
+        if (scull_user_pread(&dev, buf, bs, p + sizeof(len)) != (ssize_t)bs ||
+            memcmp(buf, &k, sizeof(n)))
+            goto bad;
+    }
+    r->ns[T_REC_SCAN] = now_ns() - t0;
+    r->ops[T_REC_SCAN] = scans;
+    r->bytes[T_REC_SCAN] = scans * bs;
+    return 0;
+
+bad:
+    fprintf(stderr, "scull_qbench: record %llu read back wrong\n", (unsigned long long)k);
+    return -1;
+}
+
+/* one pass of every test on a fresh device of @size bytes */
+static int bench_once(uint64_t size, size_t bs, uint64_t small_ops, size_t small_bs,
+                      char *buf, char *wc, struct run *r)
+{
+    uint64_t t0, pos, ops, rnd = 42, follow_ops = 1000, sparse_ops = 10000, sum = 0, last;
+    uint64_t wc_pos = 0;
+    size_t wc_len;
+    struct scull_loc loc;
+    loff_t p;
+    ssize_t ret;
+
+    scull_user_init(&dev, quantum, qset);
+    memset(&cursor, 0, sizeof(cursor));     /* dev->generation starts again */
+
+    /* fill, one scull_write() call per quantum as the driver does */
+    scull_user_kmalloc_calls = 0;
+    t0 = now_ns();
+    for (pos = 0, ops = 0; pos < size; ops++) {
+        p = pos;
+        ret = scull_user_write(&dev, cur, buf, size - pos < bs ? size - pos : bs, &p);
+        if (ret <= 0) {
+            fprintf(stderr, "scull_qbench: write at %llu: %zd\n",
+                    (unsigned long long)pos, ret);
+            return -1;
+        }
+        pos = p;
+    }
+    r->ns[T_FILL] = now_ns() - t0;
+    r->ops[T_FILL] = ops;
+    r->bytes[T_FILL] = size;
+    r->fill_allocs = scull_user_kmalloc_calls;
+    r->fill_quanta = dev.nr_quanta;
+    r->fill_extents = dev.nr_extents;
+    r->fill_stat = dev.alloc;
+
+    t0 = now_ns();
+    for (pos = 0, ops = 0; pos < size; ops++) {
+        p = pos;
+        ret = scull_user_read(&dev, cur, buf, bs, &p);
+        if (ret <= 0)
+            break;
+        pos = p;
+    }
+    r->ns[T_READ] = now_ns() - t0;
+    r->ops[T_READ] = ops;
+    r->bytes[T_READ] = pos;
+
+    t0 = now_ns();
+    for (ops = 0; ops < small_ops; ops++) {
+        p = rnd_next(&rnd) % (size - small_bs + 1);
+        scull_user_write(&dev, cur, buf, small_bs, &p);
+    }
+    r->ns[T_RAND] = now_ns() - t0;
+    r->ops[T_RAND] = small_ops;
+    r->bytes[T_RAND] = small_ops * small_bs;
+
+    /* the per-call cost of a small read, offset math included */
+    t0 = now_ns();
+    for (ops = 0, pos = 0; ops < small_ops; ops++) {
+        if (pos + small_bs > size)
+            pos = 0;
+        p = pos;
+        scull_user_read(&dev, cur, buf, small_bs, &p);
+        pos += small_bs;
+    }
+    r->ns[T_SMALL] = now_ns() - t0;
+    r->ops[T_SMALL] = small_ops;
+    r->bytes[T_SMALL] = small_ops * small_bs;
+
+    /* scull_locate() alone, small_bs apart over the whole device */
+    t0 = now_ns();
+    for (ops = 0, pos = 0; ops < small_ops; ops++) {
+        scull_locate(&dev, pos, &loc);
+        sum += loc.item + loc.s_pos + loc.q_pos;
+        pos += small_bs;
+        if (pos >= size)
+            pos -= size;
+    }
+    r->ns[T_LOCATE] = now_ns() - t0;
+    r->ops[T_LOCATE] = small_ops;
+    r->bytes[T_LOCATE] = 0;
+
+    /* the index walk every read and write pays to reach the end of the device */
+    last = (size - 1) / ((uint64_t)quantum * qset);
+    t0 = now_ns();
+    for (ops = 0; ops < follow_ops; ops++)
+        if (!scull_follow(&dev, last))
+            break;
+    r->ns[T_FOLLOW] = now_ns() - t0;
+    r->ops[T_FOLLOW] = ops;
+    r->bytes[T_FOLLOW] = 0;
+
+    t0 = now_ns();
+    scull_trim(&dev);
+    r->ns[T_TRIM] = now_ns() - t0;
+    r->ops[T_TRIM] = 1;
+    r->bytes[T_TRIM] = 0;
+
+    /* the same fill, into quanta allocated (and zeroed) beforehand */
+    t0 = now_ns();
+    if (scull_fallocate_locked(&dev, 0, size, false)) {
+        fprintf(stderr, "scull_qbench: fallocate failed\n");
+        return -1;
+    }
+    r->ns[T_FALLOC] = now_ns() - t0;
+    r->ops[T_FALLOC] = 1;
+    r->bytes[T_FALLOC] = size;
+
+    memset(&cursor, 0, sizeof(cursor));
+    t0 = now_ns();
+    for (pos = 0, ops = 0; pos < size; ops++) {
+        p = pos;
+        ret = scull_user_write(&dev, cur, buf, size - pos < bs ? size - pos : bs, &p);
+        if (ret <= 0)
+            break;
+        pos = p;
+    }
+    r->ns[T_FALLOC_FILL] = now_ns() - t0;
+    r->ops[T_FALLOC_FILL] = ops;
+    r->bytes[T_FALLOC_FILL] = pos;
+    scull_trim(&dev);
+
+    /* each write allocates its own path, quantum set and quantum */
+    t0 = now_ns();
+    for (ops = 0; ops < sparse_ops; ops++) {
+        p = rnd_next(&rnd) % (scull_max_size - small_bs);
+        scull_user_write(&dev, cur, buf, small_bs, &p);
+    }
+    r->ns[T_SPARSE] = now_ns() - t0;
+    r->ops[T_SPARSE] = sparse_ops;
+    r->bytes[T_SPARSE] = sparse_ops * small_bs;
+
+    /* small appends, each one taking dev->sem and walking the index */
+    scull_trim(&dev);
+    t0 = now_ns();
+    for (ops = 0, pos = 0; ops < small_ops; ops++) {
+        if (pos + small_bs > size)
+            pos = 0;
+        p = pos;
+        while (p < pos + small_bs) {
+            ret = scull_user_write(&dev, cur, buf, pos + small_bs - p, &p);
+            if (ret <= 0)
+                break;
+        }
+        pos = p;
+    }
+    r->ns[T_WSMALL] = now_ns() - t0;
+    r->ops[T_WSMALL] = small_ops;
+    r->bytes[T_WSMALL] = small_ops * small_bs;
+
+    /* the same appends gathered up to the end of each quantum */
+    scull_trim(&dev);
+    t0 = now_ns();
+    for (ops = 0, pos = 0, wc_len = 0; ops < small_ops; ops++) {
+        size_t done = 0, n;
+
+        if (pos + small_bs > size) {
+            combine_flush(wc, &wc_pos, &wc_len);
+            pos = 0;
+        }
+        while (done < small_bs) {
+            if (!wc_len)
+                wc_pos = pos;
+            n = quantum - (wc_pos + wc_len) % quantum;
+            if (n > small_bs - done)
+                n = small_bs - done;
+            memcpy(wc + wc_len, buf + done, n);
+            wc_len += n;
+            done += n;
+            pos += n;
+            if ((wc_pos + wc_len) % quantum == 0)
+                combine_flush(wc, &wc_pos, &wc_len);
+        }
+    }
+    combine_flush(wc, &wc_pos, &wc_len);
+    r->ns[T_COMBINE] = now_ns() - t0;
+    r->ops[T_COMBINE] = small_ops;
+    r->bytes[T_COMBINE] = small_ops * small_bs;
+
+    /* the same number of appends, from all the threads at once */
+    if (append_run(small_ops, small_bs, 0, buf, &r->ns[T_APPEND]) ||
+        append_run(small_ops, small_bs, 1, buf, &r->ns[T_APPEND_LOCKED]))
+        return -1;
+    r->ops[T_APPEND] = r->ops[T_APPEND_LOCKED] = small_ops / threads * threads;
+    r->bytes[T_APPEND] = r->bytes[T_APPEND_LOCKED] = r->ops[T_APPEND] * small_bs;
+
+    if (record_run(small_ops, small_bs, buf, r))
+        return -1;
+
+    scull_user_destroy(&dev);
+    r->sum = sum;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int bench(uint64_t size, size_t bs, uint64_t small_ops, size_t small_bs, int repeat)
+{
+    size_t len = bs > 64 * small_bs ? bs : 64 * small_bs;   /* record-batch */
+    struct run *runs = calloc(repeat, sizeof(*runs));
+    uint64_t *ns = calloc(repeat, sizeof(*ns));
+    char *buf = malloc(len);
+    char *wc = malloc(quantum);
+    int i, t;
+
+    if (!buf || !wc || !runs || !ns) {
+        fprintf(stderr, "scull_qbench: out of memory\n");
+        return -1;
+    }
+    memset(buf, 'x', len);
+
+    for (i = 0; i < repeat; i++)
+        if (bench_once(size, bs, small_ops, small_bs, buf, wc, &runs[i]))
+            return -1;
+
+    /* the median is much steadier than the mean from one build to the next */
+    for (t = 0; t < T_NR; t++) {
+        for (i = 0; i < repeat; i++)
+            ns[i] = runs[i].ns[t];
+        qsort(ns, repeat, sizeof(*ns), cmp_u64);
+        report(test_names[t], size,
+               t == T_FALLOC_FILL ? bs : t == T_FALLOC ? 0 :
+               t == T_RAND || t == T_SMALL || t == T_LOCATE || t >= T_SPARSE ? small_bs : t < T_RAND ? bs : 0,
+               runs[0].ops[t], runs[0].bytes[t], ns[repeat / 2]);
+    }
+    printf("qalloc write-fill size=%llu kmalloc=%llu quanta=%llu extents=%llu stalls=%llu stall_ns=%llu stall_max_ns=%llu\n",
+           (unsigned long long)size, (unsigned long long)runs[0].fill_allocs,
+           (unsigned long long)runs[0].fill_quanta, (unsigned long long)runs[0].fill_extents,
+           (unsigned long long)runs[0].fill_stat.stalls,
+           (unsigned long long)runs[0].fill_stat.stall_ns,
+           (unsigned long long)runs[0].fill_stat.stall_max_ns);
+
+    free(runs);
+    free(ns);
+    free(buf);
+    free(wc);
+    return 0;
+}
+
+static uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'g': case 'G': v <<= 10; /* fall through */
+    case 'm': case 'M': v <<= 10; /* fall through */
+    case 'k': case 'K': v <<= 10;
+    }
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    const char *sizes = "1m,100m,1g";
+    uint64_t small_ops = 100000, size;
+    size_t bs = 0, small_bs = 64;
+    int c, repeat = 3;
+    char *list, *tok;
+
+    while ((c = getopt(argc, argv, "q:Q:s:b:n:B:r:GCXt:")) != -1) {
+        switch (c) {
+        case 'q': quantum = atoi(optarg); break;
+        case 'Q': qset = atoi(optarg); break;
+        case 's': sizes = optarg; break;
+        case 'b': bs = parse_size(optarg); break;
+        case 'n': small_ops = strtoull(optarg, NULL, 0); break;
+        case 'B': small_bs = parse_size(optarg); break;
+        case 'r': repeat = atoi(optarg); break;
+        case 'G': scull_pow2 = false; break;
+        case 'C': cur = NULL; break;
+        case 'X': scull_extent_max = 0; break;
+        case 't': threads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: scull_qbench [-q quantum] [-Q qset] [-s size[,size...]]"
+                    " [-b bs] [-n small ops] [-B small op size] [-r repeat] [-G] [-C] [-X] [-t appenders]\n");
+            return 2;
+        }
+    }
+    if (quantum < 1 || qset < 1 || repeat < 1 || threads < 1 || small_bs > 256) {
+        fprintf(stderr, "scull_qbench: bad geometry\n");
+        return 2;
+    }
+    if (!bs)
+        bs = quantum;
+
+    list = strdup(sizes);
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        size = parse_size(tok);
+        if (!size || small_bs > size) {
+            fprintf(stderr, "scull_qbench: bad size %s\n", tok);
+            return 2;
+        }
+        if (bench(size, bs, small_ops, small_bs, repeat))
+            return 1;
+    }
+    free(list);
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * scull_user.c -- what main.c provides to qset.c in the module:
+ * the geometry parameters and the setup of a device.
+ */
+#include "scull_user.h"
+#include "scull.h"
+#include "libscull_store.h"
+
+int scull_quantum = SCULL_QUANTUM;
+int scull_qset = SCULL_QSET;
+bool scull_pow2 = true;
+unsigned long long scull_max_size = SCULL_MAX_SIZE;
+unsigned int scull_extent_max = SCULL_EXTENT_MAX;
+
+unsigned long scull_user_kmalloc_fail;
+unsigned long scull_user_kmalloc_calls;
+
+void scull_user_init(struct scull_dev *dev, int quantum, int qset)
+{
+    /* scull_trim() puts the geometry back to the module parameters */
+    scull_quantum = quantum;
+    scull_qset = qset;
+
+    memset(dev, 0, sizeof(*dev));
+    scull_set_geometry(dev, quantum, qset);
+    sema_init(&dev->sem, 1);
+}
+
+void scull_user_destroy(struct scull_dev *dev)
+{
+    down_interruptible(&dev->sem);
+    scull_trim(dev);
+    up(&dev->sem);
+    scull_log_free(dev);
+    scull_rec_free(dev);
+    pthread_mutex_destroy(&dev->sem.lock);
+}
+
+/* like SCULL_IOC_SET_MODE: empty the device and change its mode */
+int scull_user_set_mode(struct scull_dev *dev, int mode)
+{
+    struct scull_log *log;
+    int ret = 0;
+
+    if (mode < 0 || mode > SCULL_MODE_MAX)
+        return -EINVAL;
+    if (mode == SCULL_MODE_LOG && scull_log_setup(dev))
+        return -ENOMEM;
+
+    log = scull_log_block(dev);
+    down_interruptible(&dev->sem);
+    if (mode == SCULL_MODE_RECORD)
+        ret = scull_rec_setup(dev);
+    else
+        scull_rec_free(dev);
+    if (!ret) {
+        scull_trim(dev);
+        dev->mode = mode;
+    }
+    up(&dev->sem);
+    scull_log_unblock(dev, log);
+    return ret;
+}
+
+/*
+ * like scull_read(): at most one quantum per call, or one record in
+ * record mode. @cur may be NULL
+ */
+ssize_t scull_user_read(struct scull_dev *dev, struct scull_cursor *cur,
+                        void *buf, size_t count, loff_t *pos)
+{
+    struct scull_loc loc;
+    ssize_t ret;
+
+    down_interruptible(&dev->sem);
+    if (dev->mode == SCULL_MODE_RECORD)
+        ret = scull_rec_read_locked(dev, buf, count, pos, &loc, cur);
+    else
+        ret = scull_read_locked(dev, buf, count, pos, &loc, cur);
+    up(&dev->sem);
+    return ret;
+}
+
+ssize_t scull_user_write(struct scull_dev *dev, struct scull_cursor *cur,
+                         const void *buf, size_t count, loff_t *pos)
+{
+    struct scull_loc loc;
+    ssize_t ret;
+
+    down_interruptible(&dev->sem);
+    if (dev->mode == SCULL_MODE_RECORD)
+        ret = scull_rec_write_locked(dev, buf, count, pos, &loc, cur);
+    else
+        ret = scull_write_locked(dev, buf, count, pos, &loc, cur);
+    up(&dev->sem);
+    return ret;
+}
+
+/* like SCULL_IOC_READ_RECORDS */
+int scull_user_read_records(struct scull_dev *dev, struct scull_cursor *cur,
+                            struct scull_rec_batch *b, loff_t *pos)
+{
+    int ret = -EINVAL;
+
+    down_interruptible(&dev->sem);
+    if (dev->mode == SCULL_MODE_RECORD)
+        ret = scull_rec_read_batch_locked(dev, b, pos, cur);
+    up(&dev->sem);
+    return ret;
+}
+
+/* like read(2)/write(2) loops in a program: go on until done or stuck */
+ssize_t scull_user_pread(struct scull_dev *dev, void *buf, size_t count, loff_t pos)
+{
+    struct scull_cursor cur = { 0 };
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < count) {
+        ret = scull_user_read(dev, &cur, (char *)buf + done, count - done, &pos);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    return done;
+}
+
+ssize_t scull_user_pwrite(struct scull_dev *dev, const void *buf, size_t count, loff_t pos)
+{
+    struct scull_cursor cur = { 0 };
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < count) {
+        ret = scull_user_write(dev, &cur, (const char *)buf + done, count - done, &pos);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        done += ret;
+    }
+    return done;
+}
+
+/* compute.c */
+const char scull_user_zero_page[PAGE_SIZE];
+
+/* lib/crc32.c without the tables: no inversion, the caller does it */
+u32 crc32c(u32 crc, const void *p, unsigned int len)
+{
+    const u8 *s = p;
+    int k;
+
+    while (len--) {
+        crc ^= *s++;
+        for (k = 0; k < 8; k++)
+            crc = crc >> 1 ^ (crc & 1 ? 0x82f63b78 : 0);
+    }
+    return crc;
+}
+
+/* lib/xxhash.c, the streaming XXH64 */
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3  1609587929392839161ULL
+#define PRIME64_4  9650029242287828579ULL
+#define PRIME64_5  2870177450012600261ULL
+
+static inline u64 xxh_rotl64(u64 x, int r)
+{
+    return x << r | x >> (64 - r);
+}
+
+static inline u64 xxh_get64(const u8 *p)
+{
+    u64 v;
+
+    memcpy(&v, p, sizeof(v));   /* little endian hosts only */
+    return v;
+}
+
+static inline u32 xxh_get32(const u8 *p)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static u64 xxh64_round(u64 acc, u64 input)
+{
+    acc += input * PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static u64 xxh64_merge_round(u64 acc, u64 val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+void xxh64_reset(struct xxh64_state *state, u64 seed)
+{
+    memset(state, 0, sizeof(*state));
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+int xxh64_update(struct xxh64_state *state, const void *input, size_t len)
+{
+    const u8 *p = input, *end = p + len;
+    int k;
+
+    state->total_len += len;
+    if (state->memsize + len < 32) {
+        memcpy(state->mem + state->memsize, p, len);
+        state->memsize += len;
+        return 0;
+    }
+    if (state->memsize) {
+        memcpy(state->mem + state->memsize, p, 32 - state->memsize);
+        for (k = 0; k < 4; k++)
+            state->v[k] = xxh64_round(state->v[k], xxh_get64(state->mem + 8 * k));
+        p += 32 - state->memsize;
+        state->memsize = 0;
+    }
+    for (; p + 32 <= end; p += 32)
+        for (k = 0; k < 4; k++)
+            state->v[k] = xxh64_round(state->v[k], xxh_get64(p + 8 * k));
+    memcpy(state->mem, p, end - p);
+    state->memsize = end - p;
+    return 0;
+}
+
+u64 xxh64_digest(const struct xxh64_state *state)
+{
+    const u8 *p = state->mem, *end = p + state->memsize;
+    u64 h;
+    int k;
+
+    if (state->total_len >= 32) {
+        h = xxh_rotl64(state->v[0], 1) + xxh_rotl64(state->v[1], 7) +
+            xxh_rotl64(state->v[2], 12) + xxh_rotl64(state->v[3], 18);
+        for (k = 0; k < 4; k++)
+            h = xxh64_merge_round(h, state->v[k]);
+    } else {
+        h = state->v[2] + PRIME64_5;
+    }
+    h += state->total_len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, xxh_get64(p));
+        h = xxh_rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (u64)xxh_get32(p) * PRIME64_1;
+        h = xxh_rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = xxh_rotl64(h, 11) * PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
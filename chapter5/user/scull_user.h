@@ -0,0 +1,402 @@
+/*
+ * scull_user.h -- just enough of the kernel to build qset.c in user space
+ *
+ * kmalloc/kfree map to malloc/free, copy_*_user to memcpy, the device
+ * semaphore to a pthread mutex (scull only uses it as a mutex), the
+ * spill file to a file descriptor and the tracepoints to nothing.
+ */
+#ifndef _SCULL_USER_H_
+#define _SCULL_USER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>   /* USHRT_MAX */
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>   /* offsetof() */
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>     /* clock_gettime() */
+#include <fcntl.h>    /* open() */
+#include <unistd.h>   /* pread(), pwrite() */
+#include <sys/types.h>  /* loff_t */
+#include <linux/types.h>  /* __u32, __u64 of the ioctl structures */
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+
+#define __user
+
+#ifndef ERESTARTSYS
+#define ERESTARTSYS 512
+#endif
+
+#define READ_ONCE(x)        __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val)  __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+#define pr_err(fmt, ...)    fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define prefetch(x)         __builtin_prefetch(x)
+
+#define min_t(type, a, b)   ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define max_t(type, a, b)   ((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+
+static inline int fls(unsigned int x)
+{
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define is_power_of_2(n)    ((n) != 0 && ((n) & ((n) - 1)) == 0)
+
+static inline int ilog2(unsigned long v)
+{
+    return 63 - __builtin_clzl(v);
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+static inline u64 div64_u64_rem(u64 dividend, u64 divisor, u64 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+/*
+ * kmalloc fails every scull_user_kmalloc_fail-th call if that is not 0,
+ * so that the fuzzer reaches the -ENOMEM paths too. The calls are
+ * counted in scull_user_kmalloc_calls either way.
+ */
+extern unsigned long scull_user_kmalloc_fail;
+extern unsigned long scull_user_kmalloc_calls;
+
+typedef unsigned int gfp_t;
+#define GFP_KERNEL 0u
+#define __GFP_NOWARN 0u
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    ++scull_user_kmalloc_calls;
+    if (scull_user_kmalloc_fail &&
+        scull_user_kmalloc_calls % scull_user_kmalloc_fail == 0)
+        return NULL;
+    return malloc(size);
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *)p);
+}
+
+#define kvmalloc(size, flags)   kmalloc(size, flags)
+#define kvfree(p)               kfree(p)
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+    void *p = kmalloc(n * size, flags);
+
+    if (p)
+        memset(p, 0, n * size);
+    return p;
+}
+
+#define BITS_PER_LONG       (8 * sizeof(long))
+#define BITS_TO_LONGS(n)    (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline bool test_bit(long nr, const unsigned long *addr)
+{
+    return addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG) & 1;
+}
+
+static inline void __set_bit(long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long clear_user(void *to, unsigned long n)
+{
+    memset(to, 0, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+struct semaphore {
+    pthread_mutex_t lock;
+};
+
+static inline void sema_init(struct semaphore *sem, int val)
+{
+    (void)val; /* always 1 in scull */
+    pthread_mutex_init(&sem->lock, NULL);
+}
+
+static inline int down_interruptible(struct semaphore *sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    return 0;
+}
+
+static inline void up(struct semaphore *sem)
+{
+    pthread_mutex_unlock(&sem->lock);
+}
+
+static inline void down(struct semaphore *sem)
+{
+    pthread_mutex_lock(&sem->lock);
+}
+
+#define cmpxchg(ptr, old, new)  __sync_val_compare_and_swap(ptr, old, new)
+
+/* the log mode (log.c): its reader/writer lock, tail and wait queue */
+struct rw_semaphore {
+    pthread_rwlock_t lock;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem)
+{
+    pthread_rwlock_init(&sem->lock, NULL);
+}
+
+static inline void down_read(struct rw_semaphore *sem)  { pthread_rwlock_rdlock(&sem->lock); }
+static inline void up_read(struct rw_semaphore *sem)    { pthread_rwlock_unlock(&sem->lock); }
+static inline void down_write(struct rw_semaphore *sem) { pthread_rwlock_wrlock(&sem->lock); }
+static inline void up_write(struct rw_semaphore *sem)   { pthread_rwlock_unlock(&sem->lock); }
+
+typedef struct {
+    int64_t counter;
+} atomic64_t;
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_set(atomic64_t *v, s64 i)
+{
+    __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline s64 atomic64_cmpxchg(atomic64_t *v, s64 old, s64 new)
+{
+    return __sync_val_compare_and_swap(&v->counter, old, new);
+}
+
+/* a wait queue is a condition variable, woken up by broadcast */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+#define wait_event(wq, condition) do {                      \
+        pthread_mutex_lock(&(wq).lock);                     \
+        while (!(condition))                                \
+            pthread_cond_wait(&(wq).cond, &(wq).lock);      \
+        pthread_mutex_unlock(&(wq).lock);                   \
+    } while (0)
+
+static inline void wake_up_all(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* compute.c: no signals, the zero page, and the hashes of lib/ in scull_user.c */
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define min3(a, b, c)       min(min(a, b), c)
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define U32_MAX             UINT32_MAX
+#define PAGE_SIZE           4096UL
+
+#define current             NULL
+#define signal_pending(t)   0
+#define fatal_signal_pending(t) 0
+#define cond_resched()      do { } while (0)
+
+extern const char scull_user_zero_page[PAGE_SIZE];
+#define ZERO_PAGE(vaddr)    scull_user_zero_page
+#define page_address(page)  ((void *)(page))
+
+#define u64_to_user_ptr(x)  ((void *)(uintptr_t)(x))
+#define put_user(x, ptr)    (*(ptr) = (x), 0)
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+    return kcalloc(1, size, flags);
+}
+
+#define kvzalloc(size, flags)   kzalloc(size, flags)
+
+u32 crc32c(u32 crc, const void *p, unsigned int len);
+
+struct xxh64_state {
+    u64 total_len;
+    u64 v[4];
+    u8 mem[32];
+    u32 memsize;
+};
+
+void xxh64_reset(struct xxh64_state *state, u64 seed);
+int xxh64_update(struct xxh64_state *state, const void *input, size_t len);
+u64 xxh64_digest(const struct xxh64_state *state);
+
+/* the backing file of spill.c */
+struct file {
+    int fd;
+};
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+#define IS_ERR(p)   ((unsigned long)(p) >= (unsigned long)-4095)
+#define PTR_ERR(p)  ((long)(p))
+#define ERR_PTR(e)  ((void *)(long)(e))
+
+static inline struct file *filp_open(const char *path, int flags, int mode)
+{
+    struct file *filp = malloc(sizeof(*filp));
+
+    if (!filp)
+        return ERR_PTR(-ENOMEM);
+    filp->fd = open(path, flags, mode);
+    if (filp->fd < 0) {
+        int err = -errno;
+
+        free(filp);
+        return ERR_PTR(err);
+    }
+    return filp;
+}
+
+static inline int filp_close(struct file *filp, void *id)
+{
+    (void)id;
+    close(filp->fd);
+    free(filp);
+    return 0;
+}
+
+static inline ssize_t kernel_read(struct file *filp, void *buf, size_t count, loff_t *pos)
+{
+    ssize_t ret = pread(filp->fd, buf, count, *pos);
+
+    if (ret < 0)
+        return -errno;
+    *pos += ret;
+    return ret;
+}
+
+static inline ssize_t kernel_write(struct file *filp, const void *buf, size_t count,
+                                   loff_t *pos)
+{
+    ssize_t ret = pwrite(filp->fd, buf, count, *pos);
+
+    if (ret < 0)
+        return -errno;
+    *pos += ret;
+    return ret;
+}
+
+/* the slots of the spill file: the lowest free id, from a bitmap */
+struct ida {
+    unsigned char *used;
+    unsigned int size;
+};
+
+#define DEFINE_IDA(name)    struct ida name = { NULL, 0 }
+
+static inline int ida_alloc(struct ida *ida, gfp_t flags)
+{
+    unsigned char *used;
+    unsigned int i, size;
+
+    (void)flags;
+    for (i = 0; i < ida->size; i++)
+        if (!ida->used[i])
+            break;
+    if (i == ida->size) {
+        size = ida->size ? 2 * ida->size : 64;
+        used = realloc(ida->used, size);
+        if (!used)
+            return -ENOMEM;
+        memset(used + ida->size, 0, size - ida->size);
+        ida->used = used;
+        ida->size = size;
+    }
+    ida->used[i] = 1;
+    return i;
+}
+
+static inline void ida_free(struct ida *ida, unsigned int id)
+{
+    if (id >= ida->size || !ida->used[id])
+        abort();    /* freed twice: the fuzzer wants to know */
+    ida->used[id] = 0;
+}
+
+/* no reserve of ready quanta (pool.c), the writers allocate every one */
+struct scull_dev;
+
+static inline void *scull_pool_get(struct scull_dev *dev)
+{
+    (void)dev;
+    return NULL;
+}
+
+#define trace_scull_write(...)   do { } while (0)
+#define trace_scull_follow(...)  do { } while (0)
+#define trace_scull_alloc(...)   do { } while (0)
+#define trace_scull_trim(...)    do { } while (0)
+
+#endif /* _SCULL_USER_H_ */
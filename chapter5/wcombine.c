@@ -0,0 +1,216 @@
+/*
+ * wcombine.c -- write combining of small writes, per open file
+ *
+ * A write contiguous with the buffered bytes is copied into the buffer
+ * of its file without taking dev->sem, walking the index or allocating
+ * a quantum. The buffer is written to the device, under dev->sem, in one
+ * piece when it reaches the end of its quantum, when the timer of
+ * wc.flush_ms fires, on fsync(), on close, before a read or SEEK_END of
+ * the same file and before any write that cannot be buffered.
+ *
+ * The writes taken into the buffer succeed at once; a flush failing
+ * later (-ENOMEM, or -EFBIG) drops the bytes and the error is returned
+ * by the next write, fsync() or close of the file, as for the page cache.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>     /* kmalloc() */
+#include <linux/errno.h>    /* error codes */
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>  /* msecs_to_jiffies() */
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
+    #include <asm/uaccess.h>    /* copy_*_user */
+#else
+    #include <linux/uaccess.h>    /* copy_*_user */
+#endif
+
+#include "scull.h"
+#include "scull_trace.h"    /* the tracepoints themselves are created in main.c */
+
+/*
+ * Write the buffer to the device, called with sf->wc_lock held. dev->sem
+ * is taken without being interruptible: a flush must not be lost to a
+ * signal, on close least of all.
+ */
+static void scull_wc_flush_locked(struct scull_file *sf)
+{
+	struct scull_dev *dev = sf->dev;
+	struct scull_loc loc = { .item = -1, .s_pos = -1 };
+	loff_t pos = sf->wc_pos;
+	size_t done = 0;
+	ssize_t retval = 0;
+
+	if (!sf->wc_len)
+		return;
+
+	down(&dev->sem);
+	/* the device was put in another mode since: drop the bytes */
+	if (dev->mode != SCULL_MODE_BYTES) {
+		up(&dev->sem);
+		if (!sf->wc_error)
+			sf->wc_error = -EBUSY;
+		sf->wc_len = 0;
+		return;
+	}
+	/* the buffer does not cross a quantum, this loops only after an error */
+	while (done < sf->wc_len) {
+		retval = scull_write_kernel_locked(dev, sf->wc_buf + done,
+				sf->wc_len - done, &pos, &loc, &sf->cur);
+		if (retval <= 0)
+			break;
+		done += retval;
+	}
+	up(&dev->sem);
+
+	trace_scull_write(dev->index, sf->wc_pos, sf->wc_len, loc.item, loc.s_pos, 0,
+			  retval < 0 ? retval : done);
+	if (retval < 0 && !sf->wc_error)
+		sf->wc_error = retval;
+	sf->wc_len = 0;
+	sf->wc.flushes++;
+}
+
+static void scull_wc_timer(struct work_struct *work)
+{
+	struct scull_file *sf = container_of(to_delayed_work(work),
+			struct scull_file, wc_work);
+
+	mutex_lock(&sf->wc_lock);
+	scull_wc_flush_locked(sf);
+	mutex_unlock(&sf->wc_lock);
+}
+
+void scull_wc_init(struct scull_file *sf)
+{
+	mutex_init(&sf->wc_lock);
+	INIT_DELAYED_WORK(&sf->wc_work, scull_wc_timer);
+}
+
+/*
+ * SCULL_IOC_SET_WCOMBINE: flush what is buffered, then start again with
+ * the new settings. The counters are reset.
+ */
+int scull_wc_set(struct scull_file *sf, const struct scull_wcombine *conf)
+{
+	size_t size = min_t(size_t, conf->size, sf->dev->quantum);
+	char *buf = NULL;
+
+	if (conf->flush_ms > SCULL_WC_MAX_MS)
+		return -EINVAL;
+	if (size) {
+		buf = kmalloc(size, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	if (mutex_lock_interruptible(&sf->wc_lock)) {
+		kfree(buf);
+		return -ERESTARTSYS;
+	}
+	scull_wc_flush_locked(sf);
+	/* not _sync: the timer takes wc_lock, and finds nothing to flush */
+	cancel_delayed_work(&sf->wc_work);
+	kfree(sf->wc_buf);
+	sf->wc_buf = buf;
+	sf->wc.size = size;
+	sf->wc.flush_ms = conf->flush_ms;
+	sf->wc.writes = 0;
+	sf->wc.flushes = 0;
+	mutex_unlock(&sf->wc_lock);
+	return 0;
+}
+
+/*
+ * Take a write into the buffer. Returns the bytes taken, 0 if the write
+ * cannot be buffered and must go to the device (the buffer was flushed
+ * first, so that it is not written over later), or an error.
+ */
+ssize_t scull_wc_write(struct scull_file *sf, const char __user *buf, size_t count,
+		loff_t *f_pos)
+{
+	struct scull_dev *dev = sf->dev;
+	loff_t pos = *f_pos;
+	ssize_t retval;
+	u32 q_pos;
+
+	if (mutex_lock_interruptible(&sf->wc_lock))
+		return -ERESTARTSYS;
+
+	/* an earlier flush failed: this write is the first to hear about it */
+	retval = sf->wc_error;
+	sf->wc_error = 0;
+	if (retval)
+		goto out;
+
+	if (sf->wc_len && pos != sf->wc_pos + sf->wc_len)
+		scull_wc_flush_locked(sf);
+
+	/* large writes, and those near the limit, go straight to the device */
+	if (!sf->wc_buf || !count || count >= sf->wc.size || pos < 0 ||
+	    (u64)pos + count > scull_max_size) {
+		scull_wc_flush_locked(sf);
+		retval = sf->wc_error;
+		sf->wc_error = 0;
+		goto out;
+	}
+
+	if (!sf->wc_len) {
+		/* a new buffer, up to the end of the quantum of @pos */
+		div_u64_rem(pos, dev->quantum, &q_pos);
+		sf->wc_pos = pos;
+		sf->wc_limit = min_t(size_t, sf->wc.size, dev->quantum - q_pos);
+		if (sf->wc.flush_ms)
+			schedule_delayed_work(&sf->wc_work, msecs_to_jiffies(sf->wc.flush_ms));
+	}
+
+	/* like the writes to the device, short at the end of the quantum */
+	count = min_t(size_t, count, sf->wc_limit - sf->wc_len);
+	if (copy_from_user(sf->wc_buf + sf->wc_len, buf, count)) {
+		retval = -EFAULT;
+		goto out;
+	}
+	sf->wc_len += count;
+	sf->wc.writes++;
+	*f_pos += count;
+	retval = count;
+
+	if (sf->wc_len == sf->wc_limit)
+		scull_wc_flush_locked(sf);
+
+out:
+	mutex_unlock(&sf->wc_lock);
+	return retval;
+}
+
+/*
+ * Write the buffer to the device now. With @report (fsync) returns, and
+ * forgets, the error of this flush or of an earlier one nobody was told
+ * about; reads and seeks leave it for the next write.
+ */
+int scull_wc_flush(struct scull_file *sf, bool report)
+{
+	int retval = 0;
+
+	mutex_lock(&sf->wc_lock);
+	scull_wc_flush_locked(sf);
+	if (report) {
+		retval = sf->wc_error;
+		sf->wc_error = 0;
+	}
+	mutex_unlock(&sf->wc_lock);
+	return retval;
+}
+
+/* the file is being closed: flush, free the buffer, and tell of any error */
+int scull_wc_release(struct scull_file *sf)
+{
+	cancel_delayed_work_sync(&sf->wc_work);
+	scull_wc_flush_locked(sf);    /* nobody else has the file any more */
+	kfree(sf->wc_buf);
+	sf->wc_buf = NULL;
+	return sf->wc_error;
+}